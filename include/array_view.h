@@ -0,0 +1,30 @@
+#ifndef ARRAYVIEW_H
+#define ARRAYVIEW_H
+
+#include <cstddef>
+#include <vector>
+
+// A read-only, non-owning view of a contiguous array
+// The viewed memory may belong to a std::vector or to a memory-mapped file
+template <typename T>
+class ArrayView
+{
+public:
+    ArrayView() : m_data(nullptr), m_size(0) {}
+    ArrayView(const T* data, std::size_t size) : m_data(data), m_size(size) {}
+    ArrayView(const std::vector<T>& vec) : m_data(vec.data()), m_size(vec.size()) {}
+    
+    const T* data() const { return m_data; }
+    std::size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+    
+    const T* begin() const { return m_data; }
+    const T* end() const { return m_data + m_size; }
+    
+    const T& operator[](std::size_t i) const { return m_data[i]; }
+private:
+    const T* m_data;
+    std::size_t m_size;
+};
+
+#endif // ARRAYVIEW_H
@@ -0,0 +1,35 @@
+#ifndef CHROUTER_H
+#define CHROUTER_H
+
+#include <vector>
+#include <cstdint>
+#include "base_classes.h"
+#include "geodb.h"
+#include "geopoint.h"
+#include "search_context.h"
+#include "contraction_hierarchy.h"
+#include "router.h"
+
+// Routes with a contraction hierarchy: a forward search from the start that only goes up
+// in rank meets a backward search from the end that only goes up too, and the shortcuts on
+// the path where they meet are unpacked back into the map's own points
+class CHRouter: public EdgeRouter
+{
+public:
+    // The hierarchy must have been built from geo_db, and both must outlive the router
+    CHRouter(const GeoDatabase& geo_db, const ContractionHierarchy& hierarchy);
+    virtual ~CHRouter();
+    
+    // Routes with SearchContexts kept per thread, so concurrent calls are safe
+    virtual std::vector<GeoPoint> route(const GeoPoint& pt1, const GeoPoint& pt2) const;
+    virtual std::vector<GeoPoint> route(const GeoPoint& pt1, const GeoPoint& pt2, std::vector<uint32_t>& edges) const;
+    
+    // Routes with the caller's SearchContexts, one for each direction
+    std::vector<GeoPoint> route(const GeoPoint& pt1, const GeoPoint& pt2, SearchContext& forward, SearchContext& backward,
+                                std::vector<uint32_t>& edges) const;
+private:
+    const GeoDatabase& m_geodb;
+    const ContractionHierarchy& m_hierarchy;
+};
+
+#endif // CHROUTER_H
@@ -0,0 +1,114 @@
+#ifndef CONTRACTIONHIERARCHY_H
+#define CONTRACTIONHIERARCHY_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "geodb.h"
+#include "array_view.h"
+#include "mapped_file.h"
+#include "map_snapshot.h"
+#include "search_context.h"
+
+// An arc of the hierarchy, stored at its lower ranked end
+// An original edge has no middle node; a shortcut stands for the path through its middle node,
+// which is ranked below both ends
+struct HierarchyArc
+{
+    uint32_t target;    // the higher ranked end
+    uint32_t middle;    // NO_NODE for an original edge
+    double weight;      // in miles
+};
+
+// On-disk layout of a saved hierarchy: a HierarchyHeader followed by its sections,
+// laid out like a map snapshot and mapped in place the same way
+const char HIERARCHY_MAGIC[8] = {'B', 'T', 'O', 'U', 'R', 'C', 'H', '1'};
+const uint32_t HIERARCHY_VERSION = 1;   // bump whenever a section's layout changes
+
+enum HierarchySection
+{
+    SECTION_RANKS,              // uint32_t per node
+    SECTION_UP_OFFSETS,         // uint32_t per node + 1, into SECTION_UP_ARCS
+    SECTION_UP_ARCS,            // HierarchyArc per arc leaving a node upward
+    SECTION_DOWN_OFFSETS,       // uint32_t per node + 1, into SECTION_DOWN_ARCS
+    SECTION_DOWN_ARCS,          // HierarchyArc per arc entering a node from above
+    NUM_HIERARCHY_SECTIONS
+};
+
+struct HierarchyHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint64_t fileSize;
+    uint64_t checksum;          // of every byte after the header
+    uint64_t mapFingerprint;    // GeoDatabase::fingerprint of the map it was built from
+    SnapshotSectionInfo sections[NUM_HIERARCHY_SECTIONS];
+};
+
+// A contraction hierarchy over a GeoDatabase's graph
+// Nodes are contracted one by one, least important first; contracting a node removes it from
+// the graph and adds a shortcut between two of its neighbors wherever the path through it
+// was the only shortest path between them. Every shortest path then has an equally short
+// path in the hierarchy that only goes up in rank and then only down, which a
+// bidirectional search finds while settling very few nodes
+class ContractionHierarchy
+{
+public:
+    ContractionHierarchy();
+    ~ContractionHierarchy();
+
+    // Contracts the graph one node at a time, least important first, working out every node's
+    // first priority in parallel
+    void build(const GeoDatabase& geodb);
+
+    // Contracts the graph in the order another hierarchy ranks its nodes, which must have been built
+    // for a map with the same nodes, such as one whose edges were only reweighted since
+    // Only the shortcuts are searched for again, which takes a fraction of the time build does
+    void build(const GeoDatabase& geodb, const ContractionHierarchy& order);
+
+    // Writes the hierarchy to a file that load maps into memory and uses in place
+    bool save(const std::string& hierarchy_file) const;
+
+    // Loads a hierarchy written by save; returns false if it can't be read or wasn't built from this map
+    bool load(const std::string& hierarchy_file, const GeoDatabase& geodb);
+
+    uint32_t num_nodes() const { return static_cast<uint32_t>(m_ranks.size()); }
+    uint32_t rank(uint32_t node) const { return m_ranks[node]; }
+
+    // The arcs u -> v with rank(v) > rank(u), leaving u
+    const HierarchyArc* up_begin(uint32_t u) const { return m_upArcs.data() + m_upOffsets[u]; }
+    const HierarchyArc* up_end(uint32_t u) const { return m_upArcs.data() + m_upOffsets[u + 1]; }
+
+    // The arcs v -> u with rank(v) > rank(u), entering u; their target is v
+    const HierarchyArc* down_begin(uint32_t u) const { return m_downArcs.data() + m_downOffsets[u]; }
+    const HierarchyArc* down_end(uint32_t u) const { return m_downArcs.data() + m_downOffsets[u + 1]; }
+
+    // Appends the original nodes on the arc from -> to, after from and up to and including to
+    // The arc must be in the hierarchy: an up arc of from or a down arc of to
+    void unpack(uint32_t from, uint32_t to, std::vector<uint32_t>& path) const;
+private:
+    ArrayView<uint32_t> m_ranks;
+    ArrayView<uint32_t> m_upOffsets;
+    ArrayView<HierarchyArc> m_upArcs;
+    ArrayView<uint32_t> m_downOffsets;
+    ArrayView<HierarchyArc> m_downArcs;
+
+    std::vector<uint32_t> m_rankStorage;
+    std::vector<uint32_t> m_upOffsetStorage;
+    std::vector<HierarchyArc> m_upArcStorage;
+    std::vector<uint32_t> m_downOffsetStorage;
+    std::vector<HierarchyArc> m_downArcStorage;
+
+    uint64_t m_fingerprint;     // of the map the hierarchy was built from
+    MappedFile m_file;  // the mapped hierarchy the tables are viewed in, if it was loaded
+
+    const HierarchyArc* find_arc(uint32_t from, uint32_t to) const;
+    void clear();
+    void use_storage();
+
+    ContractionHierarchy(const ContractionHierarchy&) = delete;
+    ContractionHierarchy& operator=(const ContractionHierarchy&) = delete;
+};
+
+#endif // CONTRACTIONHIERARCHY_H
@@ -0,0 +1,53 @@
+#ifndef DISTANCEMATRIX_H
+#define DISTANCEMATRIX_H
+
+#include <vector>
+#include <cstdint>
+#include "geodb.h"
+#include "geopoint.h"
+#include "stops.h"
+
+// The shortest distances in miles between every pair of a set of points, such as a tour's stops
+// Each point gets one Dijkstra search that stops as soon as it has settled every other point,
+// and the searches for different points run in parallel
+class DistanceMatrix
+{
+public:
+    DistanceMatrix(const GeoDatabase& geodb);
+    ~DistanceMatrix();
+
+    // Computes the distance from every point to every other
+    // With keep_paths, each search's shortest path tree is kept so path can build any route later
+    // Returns false, leaving the matrix empty, if a point isn't on the map
+    bool compute(const std::vector<GeoPoint>& points, bool keep_paths = false);
+
+    // Computes the matrix for the stops' points of interest, in stop order
+    // Returns false, leaving the matrix empty, if a point of interest isn't in the map data
+    bool compute(const Stops& stops, bool keep_paths = false);
+
+    int size() const { return m_size; }
+
+    // The distance from one point to another by their indices, or infinity if there is no route
+    double distance(int from, int to) const { return m_distances[static_cast<std::size_t>(from) * m_size + to]; }
+
+    // The route from one point to another, built from the kept search trees
+    // Empty if there is no route or the paths weren't kept
+    std::vector<GeoPoint> path(int from, int to) const;
+private:
+    // A node settled by a search and the node before it on its shortest path
+    struct TreeEntry
+    {
+        uint32_t node;
+        uint32_t previous;
+    };
+
+    const GeoDatabase& m_geodb;
+    int m_size;
+    std::vector<uint32_t> m_nodes;          // point -> node ID
+    std::vector<double> m_distances;        // m_distances[from * m_size + to]
+    std::vector<std::vector<TreeEntry>> m_trees;   // point -> its search's settled nodes, sorted by node
+
+    void clear();
+};
+
+#endif // DISTANCEMATRIX_H
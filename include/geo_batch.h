@@ -0,0 +1,49 @@
+#ifndef GEOBATCH_H
+#define GEOBATCH_H
+
+#include <cstddef>
+#include <vector>
+
+#include "geopoint.h"
+
+// Batch versions of geotools' distance and angle functions, for many pairs of points at once
+// Coordinates are taken as structure of arrays, latitudes and longitudes in degrees in separate
+// arrays, so that where the CPU has AVX2 four pairs are worked out per instruction
+// Without AVX2 the same arithmetic runs one pair at a time, so the results never depend on the
+// machine; they agree with geotools to within a few units in the last place
+
+// Sets distances[i] to the distance in miles from (lat1[i], lon1[i]) to (lat2[i], lon2[i]),
+// as distance_earth_miles computes it, for every i in [0, count)
+void batch_distance_miles(const double* lat1, const double* lon1, const double* lat2, const double* lon2,
+                          std::size_t count, double* distances);
+
+// Sets bearings[i] to the angle of the line from (lat1[i], lon1[i]) to (lat2[i], lon2[i]), in radians in
+// [-pi, pi] as atan2 gives it; angle_of_line is the same angle in degrees, made positive
+void batch_bearings(const double* lat1, const double* lon1, const double* lat2, const double* lon2,
+                    std::size_t count, double* bearings);
+
+// Sets turns[i] to the turn from bearings[i] onto bearings[i + 1], in degrees in [0, 360) as
+// angle_of_turn gives it, for every i in [0, count - 1)
+void batch_turn_angles(const double* bearings, std::size_t count, double* turns);
+
+// Whether the CPU has AVX2, and the batch functions are using it
+bool batch_simd_supported();
+bool batch_simd_enabled();
+
+// Turns the AVX2 kernels off or back on, for comparing them with the scalar ones; they start on where supported
+void set_batch_simd(bool enabled);
+
+// A path's points as structure of arrays, so each leg of it is a pair of neighboring entries
+struct PathColumns
+{
+    std::vector<double> latitudes;
+    std::vector<double> longitudes;
+
+    void assign(const std::vector<GeoPoint>& path);
+    std::size_t size() const { return latitudes.size(); }
+};
+
+// The length of a path in miles: the sum of distance_earth_miles over its legs, in order
+double path_length_miles(const std::vector<GeoPoint>& path);
+
+#endif // GEOBATCH_H
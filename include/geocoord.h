@@ -0,0 +1,78 @@
+#ifndef GEOCOORD_H
+#define GEOCOORD_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string_view>
+
+#include "geopoint.h"
+
+// A compact location used inside the map and router: latitude and longitude
+// in fixed point units of 1e-7 degrees, the precision of the map data
+// GeoPoints are converted to and from GeoCoords only at the public API boundary
+struct GeoCoord
+{
+    int32_t lat;
+    int32_t lon;
+
+    // Both halves packed into one integer, for hashing and equality
+    // Biasing the signed halves keeps the keys in (lat, lon) order
+    uint64_t key() const
+    {
+        return (static_cast<uint64_t>(static_cast<uint32_t>(lat) ^ 0x80000000u) << 32) |
+            (static_cast<uint32_t>(lon) ^ 0x80000000u);
+    }
+
+    // in degrees, correctly rounded, so exactly the value a GeoPoint parses from the same 7 decimal places
+    double latitude() const { return lat / 1e7; }
+    double longitude() const { return lon / 1e7; }
+};
+
+inline bool operator==(const GeoCoord& lhs, const GeoCoord& rhs)
+{
+    return lhs.key() == rhs.key();
+}
+
+inline bool operator!=(const GeoCoord& lhs, const GeoCoord& rhs)
+{
+    return lhs.key() != rhs.key();
+}
+
+// Orders GeoCoords by latitude, then longitude
+inline bool operator<(const GeoCoord& lhs, const GeoCoord& rhs)
+{
+    return lhs.key() < rhs.key();
+}
+
+// for unordered containers keyed by GeoCoord
+struct GeoCoordHash
+{
+    std::size_t operator()(const GeoCoord& coord) const
+    {
+        // mix the halves so nearby coordinates spread across buckets
+        uint64_t k = coord.key() * 0x9E3779B97F4A7C15ULL;
+        return static_cast<std::size_t>(k ^ (k >> 32));
+    }
+};
+
+// Reads a decimal number of degrees such as "-118.4794734" from the front of text,
+// skipping blanks before it, as 1e-7 degree units rounded half away from zero
+// Returns false, leaving text alone, if it doesn't start with a number
+bool parse_fixed7(std::string_view& text, int32_t& value);
+
+// Converts a GeoPoint at the API boundary, exactly for coordinate strings with up to 7 decimal places
+// Returns false if the GeoPoint's coordinate strings aren't numbers
+bool to_geocoord(const GeoPoint& pt, GeoCoord& coord);
+
+// Reads a location given in decimal degrees, such as a GPS position from a user, to the precision of the map data
+// Returns false unless both are numbers, the latitude within 90 degrees of the equator and the
+// longitude within 180 of the prime meridian
+bool parse_location(std::string_view latitude, std::string_view longitude, GeoCoord& coord);
+
+// Converts back to a GeoPoint whose coordinate strings have 7 decimal places, as in the map data
+GeoPoint to_geopoint(const GeoCoord& coord);
+
+// The midpoint of two GeoCoords, rounded to the nearest unit like midpoint() in geotools.h
+GeoCoord midpoint(const GeoCoord& p1, const GeoCoord& p2);
+
+#endif // GEOCOORD_H
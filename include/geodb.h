@@ -2,10 +2,39 @@
 #define GEODB_H
 
 #include <string>
+#include <string_view>
 #include <vector>
+#include <cstdint>
+#include <memory>
 #include "base_classes.h"
 #include "geopoint.h"
-#include "hashmap.h"
+#include "geocoord.h"
+#include "array_view.h"
+#include "mapped_file.h"
+#include "map_tiles.h"
+
+// A point of interest, whose name is stored in a separate character table
+struct PoiRecord
+{
+    uint32_t nameOffset;
+    uint32_t nameLength;
+    uint32_t node;
+};
+
+struct ParsedMap;
+struct MapChange;
+
+// Marks a pair of nodes with no street between them
+const uint32_t NO_STREET = UINT32_MAX;
+
+// Marks a pair of nodes with no edge between them
+const uint32_t NO_EDGE = UINT32_MAX;
+
+// The eight compass directions by sector, counterclockwise from east, as edge_compass gives them
+const char* const COMPASS_DIRECTIONS[8] = {"east", "northeast", "north", "northwest", "west", "southwest", "south", "southeast"};
+
+// The sector of an angle_of_line in degrees: each direction covers the 45 degrees centered on it
+uint8_t compass_sector(double angle);
 
 class GeoDatabase: public GeoDatabaseBase
 {
@@ -13,18 +42,143 @@ public:
     GeoDatabase();
     virtual ~GeoDatabase();
     
+    // Loads either a text map data file or a snapshot written by save_snapshot
     virtual bool load(const std::string& map_data_file);
     virtual bool get_poi_location(const std::string& poi, GeoPoint& point) const;
     virtual std::vector<GeoPoint> get_connected_points(const GeoPoint& pt) const;
     virtual std::string get_street_name(const GeoPoint& pt1, const GeoPoint& pt2) const;
+    
+    // Builds this map as base with changes applied in order, such as from a delta file (see map_delta.h)
+    // base is left as it was, so searches over it can go on meanwhile; this map is never tiled
+    // Returns false, leaving this map empty, if a change names a segment or point of interest that
+    // isn't on the map, with failed set to that change's index
+    bool load(const GeoDatabase& base, const std::vector<MapChange>& changes, std::size_t& failed);
+    
+    // Writes the loaded map as a binary snapshot, which load maps into memory and uses in place
+    bool save_snapshot(const std::string& snapshot_file) const;
+    
+    // Reads all of a loaded snapshot and checks it against its checksums, which load leaves to this
+    // for an untiled snapshot, and for a tiled one to when each tile is read in
+    // Returns true if the map wasn't loaded from a snapshot
+    bool verify_snapshot() const;
+    
+    // A checksum of the node and edge tables, so data derived from the graph and saved
+    // separately (such as a contraction hierarchy) can tell if it was built from this map
+    uint64_t fingerprint() const;
+    
+    // Renumbers the nodes tile by tile, tiles being tile_degrees on a side, so a snapshot saved
+    // afterwards is read in a tile at a time as searches reach each tile (see map_tiles.h)
+    // Returns false, leaving the map as it was, if tiles can't be that size
+    bool tile(double tile_degrees);
+    bool is_tiled() const { return m_tileSize != 0; }
+    
+    // Reads in the tiles within radius tiles of a point, ahead of searches from it
+    void load_tiles_around(const GeoPoint& pt, int radius = 1) const;
+    
+    // The tiles within radius tiles of a point, read in as load_tiles_around does; none if not tiled
+    // A tile's nodes are the node IDs in [tile_first_node(tile), tile_end_node(tile))
+    std::vector<uint32_t> tiles_around(const GeoPoint& pt, int radius = 1) const;
+    uint32_t num_tiles() const { return static_cast<uint32_t>(m_tiles.size()); }
+    uint32_t tile_first_node(uint32_t tile) const { return m_tiles[tile].firstNode; }
+    uint32_t tile_end_node(uint32_t tile) const { return m_tiles[tile].endNode; }
+    
+    // Reads in the tile holding a node, for searches to call as they reach each node
+    // Does nothing unless the map is a tiled snapshot, whose tiles are read in as they are needed
+    void touch_node(uint32_t node) const { if (m_pager) m_pager->touch_node(node); }
+    
+    // How much of a tiled snapshot may be read in before the tiles used least recently are
+    // dropped, in bytes; 0, the default, for no limit
+    void set_tile_memory_cap(std::size_t bytes);
+    TileStats tile_stats() const;
+    
+    // Graph access by node ID, for the router
+    // Every distinct GeoPoint in the map data is assigned a dense ID in [0, num_nodes())
+    // The edges leaving node u are the edge indices in [edges_begin(u), edges_end(u))
+    uint32_t num_nodes() const { return static_cast<uint32_t>(m_nodes.size()); }
+    uint32_t num_edges() const { return static_cast<uint32_t>(m_edgeTargets.size()); }
+    bool get_node_id(const GeoPoint& pt, uint32_t& id) const;
+    bool get_node_id(const GeoCoord& coord, uint32_t& id) const;
+    GeoPoint get_node_point(uint32_t id) const { return to_geopoint(m_nodes[id]); }
+    const GeoCoord& get_node_coord(uint32_t id) const { return m_nodes[id]; }
+    uint32_t edges_begin(uint32_t id) const { return m_edgeOffsets[id]; }
+    uint32_t edges_end(uint32_t id) const { return m_edgeOffsets[id + 1]; }
+    uint32_t edge_target(uint32_t edge) const { return m_edgeTargets[edge]; }
+    double edge_length(uint32_t edge) const { return m_edgeLengths[edge]; }   // in miles
+    
+    // Each edge's direction is worked out once, when the map is built: its angle is the atan2 of its
+    // latitude and longitude differences, in radians, as angle_of_line and angle_of_turn compute it,
+    // and its compass sector indexes COMPASS_DIRECTIONS
+    double edge_angle(uint32_t edge) const { return m_edgeAngles[edge]; }
+    uint8_t edge_compass(uint32_t edge) const { return m_edgeCompass[edge]; }
+    
+    // The edge from one node to the next, or NO_EDGE if they aren't connected
+    // If they are connected more than once, the connection read last is found
+    uint32_t find_edge(uint32_t from, uint32_t to) const;
+    
+    // Street names are interned: every distinct name has one ID in [0, num_streets()),
+    // and every edge holds the ID of the street it's on
+    uint32_t num_streets() const { return m_streetOffsets.empty() ? 0 : static_cast<uint32_t>(m_streetOffsets.size()) - 1; }
+    uint32_t edge_street(uint32_t edge) const { return m_edgeStreets[edge]; }
+    std::string_view street_name(uint32_t street) const;
+    
+    // The street connecting one node to the next, or NO_STREET if they aren't connected
+    uint32_t get_street_id(uint32_t from, uint32_t to) const;
+    
+    // Points of interest by index in [0, num_pois()), in name order
+    uint32_t num_pois() const { return static_cast<uint32_t>(m_pois.size()); }
+    std::string_view poi_name(uint32_t poi) const { return std::string_view(m_poiChars.data() + m_pois[poi].nameOffset, m_pois[poi].nameLength); }
+    uint32_t poi_node(uint32_t poi) const { return m_pois[poi].node; }
 private:
-    // Types of HashMaps:
-    // Point of interest -> GeoPoint
-    // GeoPoint -> all connected GeoPoints
-    // 2 GeoPoints -> street
-    HashMap<GeoPoint> m_poiMap;
-    HashMap<std::vector<GeoPoint>> m_connectionsMap;
-    HashMap<std::string> m_streetMap;
+    // The map is stored as flat tables, each viewed through an ArrayView
+    // A text map is parsed into the storage vectors below and viewed from there;
+    // a snapshot is viewed directly in the mapped file
+    
+    // Node ID -> location, sorted by GeoCoord key so a location's ID is found by binary search
+    ArrayView<GeoCoord> m_nodes;
+    
+    // Compressed sparse row adjacency: the neighbors of node u are
+    // m_edgeTargets[m_edgeOffsets[u]] ... m_edgeTargets[m_edgeOffsets[u + 1] - 1]
+    ArrayView<uint32_t> m_edgeOffsets;
+    ArrayView<uint32_t> m_edgeTargets;
+    ArrayView<double> m_edgeLengths;
+    ArrayView<uint32_t> m_edgeStreets;  // edge -> street ID
+    ArrayView<double> m_edgeAngles;
+    ArrayView<uint8_t> m_edgeCompass;
+    
+    // Street ID -> name, as [m_streetOffsets[i], m_streetOffsets[i + 1]) in m_streetChars
+    ArrayView<uint32_t> m_streetOffsets;
+    ArrayView<char> m_streetChars;
+    
+    // Points of interest, sorted by name
+    ArrayView<PoiRecord> m_pois;
+    ArrayView<char> m_poiChars;
+    
+    // Tiles in node order, if tiled
+    ArrayView<MapTile> m_tiles;
+    uint32_t m_tileSize;    // in GeoCoord units, or 0 if not tiled
+    
+    std::vector<GeoCoord> m_nodeStorage;
+    std::vector<uint32_t> m_edgeOffsetStorage;
+    std::vector<uint32_t> m_edgeTargetStorage;
+    std::vector<double> m_edgeLengthStorage;
+    std::vector<uint32_t> m_edgeStreetStorage;
+    std::vector<double> m_edgeAngleStorage;
+    std::vector<uint8_t> m_edgeCompassStorage;
+    std::vector<uint32_t> m_streetOffsetStorage;
+    std::vector<char> m_streetCharStorage;
+    std::vector<PoiRecord> m_poiStorage;
+    std::vector<char> m_poiCharStorage;
+    std::vector<MapTile> m_tileStorage;
+    
+    // The mapped snapshot the tables are viewed in, or the text map while it is parsed
+    MappedFile m_file;
+    std::unique_ptr<TilePager> m_pager;     // reads in the mapped snapshot's tiles, if it's tiled
+    
+    void build_tables(const ParsedMap& parsed);
+    bool load_snapshot();
+    bool find_tile(int32_t row, int32_t col, uint32_t& tile) const;
+    void clear();
+    void use_storage();
 };
 
 #endif // GEODB_H
@@ -2,125 +2,267 @@
 #define HASHMAP_H
 
 #include <string>
+#include <string_view>
 #include <vector>
-#include <list>
-#include <algorithm>
+#include <utility>
+#include <cstdint>
+#include <functional>
+#include <type_traits>
 
-// Associates strings (keys) with values
-template <typename T>
+// How a HashMap takes the keys it's given: string keys as string_views, so looking one up
+// never builds a string, and other keys by reference
+template <typename Key>
+struct HashMapKey
+{
+    typedef const Key& Ref;
+};
+
+template <>
+struct HashMapKey<std::string>
+{
+    typedef std::string_view Ref;
+};
+
+// Associates keys, strings unless another type is given, with values
+// Associations are stored back to back in insertion order, and an open-addressing
+// table of slots using Robin Hood probing maps each key's hash to its association
+template <typename T, typename Key = std::string, typename Hash = std::hash<std::decay_t<typename HashMapKey<Key>::Ref>>>
 class HashMap
 {
+    typedef typename HashMapKey<Key>::Ref KeyRef;
 public:
-    HashMap(double max_load = 0.75) : m_hashTable(10), m_size(0), m_buckets(10), m_maxLoadFactor(max_load)  // constructor
+    HashMap(double max_load = 0.75) : m_maxLoadFactor(max_load)  // constructor
     {
-        if (max_load <= 0)
+        if (max_load <= 0 || max_load > MAX_LOAD)
             m_maxLoadFactor = 0.75;
     }
-    
+
     ~HashMap()  // destructor; deletes all of the items in the hashmap
     {
-        
+
     }
-    
+
     int size() const    // return the number of associations in the hashmap
     {
-        return m_size;
+        return static_cast<int>(m_entries.size());
+    }
+
+    // Makes room for count associations, so inserting that many never rehashes
+    // A count that isn't positive does nothing
+    void reserve(int count)
+    {
+        if (count <= 0)
+            return;
+        m_entries.reserve(count);
+
+        std::size_t slots = m_slots.size();
+        while (count > slots * m_maxLoadFactor)
+            slots *= 2;
+        if (slots != m_slots.size())
+            rehash(slots);
+    }
+
+    // The hash of a key, which can be computed once and passed to the insert and find
+    // overloads that take a hash, e.g. to look the same key up in several maps
+    static std::size_t hash_key(KeyRef key)
+    {
+        return Hash()(key);
     }
-    
+
     // The insert method associates one item (key) with another (value).
     // If no association currently exists with that key, this method inserts
     // a new association into the hashmap with that key/value pair. If there is
     // already an association with that key in the hashmap, then the item
     // associated with that key is replaced by the second parameter (value).
     // Thus, the hashmap must contain no duplicate keys.
-    void insert(const std::string& key, const T& value)
+    void insert(KeyRef key, const T& value)
+    {
+        insert(key, hash_key(key), value);
+    }
+
+    void insert(KeyRef key, std::size_t hash, const T& value)
     {
-        T* valuePtr = find(key);
-        
+        T* valuePtr = find(key, hash);
+
         if (valuePtr == nullptr)    // key not found
-        {
-            if ((m_size + 1) / static_cast<double>(m_buckets) > m_maxLoadFactor)    // rehash
-            {
-                HashMap<T> newHm(m_buckets * 2, m_maxLoadFactor);
-                
-                for (const auto& li : m_hashTable)
-                    for (const auto& pr : li)
-                        newHm.insert(pr.first, pr.second);
-                
-                swap(*this, newHm); // copy and swap
-            }   // newHm, which has the original hash map, is destructed here
-            
-            m_hashTable[hashString(key) % m_buckets].push_back(std::pair<std::string, T>(key, value));
-            m_size++;
-        }
+            add(key, hash, value);
         else    // key found
             *valuePtr = value;
     }
-    
+
     // Defines the bracket operator for HashMap, so you can use your map like this:
     // your_map["david"] = 2.99;
     // If the key does not exist in the hashmap, this will create a new entry in
     // the hashmap and map it to the default value of type T (0 for builtin types).
     // It returns a reference to the newly created value in the map.
-    T& operator[](const std::string& key)
+    T& operator[](KeyRef key)
     {
-        T* valuePtr = find(key);
-        
+        std::size_t hash = hash_key(key);
+        T* valuePtr = find(key, hash);
+
         if (valuePtr == nullptr)    // key not found
-        {
-            insert(key, T());
-            return *find(key);
-        }
-        
+            return add(key, hash, T());
+
         return *valuePtr;   // key found
     }
-    
+
     // If no association exists with the given key, return nullptr; otherwise,
     // return a pointer to the value associated with that key. This pointer can be
-    // used to examine that value within the map.
-    const T* find(const std::string& key) const
+    // used to examine that value within the map until the next insertion.
+    const T* find(KeyRef key) const
     {
-        for (const auto& pr : m_hashTable[hashString(key) % m_buckets])
-            if (pr.first == key)    // key found
-                return &(pr.second);
-        
-        return nullptr; // key not found
+        return find(key, hash_key(key));
     }
-    
+
+    const T* find(KeyRef key, std::size_t hash) const
+    {
+        std::size_t pos = find_slot(key, hash);
+        if (pos == NOT_FOUND)
+            return nullptr;
+        return &(m_entries[m_slots[pos].entry].second);
+    }
+
     // If no association exists with the given key, return nullptr; otherwise,
     // return a pointer to the value associated with that key. This pointer can be
-    // used to examine that value or modify it directly within the map.
-    T* find(const std::string& key) {
+    // used to examine that value or modify it directly within the map until the next insertion.
+    T* find(KeyRef key) {
         const auto& hm = *this;
         return const_cast<T*>(hm.find(key));
     }
+
+    T* find(KeyRef key, std::size_t hash) {
+        const auto& hm = *this;
+        return const_cast<T*>(hm.find(key, hash));
+    }
+
+    // Removes the association with the given key, returning false if there was none
+    // The last association inserted takes the removed one's place in iteration order
+    bool erase(KeyRef key)
+    {
+        std::size_t pos = find_slot(key, hash_key(key));
+        if (pos == NOT_FOUND)
+            return false;
+        uint32_t entry = m_slots[pos].entry;
+
+        // shift the slots after it that aren't home back by one, so no probe stops short of them
+        std::size_t mask = m_slots.size() - 1;
+        for (std::size_t next = (pos + 1) & mask; m_slots[next].entry != EMPTY && ((next - m_slots[next].hashBits) & mask) != 0; next = (next + 1) & mask)
+        {
+            m_slots[pos] = m_slots[next];
+            pos = next;
+        }
+        m_slots[pos] = Slot{EMPTY, 0};
+
+        uint32_t last = static_cast<uint32_t>(m_entries.size() - 1);
+        if (entry != last)
+        {
+            for (pos = hash_key(m_entries[last].first) & mask; m_slots[pos].entry != last; pos = (pos + 1) & mask)
+                ;
+            m_slots[pos].entry = entry;
+            m_entries[entry] = std::move(m_entries[last]);
+        }
+        m_entries.pop_back();
+        return true;
+    }
+
+    // Iterates over the (key, value) associations in insertion order
+    typename std::vector<std::pair<Key, T>>::const_iterator begin() const
+    {
+        return m_entries.begin();
+    }
+
+    typename std::vector<std::pair<Key, T>>::const_iterator end() const
+    {
+        return m_entries.end();
+    }
 private:
-    std::vector<std::list<std::pair<std::string, T>>> m_hashTable;
-    int m_size;
-    int m_buckets;
+    // A slot in the table refers to an association by its index in m_entries
+    // and keeps the low bits of its key's hash, so most mismatches never compare strings
+    struct Slot
+    {
+        uint32_t entry;
+        uint32_t hashBits;
+    };
+
+    static constexpr uint32_t EMPTY = UINT32_MAX;
+    static constexpr std::size_t NOT_FOUND = SIZE_MAX;
+    static constexpr std::size_t MIN_SLOTS = 16;    // always a power of two
+    static constexpr double MAX_LOAD = 0.95;    // open addressing needs some empty slots
+
+    std::vector<std::pair<Key, T>> m_entries;
+    std::vector<Slot> m_slots = std::vector<Slot>(MIN_SLOTS, Slot{EMPTY, 0});
     double m_maxLoadFactor;
-    
-    std::size_t hashString(const std::string& key) const
+
+    // The position of the slot referring to the key's association, or NOT_FOUND
+    std::size_t find_slot(KeyRef key, std::size_t hash) const
     {
-        return std::hash<std::string>()(key);
+        std::size_t mask = m_slots.size() - 1;
+        uint32_t hashBits = static_cast<uint32_t>(hash);
+
+        // Robin Hood probing keeps every run of slots ordered by distance from the
+        // keys' home slots, so the search stops at the first slot whose key is
+        // closer to home than the key searched for would be
+        for (std::size_t pos = hash & mask, distance = 0; ; pos = (pos + 1) & mask, distance++)
+        {
+            const Slot& slot = m_slots[pos];
+            if (slot.entry == EMPTY || ((pos - slot.hashBits) & mask) < distance)
+                return NOT_FOUND;
+
+            if (slot.hashBits == hashBits && m_entries[slot.entry].first == key)
+                return pos;
+        }
     }
-    
-    HashMap(int buckets, double max_load) : m_hashTable(buckets), m_size(0), m_buckets(buckets), m_maxLoadFactor(max_load)
+
+    // Adds an association for a key known not to be in the map
+    T& add(KeyRef key, std::size_t hash, const T& value)
     {
-        if (max_load <= 0)
-            m_maxLoadFactor = 0.75;
+        if ((m_entries.size() + 1) > m_slots.size() * m_maxLoadFactor)
+            rehash(m_slots.size() * 2);
+
+        m_entries.emplace_back(Key(key), value);
+        place(Slot{static_cast<uint32_t>(m_entries.size() - 1), static_cast<uint32_t>(hash)});
+        return m_entries.back().second;
     }
-    
-    HashMap(const HashMap&) = delete;   // copy constructor
-    HashMap& operator=(const HashMap&) = delete;    // assignment operator
-    
-    void swap(HashMap& hm1, HashMap& hm2)
+
+    // Puts a slot into the table, displacing any slot that is closer to its home than the
+    // new slot is to its own, and carrying the displaced slot onward in its place
+    void place(Slot slot)
     {
-        std::swap(hm1.m_hashTable, hm2.m_hashTable);
-        std::swap(hm1.m_size, hm2.m_size);
-        std::swap(hm1.m_buckets, hm2.m_buckets);
-        std::swap(hm1.m_maxLoadFactor, hm2.m_maxLoadFactor);
+        std::size_t mask = m_slots.size() - 1;
+        std::size_t pos = slot.hashBits & mask;
+
+        for (std::size_t distance = 0; ; pos = (pos + 1) & mask, distance++)
+        {
+            Slot& current = m_slots[pos];
+            if (current.entry == EMPTY)
+            {
+                current = slot;
+                return;
+            }
+
+            std::size_t currentDistance = (pos - current.hashBits) & mask;
+            if (currentDistance < distance)
+            {
+                std::swap(current, slot);
+                distance = currentDistance;
+            }
+        }
     }
+
+    // Rebuilds the table with a new number of slots, which must be a power of two
+    // Only slots move; the associations and their hashes are reused as is
+    void rehash(std::size_t slots)
+    {
+        std::vector<Slot> oldSlots(slots, Slot{EMPTY, 0});
+        std::swap(m_slots, oldSlots);
+
+        for (const auto& slot : oldSlots)
+            if (slot.entry != EMPTY)
+                place(slot);
+    }
+
+    HashMap(const HashMap&) = delete;   // copy constructor
+    HashMap& operator=(const HashMap&) = delete;    // assignment operator
 };
 
 #endif // HASHMAP_H
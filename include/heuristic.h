@@ -0,0 +1,65 @@
+#ifndef HEURISTIC_H
+#define HEURISTIC_H
+
+#include <vector>
+#include <cstdint>
+#include "geodb.h"
+
+// A heuristic function h(n) for the router: a lower bound on the distance in miles from node n to a target node
+// Both heuristics below are admissible (they never overestimate) and consistent
+// (h(u) <= length(u, v) + h(v) for every edge), so A* finds optimal paths with them
+// and never has to reopen a closed node
+class Heuristic
+{
+public:
+    Heuristic() {}
+    virtual ~Heuristic() {}
+    virtual double estimate(uint32_t node, uint32_t target) const = 0;
+};
+
+// The straight line (chord) distance through the Earth between two nodes, which is never longer than
+// the great-circle distance along the surface that edge lengths are measured in
+// Every node's position is projected onto the unit sphere once, so an estimate needs no trigonometry,
+// except on a tiled map, whose nodes are projected for each estimate as searches reach their tiles
+class GreatCircleHeuristic: public Heuristic
+{
+public:
+    GreatCircleHeuristic(const GeoDatabase& geodb);
+    virtual double estimate(uint32_t node, uint32_t target) const;
+private:
+    struct UnitVector
+    {
+        double x;
+        double y;
+        double z;
+    };
+    
+    const GeoDatabase& m_geodb;
+    std::vector<UnitVector> m_positions;    // node ID -> position on the unit sphere, or empty if tiled
+    
+    UnitVector position(uint32_t node) const;
+};
+
+// ALT (A*, landmarks and the triangle inequality): for a landmark L, the triangle inequality
+// gives |dist(L, target) - dist(L, node)| <= dist(node, target)
+// A few landmarks far apart near the map's edges are chosen when the heuristic is built,
+// and their distances to every node are stored; the estimate is the best bound over all
+// landmarks and the great-circle distance
+class LandmarkHeuristic: public Heuristic
+{
+public:
+    LandmarkHeuristic(const GeoDatabase& geodb, int num_landmarks = 8);
+    virtual double estimate(uint32_t node, uint32_t target) const;
+    
+    const std::vector<uint32_t>& landmarks() const { return m_landmarks; }
+private:
+    GreatCircleHeuristic m_greatCircle;
+    std::vector<uint32_t> m_landmarks;
+    uint32_t m_numNodes;
+    
+    // m_distances[i * m_numNodes + n] is the distance from landmark i to node n,
+    // or infinity if node n can't be reached from it
+    std::vector<double> m_distances;
+};
+
+#endif // HEURISTIC_H
@@ -0,0 +1,35 @@
+#ifndef JSON_H
+#define JSON_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <utility>
+
+// A parsed JSON value
+struct JsonValue
+{
+    enum Type { NUL, BOOLEAN, NUMBER, STRING, ARRAY, OBJECT };
+    
+    Type type = NUL;
+    bool boolean = false;
+    double number = 0;
+    std::string text;   // a string's contents, or a number as it was written
+    std::vector<JsonValue> items;   // an array's elements
+    std::vector<std::pair<std::string, JsonValue>> members;     // an object's members, in order
+    
+    // An object's member with the given name, or nullptr if there is none
+    const JsonValue* find(std::string_view name) const;
+};
+
+// Parses one JSON value, which may be surrounded by whitespace
+// Returns false if the text is not exactly one well-formed value
+bool parse_json(std::string_view text, JsonValue& value);
+
+// Appends a value as compact JSON
+void write_json(std::string& out, const JsonValue& value);
+
+// Appends a string as a quoted, escaped JSON string
+void write_json_string(std::string& out, std::string_view text);
+
+#endif // JSON_H
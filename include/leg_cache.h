@@ -0,0 +1,97 @@
+#ifndef LEGCACHE_H
+#define LEGCACHE_H
+
+#include <string>
+#include <vector>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <unordered_map>
+#include "base_classes.h"
+#include "geopoint.h"
+#include "router.h"
+
+// A routed leg: the path between two points and its length in miles
+struct CachedLeg
+{
+    std::vector<GeoPoint> path;
+    std::vector<uint32_t> edges;    // along the path, if the router gives them
+    double distance;
+};
+
+// A router that remembers the legs another router finds, keyed by their two endpoints,
+// such as the locations of a tour's points of interest
+// At most capacity legs are kept, and the least recently used leg is dropped to make room
+// The cache is split into shards with a lock each, so concurrent calls rarely wait on each other
+class LegCache: public EdgeRouter
+{
+public:
+    // The router and the map it routes on must outlive the cache
+    LegCache(const RouterBase& router, const GeoDatabase& geodb, std::size_t capacity = 4096);
+    virtual ~LegCache();
+    
+    virtual std::vector<GeoPoint> route(const GeoPoint& pt1, const GeoPoint& pt2) const;
+    virtual std::vector<GeoPoint> route(const GeoPoint& pt1, const GeoPoint& pt2, std::vector<uint32_t>& edges) const;
+    
+    // The leg from pt1 to pt2, routing it if it isn't cached; its path is empty if there is no route
+    std::shared_ptr<const CachedLeg> leg(const GeoPoint& pt1, const GeoPoint& pt2) const;
+    
+    std::size_t size() const;
+    uint64_t hits() const { return m_hits; }
+    uint64_t misses() const { return m_misses; }
+    
+    // Writes the cached legs to a file, tagged with the fingerprint of the map they were routed on
+    bool save(const std::string& cache_file, uint64_t map_fingerprint) const;
+    
+    // Adds the legs saved in a file, if it was saved for the same map
+    // Returns false if the file can't be read, is for a different map or names an edge the map doesn't have
+    bool load(const std::string& cache_file, uint64_t map_fingerprint);
+private:
+    // A leg's endpoints, as GeoCoord keys
+    struct LegKey
+    {
+        uint64_t from;
+        uint64_t to;
+        bool operator==(const LegKey& other) const { return from == other.from && to == other.to; }
+    };
+    
+    struct LegKeyHash
+    {
+        std::size_t operator()(const LegKey& key) const
+        {
+            uint64_t k = (key.from * 0x9E3779B97F4A7C15ULL) ^ key.to;
+            k *= 0xC2B2AE3D27D4EB4FULL;
+            return static_cast<std::size_t>(k ^ (k >> 32));
+        }
+    };
+    
+    // Legs ordered from most to least recently used, indexed by key
+    struct Shard
+    {
+        std::mutex lock;
+        std::list<std::pair<LegKey, std::shared_ptr<const CachedLeg>>> legs;
+        std::unordered_map<LegKey, decltype(legs)::iterator, LegKeyHash> index;
+    };
+    
+    static const std::size_t NUM_SHARDS = 16;
+    
+    const RouterBase& m_router;
+    const GeoDatabase& m_geodb;
+    const EdgeRouter* m_edgeRouter;     // the same router, if it gives its routes' edges
+    std::size_t m_shardCapacity;
+    mutable Shard m_shards[NUM_SHARDS];
+    mutable std::atomic<uint64_t> m_hits;
+    mutable std::atomic<uint64_t> m_misses;
+    
+    Shard& shard(const LegKey& key) const { return m_shards[LegKeyHash()(key) % NUM_SHARDS]; }
+    void insert(const LegKey& key, std::shared_ptr<const CachedLeg> leg) const;
+    void touch(const CachedLeg& leg) const;
+    
+    LegCache(const LegCache&) = delete;
+    LegCache& operator=(const LegCache&) = delete;
+};
+
+#endif // LEGCACHE_H
@@ -0,0 +1,133 @@
+#ifndef LIVEMAP_H
+#define LIVEMAP_H
+
+#include <cstddef>
+#include <cstdint>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "geodb.h"
+#include "heuristic.h"
+#include "contraction_hierarchy.h"
+#include "router.h"
+#include "ch_router.h"
+#include "leg_cache.h"
+#include "tour_generator.h"
+#include "poi_index.h"
+#include "spatial_index.h"
+#include "map_delta.h"
+
+// How long each phase of setting up took, in milliseconds, in order
+typedef std::vector<std::pair<std::string, double>> PhaseTimes;
+
+// How tours are routed, which every version of a live map is set up with
+struct RoutingOptions
+{
+    int numLandmarks = 0;           // 0 to guide A* by great-circle distance alone
+    bool bidirectional = false;
+    bool useHierarchy = false;
+    std::string hierarchyFile;      // a saved hierarchy to use instead of building one
+    bool optimizeOrder = false;
+    bool keepLast = false;
+    bool legCache = false;
+    std::string legCacheFile;       // legs saved by an earlier run to start the leg cache with
+    bool poiIndex = false;          // for serving searches
+    double maxSnapMiles = DEFAULT_MAX_SNAP_MILES;   // how far off the map a stop's location may be
+};
+
+// One version of a map and everything built over it to route tours: the router, with any
+// landmarks or hierarchy it needs, a spatial index it snaps locations off the map with, the
+// tour generator, and optionally a leg cache and POI index
+// A version never changes once built, so searches over it are never disturbed by updates
+class MapVersion
+{
+public:
+    MapVersion(std::shared_ptr<const GeoDatabase> geodb, uint64_t epoch);
+    ~MapVersion();
+
+    // Builds the router and the rest over the map, adding the time each part took to phases if given
+    // Returns false if options name a hierarchy file that can't be loaded for this map
+    // A leg cache file saved for a different map is ignored, as LegCache::load does
+    // Given a version whose map differs from this one's only in edges reweighted, the hierarchy is
+    // contracted in the same order as that version's, rather than ordered afresh
+    bool build(const RoutingOptions& options, PhaseTimes* phases = nullptr, const MapVersion* reweighted = nullptr);
+
+    uint64_t epoch() const { return m_epoch; }     // 0 for the map as loaded, then 1 more for each update
+    const GeoDatabase& geodb() const { return *m_geodb; }
+    const TourGenerator& generator() const { return *m_generator; }
+    const SpatialIndex& spatial_index() const { return *m_spatialIndex; }
+    const SnappingRouter& router() const { return *m_snappingRouter; }     // routes between any locations
+    const LegCache* leg_cache() const { return m_legCache.get(); }    // nullptr if not caching legs
+    const PoiIndex* poi_index() const { return m_poiIndex.get(); }    // nullptr if not indexed
+private:
+    // declared so that each part is destroyed before the parts it refers to
+    std::shared_ptr<const GeoDatabase> m_geodb;
+    uint64_t m_epoch;
+    std::unique_ptr<LandmarkHeuristic> m_landmarks;
+    std::unique_ptr<ContractionHierarchy> m_hierarchy;
+    std::unique_ptr<RouterBase> m_router;
+    std::unique_ptr<LegCache> m_legCache;
+    std::unique_ptr<SpatialIndex> m_spatialIndex;
+    std::unique_ptr<SnappingRouter> m_snappingRouter;
+    std::unique_ptr<TourGenerator> m_generator;
+    std::unique_ptr<PoiIndex> m_poiIndex;
+
+    MapVersion(const MapVersion&) = delete;
+    MapVersion& operator=(const MapVersion&) = delete;
+};
+
+// A map that can be changed while tours are routed over it
+// Readers pin the current version and keep using it however long they take; an update's changes
+// are applied to the newest map at once, and the version over it is built off to the side by a
+// thread of the live map's own, then published in one step, so a tour is routed on the map before
+// the update or after it, never on a mix
+// A version is freed once the last reader pinning it lets go
+class LiveMap
+{
+public:
+    LiveMap(const RoutingOptions& options);
+    ~LiveMap();     // finishes a version being built, but drops any update not yet being built
+
+    // Builds and publishes the first version, as MapVersion::build does
+    bool start(std::shared_ptr<const GeoDatabase> geodb, PhaseTimes* phases = nullptr);
+
+    // The version to route a tour on; it stays valid for as long as it's held
+    std::shared_ptr<const MapVersion> current() const;
+
+    // Applies changes to the newest map and returns without waiting for the version over it to be
+    // built; readers go on with the current version until it's published
+    // Updates that come in while a version is being built are published together in the next one,
+    // so not every epoch is published
+    // Sets epoch to the one the changes are published in; returns false, changing nothing, if a
+    // change names a segment or point of interest that isn't on the map, with failed set to its index
+    bool update(const std::vector<MapChange>& changes, std::size_t& failed, uint64_t& epoch);
+
+    // Waits until a version of at least the given epoch is published
+    void wait_for(uint64_t epoch) const;
+private:
+    RoutingOptions m_options;
+
+    std::mutex m_updateLock;            // guards the newest map and the builder's state
+    std::condition_variable m_updated;
+    std::shared_ptr<const GeoDatabase> m_newest;    // with every update applied
+    uint64_t m_newestEpoch;
+    uint64_t m_builtEpoch;              // of the newest map the builder has taken
+    std::size_t m_reweights;            // segments reweighted since then, or SIZE_MAX if other changes were made
+    bool m_stopping;
+    std::thread m_builder;
+
+    mutable std::mutex m_lock;          // guards m_current
+    mutable std::condition_variable m_published;
+    std::shared_ptr<const MapVersion> m_current;
+
+    void build_versions();
+
+    LiveMap(const LiveMap&) = delete;
+    LiveMap& operator=(const LiveMap&) = delete;
+};
+
+#endif // LIVEMAP_H
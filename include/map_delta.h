@@ -0,0 +1,40 @@
+#ifndef MAPDELTA_H
+#define MAPDELTA_H
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "geocoord.h"
+
+// A change to a loaded map, such as a road closure, read from a delta file with one change per line:
+//   add STREET|lat1 lon1 lat2 lon2                   a two-way street segment
+//   remove lat1 lon1 lat2 lon2                       the segment between two points
+//   reweight lat1 lon1 lat2 lon2 FACTOR              the segment's length, as FACTOR times its
+//                                                    length on the ground, such as for a slow block
+//   add-poi NAME|lat lon|lat1 lon1 lat2 lon2         a point of interest on a segment, replacing
+//                                                    any point of interest of the same name
+//   remove-poi NAME
+// Blank lines and lines starting with '#' are skipped
+// A segment's changes take in the halves it was split into for points of interest on it, as if
+// they were one edge, but never the paths from its midpoint to the points of interest
+struct MapChange
+{
+    enum Kind { ADD_SEGMENT, REMOVE_SEGMENT, REWEIGHT_SEGMENT, ADD_POI, REMOVE_POI };
+    Kind kind;
+    std::string name;       // the street, or the point of interest
+    GeoCoord from;          // the segment's ends
+    GeoCoord to;
+    GeoCoord poi;           // where a point of interest added is
+    double factor;          // for a reweight, at least 1 so great-circle distance stays a lower bound
+    std::size_t line;       // in the delta, counting from 1
+};
+
+// Parses the text of a delta file
+// Returns false if a line is malformed, with bad_line set to its line number
+bool parse_map_delta(std::string_view text, std::vector<MapChange>& changes, std::size_t& bad_line);
+
+// Reads and parses a delta file; bad_line is 0 if the file can't be read
+bool load_map_delta(const std::string& delta_file, std::vector<MapChange>& changes, std::size_t& bad_line);
+
+#endif // MAPDELTA_H
@@ -0,0 +1,37 @@
+#ifndef MAPPARSER_H
+#define MAPPARSER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "geocoord.h"
+
+// A directed edge read from the map data, before its endpoints are assigned node IDs
+struct RawEdge
+{
+    GeoCoord from;
+    GeoCoord to;
+    uint32_t street;    // index into ParsedMap::streets
+};
+
+// The contents of a text map data file, in file order
+// Names are views into the parsed text, which must outlive the ParsedMap
+struct ParsedMap
+{
+    std::vector<RawEdge> edges;     // every connection in both directions
+    std::vector<std::string_view> streets;  // one per street segment, after "a path" at index 0
+    std::vector<std::pair<std::string_view, GeoCoord>> pois;
+    std::vector<double> lengths;    // each edge's length in miles, or empty to measure them from their ends
+};
+
+// Index of "a path" in ParsedMap::streets, the name of every edge to or from a point of interest
+const uint32_t PATH_STREET = 0;
+
+// Parses the text of a map data file, split into chunks of whole street segments
+// that are parsed on all cores and then appended in file order
+// Returns false if the text is malformed
+bool parse_map_data(const char* data, std::size_t size, ParsedMap& map);
+
+#endif // MAPPARSER_H
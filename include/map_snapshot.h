@@ -0,0 +1,91 @@
+#ifndef MAPSNAPSHOT_H
+#define MAPSNAPSHOT_H
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include "array_view.h"
+#include "mapped_file.h"
+
+// On-disk layout of a compiled map snapshot:
+// a SnapshotHeader followed by the sections it describes
+// Every section starts at an 8-byte aligned offset and holds one GeoDatabase table
+// exactly as it is laid out in memory, so a mapped snapshot is used in place
+// Integers are stored in host byte order; byteOrder lets a loader reject a foreign snapshot
+
+const char SNAPSHOT_MAGIC[8] = {'B', 'T', 'O', 'U', 'R', 'M', 'A', 'P'};
+const uint32_t SNAPSHOT_VERSION = 5;    // bump whenever a section's layout changes
+const uint32_t SNAPSHOT_BYTE_ORDER = 0x01020304;
+
+enum SnapshotSection
+{
+    SECTION_NODES,              // GeoCoord per node, sorted by key, or by tile and then key if tiled
+    SECTION_EDGE_OFFSETS,       // uint32_t per node + 1
+    SECTION_EDGE_TARGETS,       // uint32_t per edge
+    SECTION_EDGE_LENGTHS,       // double per edge
+    SECTION_EDGE_STREETS,       // uint32_t street ID per edge
+    SECTION_EDGE_ANGLES,        // double per edge
+    SECTION_EDGE_COMPASS,       // uint8_t compass sector per edge
+    SECTION_STREET_OFFSETS,     // uint32_t per street + 1, into SECTION_STREET_CHARS
+    SECTION_STREET_CHARS,       // distinct street names, back to back
+    SECTION_POIS,               // PoiRecord per point of interest, sorted by name
+    SECTION_POI_CHARS,          // point of interest names, back to back
+    SECTION_TILES,              // MapTile per tile, in node order; empty unless tiled
+    NUM_SNAPSHOT_SECTIONS
+};
+
+struct SnapshotSectionInfo
+{
+    uint64_t offset;    // from the start of the file
+    uint64_t size;      // in bytes
+};
+
+struct SnapshotHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint64_t fileSize;
+    uint64_t checksum;  // of every byte after the header, or if tiled, of the sections no tile checksums
+    uint32_t tileSize;  // in GeoCoord units, or 0 if the map isn't tiled
+    uint32_t reserved;
+    SnapshotSectionInfo sections[NUM_SNAPSHOT_SECTIONS];
+};
+
+// 64-bit FNV-1a hash, used as the snapshot checksum
+uint64_t snapshot_checksum(const char* data, std::size_t size);
+
+// test if a file's first bytes are a snapshot header
+bool is_snapshot(const char* data, std::size_t size);
+
+// test if the edges of nodes [first_node, end_node) are well formed: their offsets don't go back
+// or past the edge tables, and their targets and streets are IDs on the map
+// Reads only those nodes' rows, so a tiled snapshot checks each tile as it's read in
+bool edges_well_formed(const ArrayView<uint32_t>& edge_offsets, const ArrayView<uint32_t>& edge_targets,
+                       const ArrayView<uint32_t>& edge_streets, uint32_t num_streets, uint32_t first_node, uint32_t end_node);
+
+// Appends a table to a file being built in memory as a section starting at an 8-byte aligned offset
+template <typename T>
+void append_section(std::vector<char>& file, SnapshotSectionInfo& info, const ArrayView<T>& table)
+{
+    file.resize((file.size() + 7) & ~static_cast<std::size_t>(7), 0);
+    info.offset = file.size();
+    info.size = table.size() * sizeof(T);
+    const char* bytes = reinterpret_cast<const char*>(table.data());
+    file.insert(file.end(), bytes, bytes + table.size() * sizeof(T));
+}
+
+// Points a table's view at its section of a mapped file
+// returns false if the section doesn't fit in the file or isn't a whole number of rows
+template <typename T>
+bool view_section(const MappedFile& file, const SnapshotSectionInfo& info, ArrayView<T>& table)
+{
+    if (info.offset % alignof(T) != 0 || info.size % sizeof(T) != 0 ||
+        info.offset > file.size() || info.size > file.size() - info.offset)
+        return false;
+
+    table = ArrayView<T>(reinterpret_cast<const T*>(file.data() + info.offset), info.size / sizeof(T));
+    return true;
+}
+
+#endif // MAPSNAPSHOT_H
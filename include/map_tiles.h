@@ -0,0 +1,109 @@
+#ifndef MAPTILES_H
+#define MAPTILES_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "array_view.h"
+#include "mapped_file.h"
+#include "map_snapshot.h"
+
+// A tiled map is cut into square tiles of a fixed size in degrees, and numbers its nodes tile
+// by tile, in (row, column) order and then by key within each tile, so a tile's nodes and
+// their edges are contiguous in every node and edge table
+// A tiled snapshot is mapped without being read through: each tile is read and checked against
+// its own checksum the first time a search reaches it, and once the tiles read exceed a memory
+// cap, the ones used least recently are dropped from memory until a search needs them again
+
+struct MapTile
+{
+    int32_t row;            // floor(latitude / tile size)
+    int32_t col;            // floor(longitude / tile size)
+    uint32_t firstNode;
+    uint32_t endNode;       // one past the tile's last node
+    uint64_t checksum;      // of the tile's rows in every node and edge section
+};
+
+// The tile row or column of a latitude or longitude in GeoCoord units
+inline int32_t tile_index(int32_t coordinate, uint32_t tile_size)
+{
+    int64_t c = coordinate;
+    int64_t size = tile_size;
+    return static_cast<int32_t>(c >= 0 ? c / size : -((-c + size - 1) / size));
+}
+
+// A tile's byte ranges in a snapshot: its rows of the node table, its run of edge offsets,
+// and its edges' rows of each edge table
+// Returns false if its edge offsets point outside the edge tables
+struct TileExtent
+{
+    std::uint64_t offset;
+    std::uint64_t size;
+};
+bool tile_extents(const SnapshotHeader& header, const ArrayView<uint32_t>& edge_offsets, const MapTile& tile,
+                  std::vector<TileExtent>& extents);
+
+// The checksum of a tile's byte ranges in a snapshot laid out in memory
+uint64_t tile_checksum(const char* snapshot, const std::vector<TileExtent>& extents);
+
+struct TileStats
+{
+    std::size_t tiles = 0;
+    std::size_t resident = 0;           // tiles read and not dropped since
+    std::size_t residentBytes = 0;
+    std::uint64_t loads = 0;
+    std::uint64_t evictions = 0;
+    std::uint64_t damaged = 0;          // tiles whose checksum didn't match when they were read
+};
+
+// Reads the tiles of a mapped snapshot in as searches reach them, and drops the least
+// recently used ones once more than the memory cap is read
+// Safe to use from several threads; a dropped tile's pages are read back from the file by the
+// OS if a search still in it touches them, so dropping never invalidates anything
+class TilePager
+{
+public:
+    TilePager(const MappedFile& file, const SnapshotHeader& header, ArrayView<MapTile> tiles, ArrayView<uint32_t> edge_offsets);
+    ~TilePager();
+
+    // Reads in the tile holding a node, if it isn't already
+    // A thread stepping from node to node within one tile only compares IDs
+    void touch_node(uint32_t node);
+
+    // Reads in a tile by its index in the tile table, if it isn't already
+    void load(uint32_t tile);
+
+    void set_memory_cap(std::size_t bytes);     // 0 for no cap
+    TileStats stats() const;
+private:
+    const MappedFile& m_file;
+    SnapshotHeader m_header;
+    ArrayView<MapTile> m_tiles;
+    ArrayView<uint32_t> m_edgeOffsets;
+    ArrayView<uint32_t> m_edgeTargets;     // for checking the edges of each tile read in
+    ArrayView<uint32_t> m_edgeStreets;
+    uint32_t m_numStreets;
+    uint64_t m_id;      // tells this pager apart from earlier ones in each thread's last tile
+
+    // Each tile's last use on the clock, or 0 if it isn't resident
+    std::unique_ptr<std::atomic<uint64_t>[]> m_lastUse;
+    std::atomic<uint64_t> m_clock;
+
+    mutable std::mutex m_lock;  // guards everything below
+    std::vector<uint32_t> m_resident;
+    std::size_t m_residentBytes;
+    std::size_t m_memoryCap;
+    uint64_t m_loads;
+    uint64_t m_evictions;
+    uint64_t m_damaged;
+
+    void evict_over_cap(uint32_t keep);
+
+    TilePager(const TilePager&) = delete;
+    TilePager& operator=(const TilePager&) = delete;
+};
+
+#endif // MAPTILES_H
@@ -0,0 +1,34 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <string>
+#include <cstddef>
+
+// Maps a whole file read-only into memory
+// The mapping is shared, so several processes mapping the same file share its pages
+class MappedFile
+{
+public:
+    MappedFile();
+    ~MappedFile();
+    
+    bool open(const std::string& file);    // returns false if the file can't be opened or mapped
+    void close();
+    
+    const char* data() const { return m_data; }
+    std::size_t size() const { return m_size; }
+    bool is_open() const { return m_data != nullptr; }
+    
+    // Hints that a range is about to be read, or won't be for a while, so its pages can be dropped
+    // Dropped pages read the same as ever; the OS reads them back from the file when they are touched
+    void prefetch(std::size_t offset, std::size_t size) const;
+    void release(std::size_t offset, std::size_t size) const;
+private:
+    const char* m_data;
+    std::size_t m_size;
+    
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+};
+
+#endif // MAPPEDFILE_H
@@ -0,0 +1,114 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Number of threads to spread parallel work across
+inline std::size_t hardware_threads()
+{
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+// The threads parallel loops are run on, started once for the whole process
+// A loop's calling thread works on it too, so the pool has one thread fewer than the hardware,
+// and loops running at once, such as for concurrent server requests, share its threads
+// instead of each starting threads of their own
+class ThreadPool
+{
+public:
+    static ThreadPool& shared();
+
+    ~ThreadPool();  // after finishing every task already submitted
+
+    std::size_t size() const { return m_threads.size(); }
+
+    // Runs task on the first thread of the pool to come free
+    void submit(std::function<void()> task);
+private:
+    ThreadPool(std::size_t num_threads);
+
+    std::vector<std::thread> m_threads;
+    std::deque<std::function<void()>> m_tasks;
+    std::mutex m_lock;
+    std::condition_variable m_ready;
+    bool m_stopping;
+
+    void work();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+};
+
+// Calls fn(worker, i) for every i in [0, count), spread across the shared thread pool and the calling thread
+// worker is in [0, hardware_threads()) and is the same for every call made on one thread in one loop,
+// so each thread can keep its own scratch state in a table indexed by worker
+// Indices are handed out one at a time, so uneven work balances itself
+// Returns once every call has finished
+template <typename Fn>
+void parallel_for_workers(std::size_t count, Fn fn)
+{
+    ThreadPool& pool = ThreadPool::shared();
+    std::size_t numThreads = std::min(count, pool.size() + 1);
+    if (numThreads <= 1)
+    {
+        for (std::size_t i = 0; i < count; i++)
+            fn(0, i);
+        return;
+    }
+
+    // A pool thread can get to its part of the loop after the loop has finished and returned,
+    // so the loop's state is shared with it, and then it finds no indices left and never calls fn
+    struct Loop
+    {
+        Fn* fn;
+        std::size_t count;
+        std::atomic<std::size_t> next;
+        std::size_t finished;
+        std::mutex lock;
+        std::condition_variable done;
+    };
+    auto loop = std::make_shared<Loop>();
+    loop->fn = &fn;
+    loop->count = count;
+    loop->next = 0;
+    loop->finished = 0;
+
+    auto worker = [](Loop& loop, std::size_t w)
+    {
+        std::size_t calls = 0;
+        for (std::size_t i = loop.next++; i < loop.count; i = loop.next++, calls++)
+            (*loop.fn)(w, i);
+        if (calls == 0)
+            return;
+
+        std::lock_guard<std::mutex> guard(loop.lock);
+        loop.finished += calls;
+        if (loop.finished == loop.count)
+            loop.done.notify_one();
+    };
+
+    for (std::size_t t = 1; t < numThreads; t++)
+        pool.submit([loop, worker, t] { worker(*loop, t); });
+    worker(*loop, 0);   // the calling thread does its share too
+
+    std::unique_lock<std::mutex> guard(loop->lock);
+    loop->done.wait(guard, [&] { return loop->finished == count; });
+}
+
+// Calls fn(i) for every i in [0, count), spread across the shared thread pool and the calling thread
+template <typename Fn>
+void parallel_for(std::size_t count, Fn fn)
+{
+    parallel_for_workers(count, [&](std::size_t, std::size_t i) { fn(i); });
+}
+
+#endif // PARALLEL_H
@@ -0,0 +1,71 @@
+#ifndef POIINDEX_H
+#define POIINDEX_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+#include "geodb.h"
+
+// A point of interest found by a PoiIndex search, best first
+struct PoiMatch
+{
+    enum Kind { EXACT, PREFIX, WORD_PREFIX, FUZZY };
+
+    Kind kind;
+    uint32_t poi;           // index in the GeoDatabase
+    std::string_view name;  // as in the map data
+    uint32_t node;          // its location's node ID
+    int edits;              // for a fuzzy match, how many edits the query is from a prefix of a word of the name
+};
+
+// A search index over a GeoDatabase's point of interest names, for looking them up
+// by something less than their exact name, such as what a user has typed so far
+// Names and queries are compared case-insensitively, ignoring punctuation and extra spaces
+// Prefix matches come from a sorted table of every word of every name; when those run short,
+// names sharing enough trigrams with the query are checked for a bounded edit distance
+class PoiIndex
+{
+public:
+    // The map must stay loaded while the index is used
+    PoiIndex(const GeoDatabase& geodb);
+    ~PoiIndex();
+
+    // The names best matching a query, ranked: an exact match, then names starting with the query,
+    // then names with a later word starting with it, then names within max_edits of it
+    // Fewer edits are allowed for short queries, whose trigrams couldn't tell candidates apart
+    std::vector<PoiMatch> search(const std::string& query, size_t max_results = 10, int max_edits = 2) const;
+private:
+    // Where a word starts in a normalized name
+    struct WordStart
+    {
+        uint32_t poi;
+        uint32_t offset;    // into m_chars
+    };
+
+    const GeoDatabase& m_geodb;
+
+    // POI -> normalized name, as [m_nameOffsets[i], m_nameOffsets[i + 1]) in m_chars
+    std::vector<uint32_t> m_nameOffsets;
+    std::vector<char> m_chars;
+
+    // The POIs in normalized name order, which can differ from the map's case-sensitive order
+    std::vector<uint32_t> m_names;
+
+    // Every word of every name except the first, sorted by the rest of the name from there
+    std::vector<WordStart> m_words;
+
+    // Trigram -> the POIs whose names hold it, as
+    // m_postings[m_trigramOffsets[i]] ... m_postings[m_trigramOffsets[i + 1] - 1] for m_trigrams[i]
+    std::vector<uint32_t> m_trigrams;
+    std::vector<uint32_t> m_trigramOffsets;
+    std::vector<uint32_t> m_postings;
+
+    std::string_view name(uint32_t poi) const;
+    std::string_view rest(const WordStart& word) const;
+
+    PoiIndex(const PoiIndex&) = delete;
+    PoiIndex& operator=(const PoiIndex&) = delete;
+};
+
+#endif // POIINDEX_H
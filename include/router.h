@@ -2,40 +2,76 @@
 #define ROUTER_H
 
 #include <vector>
-#include <unordered_map>
-#include <string>
-#include <limits>
+#include <cstdint>
 #include "base_classes.h"
+#include "geodb.h"
 #include "geopoint.h"
+#include "search_context.h"
+#include "heuristic.h"
 
-class Router: public RouterBase
+// A router over a GeoDatabase that can also give the edges its routes take, so a caller reads
+// each segment's street, length and direction straight off the map's edge tables
+class EdgeRouter: public RouterBase
 {
 public:
-    Router(const GeoDatabaseBase& geo_db);
+    using RouterBase::route;
+    
+    // Routes as route does, also setting edges to the edge from each point of the path to the next
+    // edges is left empty if they aren't known, such as by a wrapper around a router that doesn't give them
+    virtual std::vector<GeoPoint> route(const GeoPoint& pt1, const GeoPoint& pt2, std::vector<uint32_t>& edges) const = 0;
+};
+
+class Router: public EdgeRouter
+{
+public:
+    // Guides its search with the given heuristic, or by great-circle distance if none is given
+    // A given heuristic must outlive the router
+    Router(const GeoDatabase& geo_db, const Heuristic* heuristic = nullptr);
     virtual ~Router();
+    
+    // Routes with a SearchContext kept per thread, so concurrent calls are safe
     virtual std::vector<GeoPoint> route(const GeoPoint& pt1, const GeoPoint& pt2) const;
+    virtual std::vector<GeoPoint> route(const GeoPoint& pt1, const GeoPoint& pt2, std::vector<uint32_t>& edges) const;
+    
+    // Routes with the caller's SearchContext, which holds the search's state afterwards
+    std::vector<GeoPoint> route(const GeoPoint& pt1, const GeoPoint& pt2, SearchContext& context, std::vector<uint32_t>& edges) const;
 private:
-    const GeoDatabaseBase& m_geodb;
+    const GeoDatabase& m_geodb;
+    GreatCircleHeuristic m_greatCircle;
+    const Heuristic& m_heuristic;
 };
 
-// This struct is needed for a default double value of infinity
-struct DoubleWrapper
+// A* from both ends at once: a forward search from pt1 and a backward search from pt2 over
+// the reversed edges, which are the map's own edges since every connection goes both ways
+// Both searches use the average potential (h(n, end) - h(n, start)) / 2, forward and negated
+// backward, which keeps them consistent with each other, so the route is stopped as soon as
+// the smallest fScores left in the two open sets add up to the best path found
+class BidirectionalRouter: public EdgeRouter
 {
-    DoubleWrapper(double d = std::numeric_limits<double>::max());
-    double m_d;
+public:
+    // Guides its searches with the given heuristic, or by great-circle distance if none is given
+    // A given heuristic must outlive the router
+    BidirectionalRouter(const GeoDatabase& geo_db, const Heuristic* heuristic = nullptr);
+    virtual ~BidirectionalRouter();
+    
+    // Routes with SearchContexts kept per thread, so concurrent calls are safe
+    virtual std::vector<GeoPoint> route(const GeoPoint& pt1, const GeoPoint& pt2) const;
+    virtual std::vector<GeoPoint> route(const GeoPoint& pt1, const GeoPoint& pt2, std::vector<uint32_t>& edges) const;
+    
+    // Routes with the caller's SearchContexts, one for each direction
+    std::vector<GeoPoint> route(const GeoPoint& pt1, const GeoPoint& pt2, SearchContext& forward, SearchContext& backward,
+                                std::vector<uint32_t>& edges) const;
+private:
+    const GeoDatabase& m_geodb;
+    GreatCircleHeuristic m_greatCircle;
+    const Heuristic& m_heuristic;
 };
 
-// for sorting in a priority queue
-bool operator>(const std::pair<GeoPoint, double>& lhs, const std::pair<GeoPoint, double>& rhs);
-
-// for backtracking on a path
-std::vector<GeoPoint> reconstructPath(std::unordered_map<std::string, GeoPoint>& previousMap, const GeoPoint& end);
-
-// Represents the heuristic function h(n), which estimates the cost to reach the end from GeoPoint n
-// uses Manhattan distance
-double heuristic(const GeoPoint& current, const GeoPoint& end);
+// for backtracking on a path, from the previous nodes recorded by a search
+// Appends the path's nodes from the search's start to end
+void reconstructPath(const SearchContext& context, uint32_t end, std::vector<uint32_t>& nodes);
 
-// test if current == end
-bool isAtEnd(const GeoPoint& current, const GeoPoint& end);
+// The points along a path of nodes, with edges set to the edge from each node to the next
+std::vector<GeoPoint> pathPoints(const GeoDatabase& geodb, const std::vector<uint32_t>& nodes, std::vector<uint32_t>& edges);
 
 #endif // ROUTER_H
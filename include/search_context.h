@@ -0,0 +1,87 @@
+#ifndef SEARCHCONTEXT_H
+#define SEARCHCONTEXT_H
+
+#include <vector>
+#include <cstdint>
+#include <limits>
+#include "search_stats.h"
+
+// Marks a node with no previous node on a path
+const uint32_t NO_NODE = std::numeric_limits<uint32_t>::max();
+
+// The state of one shortest path search over a graph with dense node IDs:
+// each node's gScore and previous node, the open set, and the closed set
+// A context is meant to be reused across searches, so a search allocates nothing
+// once the arrays have grown to the size of the graph
+// Per-node entries are stamped with the search's generation and are only valid for
+// the search that wrote them, so starting a search never clears the arrays
+class SearchContext
+{
+public:
+    SearchContext();
+
+    // Starts a new search over a graph with numNodes nodes, forgetting the previous one
+    void reset(uint32_t numNodes);
+
+    // test if the node has been given a gScore in this search
+    bool is_reached(uint32_t node) const { return m_stamp[node] == m_generation; }
+
+    // The node's gScore, or infinity if it hasn't been reached
+    double g_score(uint32_t node) const
+    {
+        return is_reached(node) ? m_gScore[node] : std::numeric_limits<double>::infinity();
+    }
+
+    // The node immediately before the node on its best path, or NO_NODE
+    uint32_t previous(uint32_t node) const { return is_reached(node) ? m_previous[node] : NO_NODE; }
+
+    // test if the node has been removed from the open set, so its gScore is final
+    bool is_closed(uint32_t node) const { return is_reached(node) && m_heapPos[node] == CLOSED; }
+
+    // Records a (better) path to the node, and adds it to the open set with the given fScore,
+    // or lowers its fScore if it's already there
+    // A closed node is reopened, which only happens if the search's heuristic isn't consistent
+    void relax(uint32_t node, double gScore, uint32_t previous, double fScore);
+
+    bool open_empty() const { return m_heap.empty(); }
+
+    // The lowest fScore in the open set, which must not be empty
+    double min_f_score() const { return m_heap[0].fScore; }
+
+    // Removes the node with the lowest fScore from the open set and closes it
+    uint32_t pop_min();
+
+    // Counts edges the search looked at, for its stats
+    void count_scanned(uint32_t numEdges) { m_numScanned += numEdges; }
+
+    // Search counters since the last reset
+    uint32_t num_closed() const { return m_numClosed; }
+    SearchStats stats() const;
+private:
+    // A node in the open set, stored in a 4-ary min heap ordered by fScore
+    struct HeapEntry
+    {
+        double fScore;
+        uint32_t node;
+    };
+
+    static const uint32_t ARITY = 4;
+    static const uint32_t CLOSED = std::numeric_limits<uint32_t>::max();
+
+    uint32_t m_generation;
+    std::vector<uint32_t> m_stamp;      // node -> generation its entries were written in
+    std::vector<double> m_gScore;
+    std::vector<uint32_t> m_previous;
+    std::vector<uint32_t> m_heapPos;    // node -> index in m_heap, or CLOSED
+    std::vector<HeapEntry> m_heap;
+    uint32_t m_numClosed;
+    uint32_t m_numPushes;
+    uint32_t m_numDecreases;
+    uint32_t m_numReopened;
+    uint32_t m_numScanned;
+
+    void sift_up(uint32_t pos, HeapEntry entry);
+    void sift_down(uint32_t pos, HeapEntry entry);
+};
+
+#endif // SEARCHCONTEXT_H
@@ -0,0 +1,62 @@
+#ifndef SEARCHSTATS_H
+#define SEARCHSTATS_H
+
+#include <string>
+#include <iostream>
+#include <cstdint>
+#include <chrono>
+
+class SearchContext;
+
+// Counts of the work done by shortest path searches and map lookups
+// Counting is cheap enough to stay on: a search counts in its SearchContext and adds its
+// counts to its thread's totals once, when it's done, and each thread only ever writes its own
+struct SearchStats
+{
+    uint64_t searches = 0;          // a bidirectional route runs two
+    uint64_t nodesExpanded = 0;     // closed by a search
+    uint64_t heapPushes = 0;        // nodes added to an open set
+    uint64_t heapDecreases = 0;     // fScores lowered in place, where a heap without decrease-key would pop a stale entry later
+    uint64_t nodesReopened = 0;     // closed nodes reached again by a shorter path, which only an inconsistent heuristic causes
+    uint64_t edgesScanned = 0;      // edges looked at while expanding nodes
+    uint64_t nodeLookups = 0;       // GeoPoints looked up in the map's sorted node table
+    uint64_t neighborFetches = 0;   // calls to get_connected_points
+    uint64_t streetLookups = 0;     // calls to get_street_name
+    uint64_t searchNanos = 0;       // wall time spent searching
+
+    SearchStats& operator+=(const SearchStats& other);
+    SearchStats operator-(const SearchStats& other) const;
+
+    // One "name: value" line per counter, each line starting with indent
+    void print(std::ostream& out, const std::string& indent = "") const;
+
+    // Appends the counters as a JSON object
+    void write_json(std::string& out) const;
+};
+
+// The work done so far on the calling thread
+SearchStats thread_search_stats();
+
+// The work done so far by every thread of the process, running or finished
+SearchStats process_search_stats();
+
+// Adds to the calling thread's counts
+void count_search_stats(const SearchStats& stats);
+void count_search_stat(uint64_t SearchStats::* counter, uint64_t amount = 1);
+
+// Adds one search's counts to its thread's totals when it goes out of scope,
+// however the search returns
+class SearchRecorder
+{
+public:
+    SearchRecorder(const SearchContext& context);
+    ~SearchRecorder();
+private:
+    const SearchContext& m_context;
+    std::chrono::steady_clock::time_point m_start;
+
+    SearchRecorder(const SearchRecorder&) = delete;
+    SearchRecorder& operator=(const SearchRecorder&) = delete;
+};
+
+#endif // SEARCHSTATS_H
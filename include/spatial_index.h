@@ -0,0 +1,144 @@
+#ifndef SPATIALINDEX_H
+#define SPATIALINDEX_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include "base_classes.h"
+#include "geodb.h"
+#include "geopoint.h"
+#include "router.h"
+#include "hashmap.h"
+
+// The point on a street segment nearest to a query point
+struct SegmentMatch
+{
+    uint32_t edge;      // one of the segment's edges, from -> to
+    uint32_t from;
+    uint32_t to;
+    double fraction;    // how far along the segment the nearest point is, from 0 at from to 1 at to
+    double distance;    // from the query point, in miles
+};
+
+// A uniform grid over the map's nodes and street segments, for finding what is near an
+// arbitrary location, such as a GPS position that isn't exactly one of the map's points
+// Locations are projected onto a plane tangent to the map's center, which is accurate
+// to well under a percent across a city
+// A tiled map gets a grid per tile instead, built as a query first needs the tile, so only the
+// tiles around the points queried are read in; a query then only finds what is in the tiles
+// next to the point's, which is everything within a tile's width of it
+class SpatialIndex
+{
+public:
+    SpatialIndex(const GeoDatabase& geodb);
+    ~SpatialIndex();
+
+    // Finds the node nearest to a point; returns false if the map has no nodes near enough to search
+    bool nearest_node(const GeoPoint& pt, uint32_t& node) const;
+
+    // Finds the segment nearest to a point; returns false if the map has no segments near enough to search
+    bool nearest_segment(const GeoPoint& pt, SegmentMatch& match) const;
+
+    // Reverse geocoding: the name of the street nearest to a point,
+    // or "" if no street is within max_miles of it
+    std::string street_at(const GeoPoint& pt, double max_miles = 0.05) const;
+private:
+    struct Point
+    {
+        double x;   // in miles east of the grid's center
+        double y;   // in miles north of it
+    };
+
+    // A grid over the nodes [first, end) and the segments leaving them
+    class Grid
+    {
+    public:
+        Grid(const GeoDatabase& geodb, uint32_t first, uint32_t end);
+        bool nearest_node(const GeoPoint& pt, uint32_t& node, double& distance) const;
+        bool nearest_segment(const GeoPoint& pt, SegmentMatch& match) const;
+    private:
+        const GeoDatabase& m_geodb;
+        double m_centerLat;     // in degrees
+        double m_centerLon;
+        double m_lonScale;      // miles per degree of longitude at the center
+
+        uint32_t m_first;
+        std::vector<Point> m_points;    // node ID - m_first -> projected position
+        HashMap<Point, uint32_t> m_outside;     // the far ends of segments leaving the grid's nodes
+
+        // The grid covers [m_minX, m_minX + m_cols * m_cellSize) x [m_minY, m_minY + m_rows * m_cellSize)
+        double m_minX;
+        double m_minY;
+        double m_cellSize;  // in miles
+        int m_cols;
+        int m_rows;
+
+        // A segment, by the edge along it from its lower ID end, or from the grid's end if only one is in it
+        struct Segment
+        {
+            uint32_t from;
+            uint32_t edge;
+        };
+
+        // The nodes in cell c are m_cellNodes[m_nodeOffsets[c]] ... m_cellNodes[m_nodeOffsets[c + 1] - 1],
+        // and the segments whose bounding boxes overlap it are listed the same way
+        std::vector<uint32_t> m_nodeOffsets;
+        std::vector<uint32_t> m_cellNodes;
+        std::vector<uint32_t> m_segmentOffsets;
+        std::vector<Segment> m_cellSegments;
+
+        Point project(double latitude, double longitude) const;
+        const Point& point(uint32_t node) const;
+        int column(double x) const;
+        int row(double y) const;
+
+        // Calls visit(cell) for the cells in rings around the point's cell, nearest ring first,
+        // until visit has found something nearer than any cell left to visit
+        template <typename Visit>
+        void search_rings(const Point& p, const double& best, Visit visit) const;
+    };
+
+    const GeoDatabase& m_geodb;
+    std::unique_ptr<Grid> m_grid;       // over the whole map, unless it's tiled
+
+    // a tiled map's grids by tile, built as they're first needed
+    mutable std::mutex m_lock;
+    mutable std::vector<std::unique_ptr<Grid>> m_tileGrids;
+
+    std::vector<const Grid*> grids_around(const GeoPoint& pt) const;
+
+    SpatialIndex(const SpatialIndex&) = delete;
+    SpatialIndex& operator=(const SpatialIndex&) = delete;
+};
+
+// How far a location may be from the nearest street and still be snapped to it, unless told otherwise
+const double DEFAULT_MAX_SNAP_MILES = 0.25;
+
+// A router that accepts any locations: an endpoint that isn't one of the map's points
+// is snapped to the nearer end of the street segment nearest to it before routing
+// A location farther than max_snap_miles from every street is off the map, and isn't routed
+class SnappingRouter: public EdgeRouter
+{
+public:
+    // The router and the index must outlive this router
+    SnappingRouter(const RouterBase& router, const GeoDatabase& geodb, const SpatialIndex& index,
+                   double max_snap_miles = DEFAULT_MAX_SNAP_MILES);
+    virtual ~SnappingRouter();
+
+    virtual std::vector<GeoPoint> route(const GeoPoint& pt1, const GeoPoint& pt2) const;
+    virtual std::vector<GeoPoint> route(const GeoPoint& pt1, const GeoPoint& pt2, std::vector<uint32_t>& edges) const;
+
+    // The point of the map a location is routed from or to; returns false if the location is off the map
+    bool snap(const GeoPoint& pt, GeoPoint& snapped) const;
+    double max_snap_miles() const { return m_maxSnapMiles; }
+private:
+    const RouterBase& m_router;
+    const EdgeRouter* m_edgeRouter;     // the same router, if it gives its routes' edges
+    const GeoDatabase& m_geodb;
+    const SpatialIndex& m_index;
+    double m_maxSnapMiles;
+};
+
+#endif // SPATIALINDEX_H
@@ -0,0 +1,13 @@
+#ifndef STOPORDER_H
+#define STOPORDER_H
+
+#include <vector>
+
+// Finds a short order to visit n stops in, given distances[from * n + to] between them
+// The first stop stays first, and with keep_last the last stop stays last; the stops between
+// are reordered by 2-opt and Or-opt local search, started from a different order on every
+// thread and kicked out of local optima until the time budget runs out or kicks stop helping
+// Returns the stops' indices in visiting order
+std::vector<int> optimize_stop_order(const std::vector<double>& distances, int n, bool keep_last, double time_budget_ms);
+
+#endif // STOPORDER_H
@@ -1,19 +1,72 @@
 #ifndef TOURGENERATOR_H
 #define TOURGENERATOR_H
 
+#include <string>
 #include <vector>
 #include "base_classes.h"
+#include "geopoint.h"
 #include "tourcmd.h"
+#include "search_stats.h"
+
+// A stop on a tour: the point of interest and the commentary given there
+// A stop can instead be at any location, such as a GPS position, with poi just naming it;
+// the router must then be one that snaps locations to the map, such as a SnappingRouter
+struct TourStop
+{
+    std::string poi;
+    std::string talking_points;
+    bool at_location = false;
+    GeoPoint location;
+};
+
+// What a stop at a location is called if no street is near it and it isn't given a name
+const char* const UNNAMED_LOCATION = "your location";
+
+// The work of generating one leg of a tour
+struct LegStats
+{
+    std::string from;
+    std::string to;
+    double micros;          // wall time to route the leg and turn it into commands
+    SearchStats search;     // the work done on the way
+};
+
+// The work of generating a tour, to tell a slow leg from a slow choice of order
+struct TourStats
+{
+    double orderMicros = 0;     // finding the visiting order, including the distances between stops
+    double micros = 0;          // the whole tour
+    std::vector<LegStats> legs;
+    SearchStats search;         // the legs' work added up
+};
 
 class TourGenerator: public TourGeneratorBase
 {
 public:
     TourGenerator(const GeoDatabaseBase& geodb, const RouterBase& router);
     virtual ~TourGenerator();
+    // Legs between stops are generated on all cores, so the router must be safe to call concurrently
     virtual std::vector<TourCommand> generate_tour(const Stops& stops) const;
+    
+    // Generates a tour of stops that weren't loaded from a file
+    // Either overload can also report the work it took in stats
+    std::vector<TourCommand> generate_tour(const std::vector<TourStop>& stops, TourStats* stats = nullptr) const;
+    std::vector<TourCommand> generate_tour(const Stops& stops, TourStats* stats) const;
+    
+    // Visit the stops in the order that makes the tour shortest, instead of in file order
+    // The first stop is always visited first, and with keep_last the last stop is visited last
+    // Finding the order takes up to time_budget_ms on top of computing the distances between stops
+    void optimize_order(bool keep_last = false, double time_budget_ms = 50);
 private:
     const GeoDatabaseBase& m_geodb;
     const RouterBase& m_router;
+    bool m_optimizeOrder;
+    bool m_keepLast;
+    double m_timeBudgetMs;
+    
+    bool locate(const TourStop& stop, GeoPoint& location) const;
+    std::vector<int> visiting_order(const std::vector<TourStop>& stops) const;
+    bool generate_leg(const TourStop& from, const TourStop& to, std::vector<TourCommand>& commands) const;
 };
 
 #endif // TOURGENERATOR_H
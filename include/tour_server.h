@@ -0,0 +1,81 @@
+#ifndef TOURSERVER_H
+#define TOURSERVER_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include "live_map.h"
+
+struct JsonValue;
+struct Connection;
+
+// Serves tour requests against a live map, as newline-delimited JSON:
+// {"id": 7, "stops": [{"poi": "Ackerman Union", "commentary": "..."}, ...]}
+// Requests are handled concurrently by a pool of workers, and each is answered by one line
+// as soon as its tour is ready, so answers can come back in a different order than requests
+// An answer carries its request's id:
+// {"id": 7, "ok": true, "epoch": 0, "distance": 1.758, "commands": [{"type": "commentary", ...}, ...]}
+// {"id": 7, "ok": false, "error": "..."}
+// where the epoch tells which version of the map the tour was routed on
+// A stop can be any location instead, such as a GPS position, which is routed from the street nearest
+// to it, and named after that street unless the stop gives a poi to name it:
+// {"id": 7, "stops": [{"location": [34.0712, -118.4451]}, {"poi": "Ackerman Union"}]}
+// A stop at a location no street is near is called UNNAMED_LOCATION (see tour_generator.h), and one
+// farther off than the live map's RoutingOptions::maxSnapMiles is refused as off the map
+// A request can ask which street a location is on, answered with "" if none is near it:
+// {"id": 10, "street_at": [34.0712, -118.4451]}
+// {"id": 10, "ok": true, "street": "Bruin Walk"}
+// With a PoiIndex, a request can instead look up points of interest by what a user has typed so far:
+// {"id": 8, "search": "ackerm", "limit": 5}
+// {"id": 8, "ok": true, "matches": [{"poi": "Ackerman Union", "match": "prefix", "edits": 0}, ...]}
+// Or it can change the map, with the text of a delta file (see map_delta.h), answered as soon as the
+// changes are applied with the epoch of the version they'll be in, which the live map builds in the
+// background while requests go on with the version before:
+// {"id": 9, "update": "remove 34.0709602 -118.4425828 34.0709629 -118.4428913"}
+// {"id": 9, "ok": true, "epoch": 1}
+class TourServer
+{
+public:
+    // The map must outlive the server; searches are served if its versions have a PoiIndex
+    TourServer(LiveMap& map, int num_workers = 0);     // 0 for one worker per core
+    ~TourServer();
+    
+    // Answers the requests read from in on out, returning once in ends and every request is answered
+    void serve(std::istream& in, std::ostream& out);
+    
+    // Listens on a Unix domain socket, answering each connection's requests on that connection
+    // Only returns if the socket can't be created or stops accepting connections, once every
+    // connection has stopped being read
+    bool serve_socket(const std::string& socket_path);
+    
+    // The answer to one request, without its newline
+    std::string handle(const std::string& request) const;
+private:
+    LiveMap& m_map;
+    
+    // the worker pool's queue of jobs
+    std::vector<std::thread> m_workers;
+    std::deque<std::function<void()>> m_jobs;
+    std::mutex m_lock;
+    std::condition_variable m_ready;
+    bool m_stopping;
+    
+    std::string answer(const std::string& id, const JsonValue& json) const;
+    std::string search(const std::string& id, const JsonValue& request, const MapVersion& version) const;
+    std::string street_at(const std::string& id, const JsonValue& request, const MapVersion& version) const;
+    std::string update(const std::string& id, const JsonValue& request) const;
+    void read_connection(std::shared_ptr<Connection> connection);
+    void submit(std::function<void()> job);
+    void work();
+    
+    TourServer(const TourServer&) = delete;
+    TourServer& operator=(const TourServer&) = delete;
+};
+
+#endif // TOURSERVER_H
@@ -0,0 +1,50 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <string>
+#include <utility>
+#include <atomic>
+#include <cstdint>
+
+// Scoped timing spans, written as a Chrome trace-event file (for chrome://tracing or Perfetto)
+// to show which phase on which thread took the time
+// Tracing is off until start_tracing is called; until then a span costs a relaxed load and a branch
+
+// Whether spans are being recorded
+extern std::atomic<bool> traceEnabled;
+
+// Starts recording spans, timed from now
+void start_tracing();
+
+// Writes every span recorded so far as a JSON trace; returns false if the file can't be written
+bool write_trace(const std::string& trace_file);
+
+// Records the time from its construction to its destruction as a span on the current thread
+class TraceSpan
+{
+public:
+    // The name must outlive tracing, as a string literal does
+    TraceSpan(const char* name) : m_name(name), m_start(traceEnabled.load(std::memory_order_relaxed) ? now() : -1) {}
+    ~TraceSpan() { end(); }
+
+    // Ends the span before it goes out of scope, so the next phase's span can follow it
+    void end() { if (m_start >= 0) finish(); }
+
+    // whether the span is being recorded, so a detail is only built when it will be kept
+    bool active() const { return m_start >= 0; }
+
+    // Text shown with the span, such as which leg of a tour it covers
+    void set_detail(std::string detail) { m_detail = std::move(detail); }
+private:
+    const char* m_name;
+    std::string m_detail;
+    double m_start;     // in microseconds since tracing started, or -1 if tracing was off
+
+    static double now();
+    void finish();
+
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+};
+
+#endif // TRACE_H
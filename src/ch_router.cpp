@@ -0,0 +1,103 @@
+#include "ch_router.h"
+#include "base_classes.h"
+#include "geodb.h"
+#include "geopoint.h"
+#include "search_context.h"
+#include "search_stats.h"
+#include "contraction_hierarchy.h"
+#include "router.h"
+#include <vector>
+#include <limits>
+#include <algorithm>
+using namespace std;
+
+CHRouter::CHRouter(const GeoDatabase& geo_db, const ContractionHierarchy& hierarchy)
+ : m_geodb(geo_db), m_hierarchy(hierarchy) {}
+
+CHRouter::~CHRouter() {}
+
+std::vector<GeoPoint> CHRouter::route(const GeoPoint& pt1, const GeoPoint& pt2) const
+{
+    vector<uint32_t> edges;
+    return route(pt1, pt2, edges);
+}
+
+std::vector<GeoPoint> CHRouter::route(const GeoPoint& pt1, const GeoPoint& pt2, std::vector<uint32_t>& edges) const
+{
+    thread_local SearchContext forward;     // reused by every search on this thread
+    thread_local SearchContext backward;
+    return route(pt1, pt2, forward, backward, edges);
+}
+
+std::vector<GeoPoint> CHRouter::route(const GeoPoint& pt1, const GeoPoint& pt2, SearchContext& forward, SearchContext& backward,
+                                      std::vector<uint32_t>& edges) const
+{
+    edges.clear();
+    uint32_t start;
+    uint32_t end;
+    if ( ! m_geodb.get_node_id(pt1, start) || ! m_geodb.get_node_id(pt2, end))
+        return std::vector<GeoPoint>();     // start or end GeoPoint is not on the map
+    
+    forward.reset(m_geodb.num_nodes());
+    backward.reset(m_geodb.num_nodes());
+    SearchRecorder forwardRecorder(forward);
+    SearchRecorder backwardRecorder(backward);
+    forward.relax(start, 0, NO_NODE, 0);
+    backward.relax(end, 0, NO_NODE, 0);
+    
+    // The best path found so far runs up from the start to the meeting node and down to the end
+    // A direction stops once its next node is no closer than that path is long,
+    // since every path through the nodes it has left is at least that long
+    double best = numeric_limits<double>::infinity();
+    uint32_t meeting = NO_NODE;
+    for (;;)
+    {
+        bool forwardOpen = ! forward.open_empty() && forward.min_f_score() < best;
+        bool backwardOpen = ! backward.open_empty() && backward.min_f_score() < best;
+        if ( ! forwardOpen && ! backwardOpen)
+            break;
+        
+        // advance the direction whose next node is closer
+        bool isForward = forwardOpen && ( ! backwardOpen || forward.min_f_score() <= backward.min_f_score());
+        SearchContext& search = isForward ? forward : backward;
+        const SearchContext& other = isForward ? backward : forward;
+        
+        uint32_t current = search.pop_min();
+        m_geodb.touch_node(current);
+        double currentDistance = search.g_score(current);
+        if (currentDistance + other.g_score(current) < best)
+        {
+            best = currentDistance + other.g_score(current);
+            meeting = current;
+        }
+        
+        const HierarchyArc* arc = isForward ? m_hierarchy.up_begin(current) : m_hierarchy.down_begin(current);
+        const HierarchyArc* arcsEnd = isForward ? m_hierarchy.up_end(current) : m_hierarchy.down_end(current);
+        search.count_scanned(static_cast<uint32_t>(arcsEnd - arc));
+        for (; arc != arcsEnd; arc++)
+        {
+            double distance = currentDistance + arc->weight;
+            if (distance < search.g_score(arc->target))
+                search.relax(arc->target, distance, current, distance);
+        }
+    }
+    
+    if (meeting == NO_NODE)
+        return std::vector<GeoPoint>();     // the searches never met, so no route is possible
+    
+    // the hierarchy's nodes on the path, from the start up to the meeting node and down to the end
+    vector<uint32_t> nodes;
+    for (uint32_t current = meeting; current != NO_NODE; current = forward.previous(current))
+        nodes.push_back(current);
+    reverse(nodes.begin(), nodes.end());
+    for (uint32_t current = backward.previous(meeting); current != NO_NODE; current = backward.previous(current))
+        nodes.push_back(current);
+    
+    vector<uint32_t> ids(1, start);
+    for (size_t i = 0; i + 1 < nodes.size(); i++)
+        m_hierarchy.unpack(nodes[i], nodes[i + 1], ids);
+    
+    for (uint32_t id : ids)
+        m_geodb.touch_node(id);     // unpacking shortcuts reaches nodes neither search settled
+    return pathPoints(m_geodb, ids, edges);
+}
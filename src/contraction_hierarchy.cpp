@@ -0,0 +1,432 @@
+#include "contraction_hierarchy.h"
+#include "geodb.h"
+#include "map_snapshot.h"
+#include "parallel.h"
+#include "search_context.h"
+#include <string>
+#include <vector>
+#include <fstream>
+#include <algorithm>
+#include <queue>
+#include <functional>
+#include <cstring>
+using namespace std;
+
+// A witness search gives up after settling this many nodes, or on paths of more than this many
+// arcs, and the shortcuts it was looking for witnesses to are added anyway, which is never wrong,
+// just less sparse
+const uint32_t MAX_WITNESS_SETTLED = 500;
+const uint8_t MAX_WITNESS_HOPS = 8;
+
+// An arc of the graph that is still being contracted
+struct WorkArc
+{
+    uint32_t node;      // the other end
+    uint32_t middle;
+    double weight;
+};
+
+struct Shortcut
+{
+    uint32_t from;
+    uint32_t to;
+    double weight;
+};
+
+// The remaining graph while it's being contracted, with every arc stored at both ends
+// Contracted nodes keep no arcs, so searches over the graph never reach them
+struct WorkGraph
+{
+    vector<vector<WorkArc>> out;    // node -> arcs leaving it
+    vector<vector<WorkArc>> in;     // node -> arcs entering it
+};
+
+// A thread's state for witness searches
+struct WitnessScratch
+{
+    SearchContext context;
+    vector<uint8_t> hops;           // node -> arcs on its path in the current search, once reached
+    vector<char> target;            // node -> whether the searches are looking for a witness to it
+};
+
+// Finds the shortcuts contracting v needs: for every path u -> v -> x, a shortcut u -> x
+// unless a witness path from u to x that avoids v is no longer
+static void findShortcuts(const WorkGraph& graph, uint32_t v, WitnessScratch& scratch, vector<Shortcut>& shortcuts)
+{
+    shortcuts.clear();
+    uint32_t numNodes = static_cast<uint32_t>(graph.out.size());
+    SearchContext& context = scratch.context;
+    scratch.hops.resize(numNodes);
+    scratch.target.resize(numNodes, false);
+    for (const WorkArc& out : graph.out[v])
+        scratch.target[out.node] = true;
+
+    for (const WorkArc& in : graph.in[v])
+    {
+        uint32_t u = in.node;
+        double maxWeight = 0;
+        uint32_t targets = 0;
+        for (const WorkArc& out : graph.out[v])
+        {
+            if (out.node != u)
+            {
+                maxWeight = max(maxWeight, in.weight + out.weight);
+                targets++;
+            }
+        }
+        if (targets == 0)
+            continue;   // v's only other neighbor is u
+
+        // Dijkstra's algorithm from u, until every target is settled or nothing closer than the
+        // longest path through v is left
+        context.reset(numNodes);
+        context.relax(u, 0, NO_NODE, 0);
+        scratch.hops[u] = 0;
+        for (uint32_t settled = 0; ! context.open_empty() && settled < MAX_WITNESS_SETTLED && targets > 0; settled++)
+        {
+            if (context.min_f_score() > maxWeight)
+                break;
+
+            uint32_t current = context.pop_min();
+            if (scratch.target[current] && current != u)
+                targets--;
+            if (scratch.hops[current] == MAX_WITNESS_HOPS)
+                continue;   // settled, but not searched past
+
+            double currentDistance = context.g_score(current);
+            for (const WorkArc& arc : graph.out[current])
+            {
+                if (arc.node == v)
+                    continue;
+                double distance = currentDistance + arc.weight;
+                if (distance < context.g_score(arc.node))
+                {
+                    context.relax(arc.node, distance, current, distance);
+                    scratch.hops[arc.node] = scratch.hops[current] + 1;
+                }
+            }
+        }
+
+        // a node the search reached but didn't settle still has a witness at least as long as its gScore
+        for (const WorkArc& out : graph.out[v])
+            if (out.node != u && context.g_score(out.node) > in.weight + out.weight)
+                shortcuts.push_back(Shortcut{u, out.node, in.weight + out.weight});
+    }
+
+    for (const WorkArc& out : graph.out[v])
+        scratch.target[out.node] = false;
+}
+
+// Adds an arc to the graph, or shortens an existing arc between the same nodes
+static void addArc(WorkGraph& graph, uint32_t from, uint32_t to, uint32_t middle, double weight)
+{
+    auto update = [&](vector<WorkArc>& arcs, uint32_t node)
+    {
+        for (WorkArc& arc : arcs)
+        {
+            if (arc.node == node)
+            {
+                if (weight < arc.weight)
+                    arc = WorkArc{node, middle, weight};
+                return;
+            }
+        }
+        arcs.push_back(WorkArc{node, middle, weight});
+    };
+
+    update(graph.out[from], to);
+    update(graph.in[to], from);
+}
+
+static void removeArcsTo(vector<WorkArc>& arcs, uint32_t node)
+{
+    arcs.erase(remove_if(arcs.begin(), arcs.end(), [node](const WorkArc& arc) { return arc.node == node; }), arcs.end());
+}
+
+// The map's edges as a graph to contract, dropping loops and keeping the shortest of parallel edges
+static void buildWorkGraph(const GeoDatabase& geodb, WorkGraph& graph)
+{
+    uint32_t numNodes = geodb.num_nodes();
+    graph.out.resize(numNodes);
+    graph.in.resize(numNodes);
+    for (uint32_t u = 0; u < numNodes; u++)
+    {
+        geodb.touch_node(u);    // so a tiled map's tiles are read in, and checked, one by one
+        for (uint32_t e = geodb.edges_begin(u); e < geodb.edges_end(u); e++)
+            if (geodb.edge_target(e) != u)
+                addArc(graph, u, geodb.edge_target(e), NO_NODE, geodb.edge_length(e));
+    }
+}
+
+// Takes v out of the graph, keeping the arcs it still has, all to nodes that will be ranked higher,
+// as its arcs in the hierarchy, and adds the shortcuts findShortcuts found for it
+static void contract(WorkGraph& graph, uint32_t v, const vector<Shortcut>& shortcuts, vector<HierarchyArc>& up, vector<HierarchyArc>& down)
+{
+    for (const WorkArc& arc : graph.out[v])
+    {
+        up.push_back(HierarchyArc{arc.node, arc.middle, arc.weight});
+        removeArcsTo(graph.in[arc.node], v);
+    }
+    for (const WorkArc& arc : graph.in[v])
+    {
+        down.push_back(HierarchyArc{arc.node, arc.middle, arc.weight});
+        removeArcsTo(graph.out[arc.node], v);
+    }
+    graph.out[v].clear();
+    graph.in[v].clear();
+
+    for (const Shortcut& shortcut : shortcuts)
+        addArc(graph, shortcut.from, shortcut.to, v, shortcut.weight);
+}
+
+// Flattens per-node arc lists into compressed sparse row tables
+static void flatten(const vector<vector<HierarchyArc>>& lists, vector<uint32_t>& offsets, vector<HierarchyArc>& arcs)
+{
+    offsets.push_back(0);
+    for (const auto& list : lists)
+    {
+        arcs.insert(arcs.end(), list.begin(), list.end());
+        offsets.push_back(static_cast<uint32_t>(arcs.size()));
+    }
+}
+
+ContractionHierarchy::ContractionHierarchy() : m_fingerprint(0) {}
+
+ContractionHierarchy::~ContractionHierarchy() {}
+
+void ContractionHierarchy::build(const GeoDatabase& geodb)
+{
+    clear();
+
+    uint32_t numNodes = geodb.num_nodes();
+    WorkGraph graph;
+    buildWorkGraph(geodb, graph);
+
+    // A node's priority is the number of arcs contracting it would add minus the number it
+    // would remove, plus its depth, the number of levels of contracted nodes below it,
+    // which spreads contraction evenly across the map
+    vector<int> priority(numNodes);
+    vector<int> depth(numNodes, 0);
+    vector<vector<Shortcut>> shortcuts(numNodes);
+
+    // Every node's first priority is worked out in parallel
+    vector<WitnessScratch> scratch(hardware_threads());
+    auto simulate = [&](uint32_t n, WitnessScratch& nodeScratch)
+    {
+        findShortcuts(graph, n, nodeScratch, shortcuts[n]);
+        int removed = static_cast<int>(graph.in[n].size() + graph.out[n].size());
+        priority[n] = static_cast<int>(shortcuts[n].size()) - removed + depth[n];
+    };
+    parallel_for_workers(numNodes, [&](size_t w, size_t n) { simulate(static_cast<uint32_t>(n), scratch[w]); });
+
+    // Nodes are contracted in priority order, from a queue updated lazily: contracting a node
+    // only changes its neighbors' priorities, and a node's priority is only worked out again,
+    // along with its shortcuts, when it comes to the front of the queue
+    // Shortcuts found since the last contraction are still right, so they're used as they are
+    typedef pair<int, uint32_t> QueueEntry;     // priority, node
+    priority_queue<QueueEntry, vector<QueueEntry>, greater<QueueEntry>> queue;
+    vector<uint32_t> simulatedAt(numNodes, 0);  // how many nodes were contracted when its shortcuts were found
+    for (uint32_t n = 0; n < numNodes; n++)
+        queue.push(QueueEntry(priority[n], n));
+
+    vector<vector<HierarchyArc>> up(numNodes);
+    vector<vector<HierarchyArc>> down(numNodes);
+    m_rankStorage.assign(numNodes, 0);
+    vector<char> contracted(numNodes, false);
+    uint32_t nextRank = 0;
+    while ( ! queue.empty())
+    {
+        QueueEntry entry = queue.top();
+        uint32_t v = entry.second;
+        queue.pop();
+        if (contracted[v] || entry.first != priority[v])
+            continue;   // contracted already, or queued again since
+
+        if (simulatedAt[v] != nextRank)
+        {
+            simulate(v, scratch[0]);
+            simulatedAt[v] = nextRank;
+            if ( ! queue.empty() && QueueEntry(priority[v], v) > queue.top())
+            {
+                queue.push(QueueEntry(priority[v], v));     // no longer first
+                continue;
+            }
+        }
+
+        contracted[v] = true;
+        m_rankStorage[v] = nextRank++;
+        contract(graph, v, shortcuts[v], up[v], down[v]);
+        for (const HierarchyArc& arc : up[v])
+            depth[arc.target] = max(depth[arc.target], depth[v] + 1);
+        for (const HierarchyArc& arc : down[v])
+            depth[arc.target] = max(depth[arc.target], depth[v] + 1);
+        shortcuts[v].clear();
+        shortcuts[v].shrink_to_fit();
+    }
+
+    m_fingerprint = geodb.fingerprint();
+    flatten(up, m_upOffsetStorage, m_upArcStorage);
+    flatten(down, m_downOffsetStorage, m_downArcStorage);
+    use_storage();
+}
+
+void ContractionHierarchy::build(const GeoDatabase& geodb, const ContractionHierarchy& order)
+{
+    clear();
+
+    uint32_t numNodes = geodb.num_nodes();
+    WorkGraph graph;
+    buildWorkGraph(geodb, graph);
+
+    vector<uint32_t> byRank(numNodes);
+    for (uint32_t n = 0; n < numNodes; n++)
+        byRank[order.rank(n)] = n;
+
+    vector<vector<HierarchyArc>> up(numNodes);
+    vector<vector<HierarchyArc>> down(numNodes);
+    m_rankStorage.assign(numNodes, 0);
+    WitnessScratch scratch;
+    vector<Shortcut> shortcuts;
+    for (uint32_t rank = 0; rank < numNodes; rank++)
+    {
+        uint32_t v = byRank[rank];
+        findShortcuts(graph, v, scratch, shortcuts);
+        m_rankStorage[v] = rank;
+        contract(graph, v, shortcuts, up[v], down[v]);
+    }
+
+    m_fingerprint = geodb.fingerprint();
+    flatten(up, m_upOffsetStorage, m_upArcStorage);
+    flatten(down, m_downOffsetStorage, m_downArcStorage);
+    use_storage();
+}
+
+bool ContractionHierarchy::save(const std::string& hierarchy_file) const
+{
+    HierarchyHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, HIERARCHY_MAGIC, sizeof(HIERARCHY_MAGIC));
+    header.version = HIERARCHY_VERSION;
+    header.byteOrder = SNAPSHOT_BYTE_ORDER;
+
+    // build the whole file in memory, leaving room for the header
+    vector<char> file(sizeof(header), 0);
+    append_section(file, header.sections[SECTION_RANKS], m_ranks);
+    append_section(file, header.sections[SECTION_UP_OFFSETS], m_upOffsets);
+    append_section(file, header.sections[SECTION_UP_ARCS], m_upArcs);
+    append_section(file, header.sections[SECTION_DOWN_OFFSETS], m_downOffsets);
+    append_section(file, header.sections[SECTION_DOWN_ARCS], m_downArcs);
+
+    header.fileSize = file.size();
+    header.checksum = snapshot_checksum(file.data() + sizeof(header), file.size() - sizeof(header));
+    header.mapFingerprint = m_fingerprint;
+    memcpy(file.data(), &header, sizeof(header));
+
+    ofstream outf(hierarchy_file, ios::binary | ios::trunc);
+    if ( ! outf)    // file can't be created
+        return false;
+
+    outf.write(file.data(), file.size());
+    return static_cast<bool>(outf);
+}
+
+bool ContractionHierarchy::load(const std::string& hierarchy_file, const GeoDatabase& geodb)
+{
+    clear();
+
+    if ( ! m_file.open(hierarchy_file))
+        return false;   // file not found
+
+    if (m_file.size() < sizeof(HierarchyHeader) || memcmp(m_file.data(), HIERARCHY_MAGIC, sizeof(HIERARCHY_MAGIC)) != 0)
+    {
+        clear();
+        return false;   // not a hierarchy
+    }
+
+    HierarchyHeader header;
+    memcpy(&header, m_file.data(), sizeof(header));
+
+    bool ok = header.version == HIERARCHY_VERSION && header.byteOrder == SNAPSHOT_BYTE_ORDER &&
+        header.fileSize == m_file.size() && header.mapFingerprint == geodb.fingerprint() &&
+        header.checksum == snapshot_checksum(m_file.data() + sizeof(header), m_file.size() - sizeof(header));
+
+    ok = ok && view_section(m_file, header.sections[SECTION_RANKS], m_ranks) &&
+        view_section(m_file, header.sections[SECTION_UP_OFFSETS], m_upOffsets) &&
+        view_section(m_file, header.sections[SECTION_UP_ARCS], m_upArcs) &&
+        view_section(m_file, header.sections[SECTION_DOWN_OFFSETS], m_downOffsets) &&
+        view_section(m_file, header.sections[SECTION_DOWN_ARCS], m_downArcs);
+
+    // every node has a rank and one offset per arc table, plus one
+    if ( ! ok || m_ranks.size() != geodb.num_nodes() ||
+        m_upOffsets.size() != m_ranks.size() + 1 || m_downOffsets.size() != m_ranks.size() + 1)
+    {
+        clear();
+        return false;
+    }
+
+    m_fingerprint = header.mapFingerprint;
+    return true;
+}
+
+void ContractionHierarchy::unpack(uint32_t from, uint32_t to, std::vector<uint32_t>& path) const
+{
+    // arcs still to unpack, the next one on top
+    vector<pair<uint32_t, uint32_t>> pending;
+    pending.push_back(pair(from, to));
+
+    while ( ! pending.empty())
+    {
+        auto [a, b] = pending.back();
+        pending.pop_back();
+
+        const HierarchyArc* arc = find_arc(a, b);
+        if (arc->middle == NO_NODE)
+            path.push_back(b);  // an original edge
+        else
+        {
+            // a shortcut stands for a -> middle, then middle -> b
+            pending.push_back(pair(arc->middle, b));
+            pending.push_back(pair(a, arc->middle));
+        }
+    }
+}
+
+// The arc from -> to, which is stored at its lower ranked end
+const HierarchyArc* ContractionHierarchy::find_arc(uint32_t from, uint32_t to) const
+{
+    if (m_ranks[from] < m_ranks[to])
+    {
+        for (const HierarchyArc* arc = up_begin(from); arc != up_end(from); arc++)
+            if (arc->target == to)
+                return arc;
+    }
+    else
+    {
+        for (const HierarchyArc* arc = down_begin(to); arc != down_end(to); arc++)
+            if (arc->target == from)
+                return arc;
+    }
+    return nullptr;
+}
+
+void ContractionHierarchy::clear()
+{
+    m_file.close();
+    m_rankStorage.clear();
+    m_upOffsetStorage.clear();
+    m_upArcStorage.clear();
+    m_downOffsetStorage.clear();
+    m_downArcStorage.clear();
+    m_fingerprint = 0;
+    use_storage();
+}
+
+// Point every table's view at its storage vector
+void ContractionHierarchy::use_storage()
+{
+    m_ranks = m_rankStorage;
+    m_upOffsets = m_upOffsetStorage;
+    m_upArcs = m_upArcStorage;
+    m_downOffsets = m_downOffsetStorage;
+    m_downArcs = m_downArcStorage;
+}
@@ -0,0 +1,138 @@
+#include "distance_matrix.h"
+#include "geodb.h"
+#include "geopoint.h"
+#include "parallel.h"
+#include "search_context.h"
+#include "search_stats.h"
+#include "trace.h"
+#include "stops.h"
+#include <vector>
+#include <string>
+#include <limits>
+#include <algorithm>
+using namespace std;
+
+DistanceMatrix::DistanceMatrix(const GeoDatabase& geodb) : m_geodb(geodb), m_size(0) {}
+
+DistanceMatrix::~DistanceMatrix() {}
+
+bool DistanceMatrix::compute(const std::vector<GeoPoint>& points, bool keep_paths)
+{
+    TraceSpan span("distance_matrix");
+    clear();
+
+    for (const auto& point : points)
+    {
+        uint32_t id;
+        if ( ! m_geodb.get_node_id(point, id))
+        {
+            clear();
+            return false;   // point is not on the map
+        }
+        m_nodes.push_back(id);
+    }
+
+    m_size = static_cast<int>(points.size());
+    m_distances.assign(static_cast<size_t>(m_size) * m_size, numeric_limits<double>::infinity());
+    if (keep_paths)
+        m_trees.resize(m_size);
+
+    // several points may share a node, so a search counts the distinct nodes it still has to settle
+    vector<uint32_t> targets(m_nodes);
+    sort(targets.begin(), targets.end());
+    targets.erase(unique(targets.begin(), targets.end()), targets.end());
+
+    vector<SearchContext> contexts(hardware_threads());
+    vector<vector<uint32_t>> settled(hardware_threads());
+    parallel_for_workers(m_size, [&](size_t w, size_t source)
+    {
+        SearchContext& context = contexts[w];
+        context.reset(m_geodb.num_nodes());
+        SearchRecorder recorder(context);
+        context.relax(m_nodes[source], 0, NO_NODE, 0);
+        settled[w].clear();
+
+        size_t unsettled = targets.size();
+        while ( ! context.open_empty() && unsettled > 0)
+        {
+            uint32_t current = context.pop_min();
+            m_geodb.touch_node(current);
+            if (binary_search(targets.begin(), targets.end(), current))
+                unsettled--;
+            if (keep_paths)
+                settled[w].push_back(current);
+
+            double currentDistance = context.g_score(current);
+            context.count_scanned(m_geodb.edges_end(current) - m_geodb.edges_begin(current));
+            for (uint32_t e = m_geodb.edges_begin(current); e < m_geodb.edges_end(current); e++)
+            {
+                uint32_t neighbor = m_geodb.edge_target(e);
+                double distance = currentDistance + m_geodb.edge_length(e);
+                if (distance < context.g_score(neighbor))
+                    context.relax(neighbor, distance, current, distance);
+            }
+        }
+
+        // a point the search never settled can't be reached
+        double* row = &m_distances[source * m_size];
+        for (int to = 0; to < m_size; to++)
+            if (context.is_closed(m_nodes[to]))
+                row[to] = context.g_score(m_nodes[to]);
+
+        if (keep_paths)
+        {
+            vector<TreeEntry>& tree = m_trees[source];
+            tree.reserve(settled[w].size());
+            for (uint32_t node : settled[w])
+                tree.push_back(TreeEntry{node, context.previous(node)});
+            sort(tree.begin(), tree.end(), [](const TreeEntry& lhs, const TreeEntry& rhs) { return lhs.node < rhs.node; });
+        }
+    });
+
+    return true;
+}
+
+bool DistanceMatrix::compute(const Stops& stops, bool keep_paths)
+{
+    vector<GeoPoint> points(stops.size());
+    for (int i = 0; i < stops.size(); i++)
+    {
+        string poi;
+        string commentary;
+        stops.get_poi_data(i, poi, commentary);
+        if ( ! m_geodb.get_poi_location(poi, points[i]))
+        {
+            clear();
+            return false;   // point of interest not found in the map data
+        }
+    }
+
+    return compute(points, keep_paths);
+}
+
+std::vector<GeoPoint> DistanceMatrix::path(int from, int to) const
+{
+    vector<GeoPoint> path;
+    if (static_cast<size_t>(from) >= m_trees.size() || distance(from, to) == numeric_limits<double>::infinity())
+        return path;    // no route, or the paths weren't kept
+
+    // backtrack through the tree; every node on a settled node's path was settled too
+    const vector<TreeEntry>& tree = m_trees[from];
+    for (uint32_t current = m_nodes[to]; current != NO_NODE; )
+    {
+        path.push_back(m_geodb.get_node_point(current));
+        auto it = lower_bound(tree.begin(), tree.end(), current, [](const TreeEntry& entry, uint32_t node) { return entry.node < node; });
+        current = it->previous;
+    }
+
+    reverse(path.begin(), path.end());  // the path was built from the end back to the start
+    return path;
+}
+
+void DistanceMatrix::clear()
+{
+    m_size = 0;
+    m_nodes.clear();
+    m_distances.clear();
+    m_trees.clear();
+}
@@ -0,0 +1,476 @@
+#include "geo_batch.h"
+#include "geotools.h"
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define GEO_BATCH_AVX2
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+// sin, cos, asin and atan2 are evaluated with fdlibm's polynomials rather than the C library's,
+// so that the AVX2 kernels below can do exactly what the scalar ones do: every AVX2 function
+// mirrors its scalar twin operation for operation, without fused multiply-adds, and IEEE
+// arithmetic then rounds each lane just as it rounds a double
+
+namespace
+{
+    const double MILES_PER_KM = 0.621371;   // as distance_earth_miles converts
+
+    // Adding 1.5 * 2^52 to a double of magnitude below 2^51 rounds it to an integer, which the
+    // sum's low bits then hold in two's complement
+    const double ROUNDING_SHIFT = 6755399441055744.0;
+
+    // pi / 2 in three parts, the first two short enough that multiples of them by a small
+    // quadrant number are exact
+    const double TWO_OVER_PI = 6.36619772367581382433e-01;
+    const double PIO2_1 = 1.57079632673412561417e+00;
+    const double PIO2_2 = 6.07710050630396597660e-11;
+    const double PIO2_3 = 2.02226624879595063154e-21;
+
+    const double PIO2_HI = 1.57079632679489655800e+00;
+    const double PIO2_LO = 6.12323399573676603587e-17;
+    const double PIO4_HI = 7.85398163397448278999e-01;
+    const double PI_HI = 3.14159265358979311600e+00;
+    const double PI_LO = 1.22464679914735317720e-16;
+
+    const uint64_t HIGH_WORD = 0xFFFFFFFF00000000ULL;   // a double's sign, exponent and leading 20 bits
+
+    // Polynomial coefficients, lowest power first
+    const double SIN[6] = {
+        -1.66666666666666324348e-01, 8.33333333332248946124e-03, -1.98412698298579493134e-04,
+        2.75573137070700676789e-06, -2.50507602534068634195e-08, 1.58969099521155010221e-10,
+    };
+    const double COS[6] = {
+        4.16666666666666019037e-02, -1.38888888888741095749e-03, 2.48015872894767294178e-05,
+        -2.75573143513906633035e-07, 2.08757232129817482790e-09, -1.13596475577881948265e-11,
+    };
+    const double ASIN_P[6] = {
+        1.66666666666666657415e-01, -3.25565818622400915405e-01, 2.01212532134862925881e-01,
+        -4.00555345006794114027e-02, 7.91534994289814532176e-04, 3.47933107596021167570e-05,
+    };
+    const double ASIN_Q[5] = {
+        1.0, -2.40339491173441421878e+00, 2.02094576023350569471e+00, -6.88283971605453293030e-01,
+        7.70381505559019352791e-02,
+    };
+    const double ATAN_EVEN[6] = {
+        3.33333333333329318027e-01, 1.42857142725034663711e-01, 9.09088713343650656196e-02,
+        6.66107313738753120669e-02, 4.97687799461593236017e-02, 1.62858201153657823623e-02,
+    };
+    const double ATAN_ODD[5] = {
+        -1.99999999998764832476e-01, -1.11111104054623557880e-01, -7.69187620504482999495e-02,
+        -5.83357013379057348645e-02, -3.65315727442169155270e-02,
+    };
+    const double ATAN_HALF_HI = 4.63647609000806093515e-01;     // atan(0.5)
+    const double ATAN_HALF_LO = 2.26987774529616870924e-17;
+    const double ATAN_ONE_HI = 7.85398163397448278999e-01;      // atan(1)
+    const double ATAN_ONE_LO = 3.06161699786838301793e-17;
+
+    atomic<bool> simdEnabled(batch_simd_supported());
+
+    // ---- one pair at a time ----
+
+    // c[0] + z * (c[1] + z * (... + z * c[n - 1]))
+    double horner(double z, const double* c, size_t n)
+    {
+        double p = c[n - 1];
+        for (size_t k = n - 1; k > 0; k--)
+            p = c[k - 1] + z * p;
+        return p;
+    }
+
+    // sin and cos of r in [-pi/4, pi/4]
+    double sin_kernel(double r)
+    {
+        double z = r * r;
+        double v = z * r;
+        return r + v * horner(z, SIN, 6);
+    }
+
+    double cos_kernel(double r)
+    {
+        double z = r * r;
+        double p = z * horner(z, COS, 6);
+        double hz = 0.5 * z;
+        double w = 1.0 - hz;
+        return w + (((1.0 - w) - hz) + z * p);
+    }
+
+    // Splits x into a remainder in [-pi/4, pi/4] and the number of quarter turns before it,
+    // of which only the low two bits matter
+    // Exact enough for angles of a few turns, which is all a latitude or longitude can be
+    double reduce(double x, uint64_t& quadrant)
+    {
+        double shifted = x * TWO_OVER_PI + ROUNDING_SHIFT;
+        double q = shifted - ROUNDING_SHIFT;
+        memcpy(&quadrant, &shifted, sizeof(quadrant));
+        return ((x - q * PIO2_1) - q * PIO2_2) - q * PIO2_3;
+    }
+
+    double sin_of(double x)
+    {
+        uint64_t quadrant;
+        double r = reduce(x, quadrant);
+        double result = (quadrant & 1) ? cos_kernel(r) : sin_kernel(r);
+        return (quadrant & 2) ? -result : result;
+    }
+
+    double cos_of(double x)
+    {
+        uint64_t quadrant;
+        double r = reduce(x, quadrant);
+        double result = (quadrant & 1) ? sin_kernel(r) : cos_kernel(r);
+        return ((quadrant + 1) & 2) ? -result : result;
+    }
+
+    // asin(x) = x + x * asin_ratio(x * x) near 0, and is worked out from asin_ratio((1 - x) / 2) near 1
+    double asin_ratio(double t)
+    {
+        return t * horner(t, ASIN_P, 6) / horner(t, ASIN_Q, 5);
+    }
+
+    // asin of x in [0, 1]
+    double asin_of(double x)
+    {
+        if (x < 0.5)
+            return x + x * asin_ratio(x * x);
+        double t = (1.0 - x) * 0.5;
+        double s = sqrt(t);
+        double r = asin_ratio(t);
+        if (x >= 0.975)
+            return PIO2_HI - (2.0 * (s + s * r) - PIO2_LO);
+
+        // below that, s is split so the leading half of the result is exact
+        uint64_t bits;
+        memcpy(&bits, &s, sizeof(bits));
+        bits &= HIGH_WORD;
+        double w;
+        memcpy(&w, &bits, sizeof(w));
+        double c = (t - w * w) / (s + w);
+        return PIO4_HI - ((2.0 * s * r - (PIO2_LO - 2.0 * c)) - (PIO4_HI - 2.0 * w));
+    }
+
+    // atan of x in [0, 1], reduced around 0, 1/2 or 1
+    double atan_of(double x)
+    {
+        double hi = 0, lo = 0;
+        double numerator = x, denominator = 1.0;
+        if (x >= 11.0 / 16)
+        {
+            hi = ATAN_ONE_HI;
+            lo = ATAN_ONE_LO;
+            numerator = x - 1.0;
+            denominator = x + 1.0;
+        }
+        else if (x >= 7.0 / 16)
+        {
+            hi = ATAN_HALF_HI;
+            lo = ATAN_HALF_LO;
+            numerator = 2.0 * x - 1.0;
+            denominator = 2.0 + x;
+        }
+        x = numerator / denominator;
+        double z = x * x;
+        double w = z * z;
+        double s1 = z * horner(w, ATAN_EVEN, 6);
+        double s2 = w * horner(w, ATAN_ODD, 5);
+        return hi - ((x * (s1 + s2) - lo) - x);
+    }
+
+    double atan2_of(double y, double x)
+    {
+        double ay = fabs(y);
+        double ax = fabs(x);
+        double big = (ay > ax) ? ay : ax;
+        double small = (ay > ax) ? ax : ay;
+        double a = atan_of((big > 0) ? small / big : 0.0);
+        if (ay > ax)
+            a = PIO2_HI - (a - PIO2_LO);
+        if (x < 0)
+            a = PI_HI - (a - PI_LO);
+        return (y < 0) ? -a : a;
+    }
+
+    double distance_of(double lat1, double lon1, double lat2, double lon2)
+    {
+        // the haversine formula, as distance_earth_km takes it
+        // Radians are worked out just as deg2rad does, since nearby points' difference in radians
+        // magnifies any rounding in them
+        double lat1r = lat1 * pi / 180;
+        double lon1r = lon1 * pi / 180;
+        double lat2r = lat2 * pi / 180;
+        double lon2r = lon2 * pi / 180;
+        double u = sin_of((lat2r - lat1r) * 0.5);
+        double v = sin_of((lon2r - lon1r) * 0.5);
+        double h = u * u + cos_of(lat1r) * cos_of(lat2r) * v * v;
+        h = (h < 1.0) ? h : 1.0;    // rounding can push antipodes just past 1
+        return 2.0 * earthRadiusKm * asin_of(sqrt(h)) * MILES_PER_KM;
+    }
+
+    double turn_of(double bearing1, double bearing2)
+    {
+        double result = (bearing2 - bearing1) * 180 / pi;
+        return (result < 0) ? result + 360 : result;
+    }
+
+#ifdef GEO_BATCH_AVX2
+    // ---- four pairs at a time ----
+    // Each function is its scalar twin with the branches turned into blends
+
+    #define AVX2 __attribute__((target("avx2")))
+
+    AVX2 inline __m256d splat(double x) { return _mm256_set1_pd(x); }
+    AVX2 inline __m256d add(__m256d a, __m256d b) { return _mm256_add_pd(a, b); }
+    AVX2 inline __m256d sub(__m256d a, __m256d b) { return _mm256_sub_pd(a, b); }
+    AVX2 inline __m256d mul(__m256d a, __m256d b) { return _mm256_mul_pd(a, b); }
+    AVX2 inline __m256d div(__m256d a, __m256d b) { return _mm256_div_pd(a, b); }
+
+    // mask ? a : b, lane by lane
+    AVX2 inline __m256d blend(__m256d mask, __m256d a, __m256d b) { return _mm256_blendv_pd(b, a, mask); }
+    AVX2 inline __m256d negate_if(__m256d mask, __m256d x) { return _mm256_xor_pd(x, _mm256_and_pd(mask, splat(-0.0))); }
+    AVX2 inline __m256d is_less(__m256d a, __m256d b) { return _mm256_cmp_pd(a, b, _CMP_LT_OQ); }
+    AVX2 inline __m256d is_greater(__m256d a, __m256d b) { return _mm256_cmp_pd(a, b, _CMP_GT_OQ); }
+
+    AVX2 inline __m256d horner(__m256d z, const double* c, size_t n)
+    {
+        __m256d p = splat(c[n - 1]);
+        for (size_t k = n - 1; k > 0; k--)
+            p = add(splat(c[k - 1]), mul(z, p));
+        return p;
+    }
+
+    AVX2 inline __m256d sin_kernel(__m256d r)
+    {
+        __m256d z = mul(r, r);
+        __m256d v = mul(z, r);
+        return add(r, mul(v, horner(z, SIN, 6)));
+    }
+
+    AVX2 inline __m256d cos_kernel(__m256d r)
+    {
+        __m256d z = mul(r, r);
+        __m256d p = mul(z, horner(z, COS, 6));
+        __m256d hz = mul(splat(0.5), z);
+        __m256d w = sub(splat(1.0), hz);
+        return add(w, add(sub(sub(splat(1.0), w), hz), mul(z, p)));
+    }
+
+    AVX2 inline __m256d reduce(__m256d x, __m256i& quadrant)
+    {
+        __m256d shifted = add(mul(x, splat(TWO_OVER_PI)), splat(ROUNDING_SHIFT));
+        __m256d q = sub(shifted, splat(ROUNDING_SHIFT));
+        quadrant = _mm256_castpd_si256(shifted);
+        return sub(sub(sub(x, mul(q, splat(PIO2_1))), mul(q, splat(PIO2_2))), mul(q, splat(PIO2_3)));
+    }
+
+    // Moves bit b of every lane to its sign bit, where blends and sign flips look
+    AVX2 inline __m256d bit_to_sign(__m256i lanes, int b)
+    {
+        return _mm256_and_pd(_mm256_castsi256_pd(_mm256_slli_epi64(lanes, 63 - b)), splat(-0.0));
+    }
+
+    AVX2 inline __m256d sin_of(__m256d x)
+    {
+        __m256i quadrant;
+        __m256d r = reduce(x, quadrant);
+        __m256d result = blend(bit_to_sign(quadrant, 0), cos_kernel(r), sin_kernel(r));
+        return _mm256_xor_pd(result, bit_to_sign(quadrant, 1));
+    }
+
+    AVX2 inline __m256d cos_of(__m256d x)
+    {
+        __m256i quadrant;
+        __m256d r = reduce(x, quadrant);
+        __m256d result = blend(bit_to_sign(quadrant, 0), sin_kernel(r), cos_kernel(r));
+        return _mm256_xor_pd(result, bit_to_sign(_mm256_add_epi64(quadrant, _mm256_set1_epi64x(1)), 1));
+    }
+
+    AVX2 inline __m256d asin_ratio(__m256d t)
+    {
+        return div(mul(t, horner(t, ASIN_P, 6)), horner(t, ASIN_Q, 5));
+    }
+
+    AVX2 inline __m256d asin_of(__m256d x)
+    {
+        // one ratio serves both ends, since each lane only needs its own
+        __m256d low = is_less(x, splat(0.5));
+        __m256d t = mul(sub(splat(1.0), x), splat(0.5));
+        __m256d s = _mm256_sqrt_pd(t);
+        __m256d r = asin_ratio(blend(low, mul(x, x), t));
+        __m256d nearZero = add(x, mul(x, r));
+        __m256d nearOne = sub(splat(PIO2_HI), sub(mul(splat(2.0), add(s, mul(s, r))), splat(PIO2_LO)));
+        __m256d w = _mm256_and_pd(s, _mm256_castsi256_pd(_mm256_set1_epi64x(static_cast<long long>(HIGH_WORD))));
+        __m256d c = div(sub(t, mul(w, w)), add(s, w));
+        __m256d between = sub(splat(PIO4_HI), sub(sub(mul(mul(splat(2.0), s), r), sub(splat(PIO2_LO), mul(splat(2.0), c))),
+                                                  sub(splat(PIO4_HI), mul(splat(2.0), w))));
+        __m256d result = blend(_mm256_cmp_pd(x, splat(0.975), _CMP_GE_OQ), nearOne, between);
+        return blend(low, nearZero, result);
+    }
+
+    AVX2 inline __m256d atan_of(__m256d x)
+    {
+        __m256d nearOne = _mm256_cmp_pd(x, splat(11.0 / 16), _CMP_GE_OQ);
+        __m256d nearHalf = _mm256_andnot_pd(nearOne, _mm256_cmp_pd(x, splat(7.0 / 16), _CMP_GE_OQ));
+        __m256d hi = blend(nearOne, splat(ATAN_ONE_HI), blend(nearHalf, splat(ATAN_HALF_HI), splat(0.0)));
+        __m256d lo = blend(nearOne, splat(ATAN_ONE_LO), blend(nearHalf, splat(ATAN_HALF_LO), splat(0.0)));
+        __m256d numerator = blend(nearOne, sub(x, splat(1.0)), blend(nearHalf, sub(mul(splat(2.0), x), splat(1.0)), x));
+        __m256d denominator = blend(nearOne, add(x, splat(1.0)), blend(nearHalf, add(splat(2.0), x), splat(1.0)));
+        x = div(numerator, denominator);
+
+        __m256d z = mul(x, x);
+        __m256d w = mul(z, z);
+        __m256d s1 = mul(z, horner(w, ATAN_EVEN, 6));
+        __m256d s2 = mul(w, horner(w, ATAN_ODD, 5));
+        return sub(hi, sub(sub(mul(x, add(s1, s2)), lo), x));
+    }
+
+    AVX2 inline __m256d atan2_of(__m256d y, __m256d x)
+    {
+        __m256d ay = _mm256_andnot_pd(splat(-0.0), y);
+        __m256d ax = _mm256_andnot_pd(splat(-0.0), x);
+        __m256d steep = is_greater(ay, ax);
+        __m256d big = blend(steep, ay, ax);
+        __m256d small = blend(steep, ax, ay);
+        __m256d a = atan_of(blend(is_greater(big, splat(0.0)), div(small, big), splat(0.0)));
+        a = blend(steep, sub(splat(PIO2_HI), sub(a, splat(PIO2_LO))), a);
+        a = blend(is_less(x, splat(0.0)), sub(splat(PI_HI), sub(a, splat(PI_LO))), a);
+        return negate_if(is_less(y, splat(0.0)), a);
+    }
+
+    AVX2 void distances_avx2(const double* lat1, const double* lon1, const double* lat2, const double* lon2,
+                             size_t count, double* distances)
+    {
+        for (size_t i = 0; i < count; i += 4)
+        {
+            __m256d lat1r = div(mul(_mm256_loadu_pd(lat1 + i), splat(pi)), splat(180));
+            __m256d lon1r = div(mul(_mm256_loadu_pd(lon1 + i), splat(pi)), splat(180));
+            __m256d lat2r = div(mul(_mm256_loadu_pd(lat2 + i), splat(pi)), splat(180));
+            __m256d lon2r = div(mul(_mm256_loadu_pd(lon2 + i), splat(pi)), splat(180));
+            __m256d u = sin_of(mul(sub(lat2r, lat1r), splat(0.5)));
+            __m256d v = sin_of(mul(sub(lon2r, lon1r), splat(0.5)));
+            __m256d h = add(mul(u, u), mul(mul(mul(cos_of(lat1r), cos_of(lat2r)), v), v));
+            h = blend(is_less(h, splat(1.0)), h, splat(1.0));
+            __m256d d = mul(mul(mul(splat(2.0), splat(earthRadiusKm)), asin_of(_mm256_sqrt_pd(h))), splat(MILES_PER_KM));
+            _mm256_storeu_pd(distances + i, d);
+        }
+    }
+
+    AVX2 void bearings_avx2(const double* lat1, const double* lon1, const double* lat2, const double* lon2,
+                            size_t count, double* bearings)
+    {
+        for (size_t i = 0; i < count; i += 4)
+        {
+            __m256d dlat = sub(_mm256_loadu_pd(lat2 + i), _mm256_loadu_pd(lat1 + i));
+            __m256d dlon = sub(_mm256_loadu_pd(lon2 + i), _mm256_loadu_pd(lon1 + i));
+            _mm256_storeu_pd(bearings + i, atan2_of(dlat, dlon));
+        }
+    }
+
+    AVX2 void turns_avx2(const double* bearings, size_t count, double* turns)
+    {
+        for (size_t i = 0; i < count; i += 4)
+        {
+            __m256d result = div(mul(sub(_mm256_loadu_pd(bearings + i + 1), _mm256_loadu_pd(bearings + i)), splat(180)), splat(pi));
+            _mm256_storeu_pd(turns + i, blend(is_less(result, splat(0.0)), add(result, splat(360)), result));
+        }
+    }
+
+    #undef AVX2
+#endif
+
+    // How many leading items the AVX2 kernels take, leaving the rest to the scalar ones
+    size_t simd_count(size_t count)
+    {
+        return simdEnabled.load(memory_order_relaxed) ? count - count % 4 : 0;
+    }
+}
+
+void batch_distance_miles(const double* lat1, const double* lon1, const double* lat2, const double* lon2,
+                          size_t count, double* distances)
+{
+    size_t i = simd_count(count);
+#ifdef GEO_BATCH_AVX2
+    distances_avx2(lat1, lon1, lat2, lon2, i, distances);
+#endif
+    for (; i < count; i++)
+        distances[i] = distance_of(lat1[i], lon1[i], lat2[i], lon2[i]);
+}
+
+void batch_bearings(const double* lat1, const double* lon1, const double* lat2, const double* lon2,
+                    size_t count, double* bearings)
+{
+    size_t i = simd_count(count);
+#ifdef GEO_BATCH_AVX2
+    bearings_avx2(lat1, lon1, lat2, lon2, i, bearings);
+#endif
+    for (; i < count; i++)
+        bearings[i] = atan2_of(lat2[i] - lat1[i], lon2[i] - lon1[i]);
+}
+
+void batch_turn_angles(const double* bearings, size_t count, double* turns)
+{
+    if (count < 2)
+        return;
+    size_t i = simd_count(count - 1);
+#ifdef GEO_BATCH_AVX2
+    turns_avx2(bearings, i, turns);
+#endif
+    for (; i < count - 1; i++)
+        turns[i] = turn_of(bearings[i], bearings[i + 1]);
+}
+
+bool batch_simd_supported()
+{
+#ifdef GEO_BATCH_AVX2
+    __builtin_cpu_init();   // this may run before the constructor that would otherwise do it
+    return __builtin_cpu_supports("avx2");
+#else
+    return false;
+#endif
+}
+
+bool batch_simd_enabled()
+{
+    return simdEnabled.load(memory_order_relaxed);
+}
+
+void set_batch_simd(bool enabled)
+{
+    simdEnabled.store(enabled && batch_simd_supported(), memory_order_relaxed);
+}
+
+void PathColumns::assign(const std::vector<GeoPoint>& path)
+{
+    latitudes.resize(path.size());
+    longitudes.resize(path.size());
+    for (size_t i = 0; i < path.size(); i++)
+    {
+        latitudes[i] = path[i].latitude;
+        longitudes[i] = path[i].longitude;
+    }
+}
+
+double path_length_miles(const std::vector<GeoPoint>& path)
+{
+    if (path.size() < 2)
+        return 0;
+
+    // the scratch columns are reused across calls on each thread
+    thread_local PathColumns columns;
+    thread_local vector<double> distances;
+    columns.assign(path);
+    distances.resize(path.size() - 1);
+    batch_distance_miles(columns.latitudes.data(), columns.longitudes.data(),
+                         columns.latitudes.data() + 1, columns.longitudes.data() + 1, distances.size(), distances.data());
+
+    double length = 0;
+    for (double distance : distances)
+        length += distance;
+    return length;
+}
@@ -0,0 +1,116 @@
+#include "geocoord.h"
+#include "geopoint.h"
+#include <charconv>
+#include <cmath>
+#include <string>
+#include <string_view>
+using namespace std;
+
+bool parse_fixed7(std::string_view& text, int32_t& value)
+{
+    size_t pos = 0;
+    while (pos < text.size() && (text[pos] == ' ' || text[pos] == '\t' || text[pos] == '\r'))
+        pos++;
+
+    bool negative = false;
+    if (pos < text.size() && (text[pos] == '-' || text[pos] == '+'))
+        negative = (text[pos++] == '-');
+
+    // whole degrees
+    int64_t whole = 0;
+    auto result = from_chars(text.data() + pos, text.data() + text.size(), whole);
+    bool haveWhole = (result.ec == errc());
+    if (haveWhole)
+        pos = result.ptr - text.data();
+    else if (result.ec != errc::invalid_argument)
+        return false;   // out of range
+
+    // up to 7 decimal places, rounded on the 8th
+    int64_t fraction = 0;
+    int digits = 0;
+    bool roundUp = false;
+    if (pos < text.size() && text[pos] == '.')
+    {
+        pos++;
+        for (; pos < text.size() && text[pos] >= '0' && text[pos] <= '9'; pos++, digits++)
+        {
+            if (digits < 7)
+                fraction = fraction * 10 + (text[pos] - '0');
+            else if (digits == 7)
+                roundUp = (text[pos] >= '5');
+        }
+    }
+
+    if ( ! haveWhole && digits == 0)
+        return false;   // not a number
+
+    for (int i = digits; i < 7; i++)
+        fraction *= 10;
+
+    int64_t units = whole * 10000000 + fraction + (roundUp ? 1 : 0);
+    if (units > INT32_MAX)
+        return false;
+
+    value = static_cast<int32_t>(negative ? -units : units);
+    text.remove_prefix(pos);
+    return true;
+}
+
+bool to_geocoord(const GeoPoint& pt, GeoCoord& coord)
+{
+    string_view lat(pt.sLatitude);
+    string_view lon(pt.sLongitude);
+    return parse_fixed7(lat, coord.lat) && parse_fixed7(lon, coord.lon);
+}
+
+// Reads all of text as a number of degrees no more than limit either way, in 1e-7 degree units
+// JSON numbers such as 3.4e1 are read too, which parse_fixed7 doesn't
+static bool parseDegrees(std::string_view text, double limit, int32_t& value)
+{
+    double degrees;
+    auto result = from_chars(text.data(), text.data() + text.size(), degrees);
+    if (result.ec != errc() || result.ptr != text.data() + text.size() || ! (fabs(degrees) <= limit))
+        return false;   // not a number, out of range, or NaN
+    value = static_cast<int32_t>(llround(degrees * 1e7));
+    return true;
+}
+
+bool parse_location(std::string_view latitude, std::string_view longitude, GeoCoord& coord)
+{
+    return parseDegrees(latitude, 90, coord.lat) && parseDegrees(longitude, 180, coord.lon);
+}
+
+// Writes a number of 1e-7 degree units with 7 decimal places, returning the end of the text
+static char* formatFixed7(char* out, int32_t value)
+{
+    int64_t units = value;
+    if (units < 0)
+    {
+        *out++ = '-';
+        units = -units;
+    }
+
+    out = to_chars(out, out + 16, units / 10000000).ptr;
+    *out++ = '.';
+
+    int64_t fraction = units % 10000000;
+    for (int i = 6; i >= 0; i--, fraction /= 10)
+        out[i] = static_cast<char>('0' + fraction % 10);
+    return out + 7;
+}
+
+GeoPoint to_geopoint(const GeoCoord& coord)
+{
+    char lat[24];
+    char lon[24];
+    *formatFixed7(lat, coord.lat) = '\0';
+    *formatFixed7(lon, coord.lon) = '\0';
+    return GeoPoint(lat, lon);
+}
+
+GeoCoord midpoint(const GeoCoord& p1, const GeoCoord& p2)
+{
+    // a sum of two units is halved, with an odd sum rounded away from zero
+    auto half = [](int64_t sum) { return static_cast<int32_t>(sum >= 0 ? (sum + 1) / 2 : (sum - 1) / 2); };
+    return GeoCoord{half(static_cast<int64_t>(p1.lat) + p2.lat), half(static_cast<int64_t>(p1.lon) + p2.lon)};
+}
@@ -1,171 +1,327 @@
 #include "geodb.h"
+#include "geo_batch.h"
 #include "geopoint.h"
 #include "geotools.h"
 #include "hashmap.h"
+#include "map_snapshot.h"
+#include "map_parser.h"
+#include "search_stats.h"
+#include "trace.h"
 #include <string>
 #include <vector>
 #include <iostream>
 #include <fstream>
-#include <sstream>
+#include <string_view>
+#include <algorithm>
+#include <cstring>
 using namespace std;
 
-GeoDatabase::GeoDatabase() {}
+GeoDatabase::GeoDatabase() : m_tileSize(0) {}
 
 GeoDatabase::~GeoDatabase() {}
 
 bool GeoDatabase::load(const std::string& map_data_file)
 {
-    ifstream inf(map_data_file);
-    
-    if ( ! inf) // file not found
-        return false;
-    
-    // Each "block" of lines in the map data file has
-    // A line with the name of the street segment
-    // A line with the starting and ending GeoPoints of the street segment
-    // A line with the number (P) of points of interest reachable from the street segment
-    // P lines with the names and locations of the points of interest found on the street segment
+    TraceSpan span("load");
+    if (span.active())
+        span.set_detail(map_data_file);
+    clear();
+
+    bool opened;
+    {
+        TraceSpan readSpan("load.read");
+        opened = m_file.open(map_data_file);
+    }
+    if ( ! opened)
+    {
+        // an empty file can't be mapped, but is still an empty map
+        ifstream inf(map_data_file);
+        if ( ! inf) // file not found
+            return false;
+
+        build_tables(ParsedMap());
+        return true;
+    }
+
+    if (is_snapshot(m_file.data(), m_file.size()))
+        return load_snapshot();
+
+    // not a snapshot, so it must be a text map
+    ParsedMap parsed;
+    bool ok;
+    {
+        TraceSpan parseSpan("load.parse");
+        ok = parse_map_data(m_file.data(), m_file.size(), parsed);
+    }
+    if (ok)
+    {
+        TraceSpan buildSpan("load.build_tables");
+        build_tables(parsed);
+    }
+
+    m_file.close();     // the tables now hold copies of everything they need from the text
+    return ok;
+}
+
+// Build the tables from the contents of a text map data file
+void GeoDatabase::build_tables(const ParsedMap& parsed)
+{
+    const vector<RawEdge>& edges = parsed.edges;
+
+    // Every distinct location becomes a node, numbered in sorted order
+    TraceSpan nodeSpan("build.nodes");
+    for (const auto& edge : edges)
+        m_nodeStorage.push_back(edge.from);
+    for (const auto& poi : parsed.pois)
+        m_nodeStorage.push_back(poi.second);
+    sort(m_nodeStorage.begin(), m_nodeStorage.end());
+    m_nodeStorage.erase(unique(m_nodeStorage.begin(), m_nodeStorage.end()), m_nodeStorage.end());
+    m_nodes = m_nodeStorage;
+
+    nodeSpan.end();
+
+    // Build the compressed sparse row adjacency
+    // Edges leaving the same node keep the order in which they were read
+    TraceSpan edgeSpan("build.edges");
+    uint32_t numNodes = num_nodes();
+    vector<uint32_t> edgeSources(edges.size());
+    m_edgeOffsetStorage.assign(numNodes + 1, 0);
+    for (size_t i = 0; i < edges.size(); i++)
+    {
+        get_node_id(edges[i].from, edgeSources[i]);
+        m_edgeOffsetStorage[edgeSources[i] + 1]++;
+    }
+    for (uint32_t i = 0; i < numNodes; i++)
+        m_edgeOffsetStorage[i + 1] += m_edgeOffsetStorage[i];
+
+    m_edgeTargetStorage.resize(edges.size());
+    m_edgeLengthStorage.resize(edges.size());
+    m_edgeStreetStorage.resize(edges.size());
+    m_edgeAngleStorage.resize(edges.size());
+    m_edgeCompassStorage.resize(edges.size());
+    vector<uint32_t> next(m_edgeOffsetStorage.begin(), m_edgeOffsetStorage.end() - 1);
     
-    // Get the street name the street segment is a part of
-    string street;
-    while (getline(inf, street))    // read until the end of the file is reached
+    // Every edge's ends are laid out by slot, as columns of coordinates, so its length and
+    // direction are worked out in batches rather than one trig call at a time
+    vector<double> fromLat(edges.size()), fromLon(edges.size()), toLat(edges.size()), toLon(edges.size());
+    for (size_t i = 0; i < edges.size(); i++)
     {
-        // Get the starting and ending GeoPoints of the street segment
-        string startLat;
-        string startLong;
-        string endLat;
-        string endLong;
-        inf >> startLat >> startLong >> endLat >> endLong;
-        
-        GeoPoint start(startLat, startLong);
-        GeoPoint end(endLat, endLong);
-        
-        // from start GeoPoint to end GeoPoint is a street name
-        m_streetMap.insert(start.to_string() + end.to_string(), street);
-        
-        // from end GeoPoint to start GeoPoint is a street name
-        m_streetMap.insert(end.to_string() + start.to_string(), street);
-        
-        // start GeoPoint is connected to end GeoPoint
-        m_connectionsMap[start.to_string()].push_back(end);
-        
-        // end GeoPoint is connected to start GeoPoint
-        m_connectionsMap[end.to_string()].push_back(start);
-        
-        // Get the number of points of interest
-        int numPoI;
-        inf >> numPoI;
-        
-        GeoPoint mid = midpoint(start, end);
-        
-        // Create midpoint connections
-        if (numPoI >= 1)
-        {
-            // from start GeoPoint to mid GeoPoint is a street name
-            m_streetMap.insert(start.to_string() + mid.to_string(), street);
-            
-            // from mid GeoPoint to start GeoPoint is a street name
-            m_streetMap.insert(mid.to_string() + start.to_string(), street);
-            
-            // from mid GeoPoint to end GeoPoint ia a street name
-            m_streetMap.insert(mid.to_string() + end.to_string(), street);
-            
-            // from end GeoPoint to mid GeoPoint is a street name
-            m_streetMap.insert(end.to_string() + mid.to_string(), street);
-            
-            // start GeoPoint is connected to mid GeoPoint
-            m_connectionsMap[start.to_string()].push_back(mid);
-            
-            // mid GeoPoint is connected to start GeoPoint
-            m_connectionsMap[mid.to_string()].push_back(start);
-            
-            // mid GeoPoint is connected to end GeoPoint
-            m_connectionsMap[mid.to_string()].push_back(end);
-            
-            // end GeoPoint is connected to mid GeoPoint
-            m_connectionsMap[end.to_string()].push_back(mid);
-        }
+        uint32_t slot = next[edgeSources[i]]++;
+        get_node_id(edges[i].to, m_edgeTargetStorage[slot]);
+        m_edgeStreetStorage[slot] = edges[i].street;
+        if ( ! parsed.lengths.empty())
+            m_edgeLengthStorage[slot] = parsed.lengths[i];
+        fromLat[slot] = edges[i].from.latitude();
+        fromLon[slot] = edges[i].from.longitude();
+        toLat[slot] = edges[i].to.latitude();
+        toLon[slot] = edges[i].to.longitude();
+    }
+    if (parsed.lengths.empty())
+        batch_distance_miles(fromLat.data(), fromLon.data(), toLat.data(), toLon.data(), edges.size(), m_edgeLengthStorage.data());
+    batch_bearings(fromLat.data(), fromLon.data(), toLat.data(), toLon.data(), edges.size(), m_edgeAngleStorage.data());
+    for (size_t e = 0; e < edges.size(); e++)
+    {
+        // the degrees angle_of_line would give
+        double degrees = m_edgeAngleStorage[e] * 180 / pi;
+        m_edgeCompassStorage[e] = compass_sector(degrees < 0 ? degrees + 360 : degrees);
+    }
 
-        // Next step is to read in an entire line with getline, so ignore any newline characters
-        inf.ignore(10000, '\n');
-        
-        for (int i = 0; i < numPoI; i++)
+    edgeSpan.end();
+
+    // Street names are interned: every distinct name is stored once, back to back, and the
+    // edges hold its ID in place of the index of the segment they were read from
+    // "a path" keeps ID 0, since it's read first
+    TraceSpan streetSpan("build.streets");
+    vector<uint32_t> streetIds(parsed.streets.size());
+    HashMap<uint32_t> internedIds;
+    internedIds.reserve(static_cast<int>(parsed.streets.size()));
+    m_streetOffsetStorage.push_back(0);
+    for (size_t i = 0; i < parsed.streets.size(); i++)
+    {
+        string_view name = parsed.streets[i];
+        size_t hash = internedIds.hash_key(name);
+        const uint32_t* id = internedIds.find(name, hash);
+        if (id != nullptr)
         {
-            // Get the point of interest name and location input line
-            string poiLine;
-            getline(inf, poiLine);
-            istringstream iss(poiLine);
-            
-            // Get the point of interest name
-            char c;
-            string poiName;
-            for (;;)
-            {
-                iss.get(c);
-                if (c == '|')
-                    break;
-                poiName += c;
-            }
-            
-            // Get the point of interest location
-            string poiLat;
-            string poiLong;
-            iss >> poiLat >> poiLong;
-            
-            GeoPoint poi(poiLat, poiLong);
-            
-            // Associate a point of interest name to a point of interest GeoPoint
-            m_poiMap.insert(poiName, poi);
-            
-            // from mid GeoPoint to poi GeoPoint is "a path"
-            m_streetMap.insert(mid.to_string() + poi.to_string(), "a path");
-            
-            // from poi GeoPoint to mid GeoPoint is "a path"
-            m_streetMap.insert(poi.to_string() + mid.to_string(), "a path");
-            
-            // mid GeoPoint is connected to poi GeoPoint
-            m_connectionsMap[mid.to_string()].push_back(poi);
-            
-            // poi GeoPoint is connected to mid GeoPoint
-            m_connectionsMap[poi.to_string()].push_back(mid);
+            streetIds[i] = *id;
+            continue;
         }
+
+        // a new name
+        streetIds[i] = static_cast<uint32_t>(internedIds.size());
+        internedIds.insert(name, hash, streetIds[i]);
+        m_streetCharStorage.insert(m_streetCharStorage.end(), name.begin(), name.end());
+        m_streetOffsetStorage.push_back(static_cast<uint32_t>(m_streetCharStorage.size()));
     }
-    
-    return true;
+    for (auto& street : m_edgeStreetStorage)
+        street = streetIds[street];
+
+    streetSpan.end();
+
+    // Points of interest sorted by name; a name read more than once keeps its last location
+    TraceSpan poiSpan("build.pois");
+    vector<pair<string_view, GeoCoord>> pois(parsed.pois);
+    stable_sort(pois.begin(), pois.end(), [](const auto& lhs, const auto& rhs) { return lhs.first < rhs.first; });
+    for (size_t i = 0; i < pois.size(); i++)
+    {
+        if (i + 1 < pois.size() && pois[i + 1].first == pois[i].first)
+            continue;   // overridden by a later entry
+
+        PoiRecord record;
+        record.nameOffset = static_cast<uint32_t>(m_poiCharStorage.size());
+        record.nameLength = static_cast<uint32_t>(pois[i].first.size());
+        get_node_id(pois[i].second, record.node);
+        m_poiCharStorage.insert(m_poiCharStorage.end(), pois[i].first.begin(), pois[i].first.end());
+        m_poiStorage.push_back(record);
+    }
+
+    use_storage();
 }
 
 bool GeoDatabase::get_poi_location(const std::string& poi, GeoPoint& point) const
 {
-    auto geoPointer = m_poiMap.find(poi);
-    
-    if (geoPointer == nullptr)  // poi not found
-        return false;
-    
-    point = *geoPointer;    // poi found
+    // binary search for the name in the sorted point of interest table
+    auto it = lower_bound(m_pois.begin(), m_pois.end(), poi, [this](const PoiRecord& record, const std::string& name) {
+        return name.compare(0, name.size(), m_poiChars.data() + record.nameOffset, record.nameLength) > 0;
+    });
+
+    if (it == m_pois.end() || poi.compare(0, poi.size(), m_poiChars.data() + it->nameOffset, it->nameLength) != 0)
+        return false;   // poi not found
+
+    point = get_node_point(it->node);   // poi found
     return true;
 }
 
 std::vector<GeoPoint> GeoDatabase::get_connected_points(const GeoPoint& pt) const
 {
-    auto connectionsPointer = m_connectionsMap.find(pt.to_string());
-    
+    count_search_stat(&SearchStats::neighborFetches);
     vector<GeoPoint> connections;
-    
-    if (connectionsPointer == nullptr)  // GeoPoint not found
+
+    uint32_t id;
+    if ( ! get_node_id(pt, id))   // GeoPoint not found
         return connections; // return empty vector
-    
-    for (const auto& geoPoint : *connectionsPointer)    // GeoPoint found
-        connections.push_back(geoPoint);
-    
+
+    connections.reserve(edges_end(id) - edges_begin(id));
+    for (uint32_t e = edges_begin(id); e < edges_end(id); e++)   // GeoPoint found
+        connections.push_back(get_node_point(m_edgeTargets[e]));
+
     return connections;
 }
 
 std::string GeoDatabase::get_street_name(const GeoPoint& pt1, const GeoPoint& pt2) const
 {
-    auto streetPointer = m_streetMap.find(pt1.to_string() + pt2.to_string());
-    
-    if (streetPointer == nullptr)   //  street not found
-        return "";
+    count_search_stat(&SearchStats::streetLookups);
+    uint32_t from;
+    uint32_t to;
+    if ( ! get_node_id(pt1, from) || ! get_node_id(pt2, to))
+        return "";  // street not found
+
+    uint32_t street = get_street_id(from, to);
+    if (street == NO_STREET)
+        return "";  // street not found
+
+    return string(street_name(street));     // street found
+}
+
+uint32_t GeoDatabase::get_street_id(uint32_t from, uint32_t to) const
+{
+    // if the same two nodes are connected more than once, the connection read last names the street
+    uint32_t edge = find_edge(from, to);
+    return (edge == NO_EDGE) ? NO_STREET : m_edgeStreets[edge];
+}
+
+uint32_t GeoDatabase::find_edge(uint32_t from, uint32_t to) const
+{
+    for (uint32_t e = edges_end(from); e > edges_begin(from); e--)
+        if (m_edgeTargets[e - 1] == to)
+            return e - 1;
+
+    return NO_EDGE;
+}
+
+uint8_t compass_sector(double angle)
+{
+    // the sectors' lower bounds, from northeast on; below 22.5 or from 337.5 on is east
+    static const double bounds[7] = {22.5, 67.5, 112.5, 157.5, 202.5, 247.5, 292.5};
+    if (angle >= 337.5)
+        return 0;
+    uint8_t sector = 0;
+    while (sector < 7 && angle >= bounds[sector])
+        sector++;
+    return sector;
+}
+
+bool GeoDatabase::get_node_id(const GeoPoint& pt, uint32_t& id) const
+{
+    count_search_stat(&SearchStats::nodeLookups);
+    GeoCoord coord;
+    return to_geocoord(pt, coord) && get_node_id(coord, id);
+}
+
+bool GeoDatabase::get_node_id(const GeoCoord& coord, uint32_t& id) const
+{
+    // a tiled map's nodes are only sorted within each tile
+    const GeoCoord* first = m_nodes.begin();
+    const GeoCoord* last = m_nodes.end();
+    if (is_tiled())
+    {
+        uint32_t tile;
+        if ( ! find_tile(tile_index(coord.lat, m_tileSize), tile_index(coord.lon, m_tileSize), tile))
+            return false;   // no nodes in that tile
+        
+        first = m_nodes.begin() + m_tiles[tile].firstNode;
+        last = m_nodes.begin() + m_tiles[tile].endNode;
+        if (m_pager)
+            m_pager->load(tile);
+    }
     
-    return *streetPointer;  // street found
+    auto it = lower_bound(first, last, coord);
+
+    if (it == last || *it != coord)    // node not found
+        return false;
+
+    id = static_cast<uint32_t>(it - m_nodes.begin());   // node found
+    return true;
+}
+
+std::string_view GeoDatabase::street_name(uint32_t street) const
+{
+    return string_view(m_streetChars.data() + m_streetOffsets[street], m_streetOffsets[street + 1] - m_streetOffsets[street]);
+}
+
+void GeoDatabase::clear()
+{
+    m_pager.reset();    // before the file it reads from is unmapped
+    m_file.close();
+    m_tileSize = 0;
+    m_nodeStorage.clear();
+    m_edgeOffsetStorage.clear();
+    m_edgeTargetStorage.clear();
+    m_edgeLengthStorage.clear();
+    m_edgeStreetStorage.clear();
+    m_edgeAngleStorage.clear();
+    m_edgeCompassStorage.clear();
+    m_streetOffsetStorage.clear();
+    m_streetCharStorage.clear();
+    m_poiStorage.clear();
+    m_poiCharStorage.clear();
+    m_tileStorage.clear();
+    use_storage();
+}
+
+// Point every table's view at its storage vector
+void GeoDatabase::use_storage()
+{
+    m_nodes = m_nodeStorage;
+    m_edgeOffsets = m_edgeOffsetStorage;
+    m_edgeTargets = m_edgeTargetStorage;
+    m_edgeLengths = m_edgeLengthStorage;
+    m_edgeStreets = m_edgeStreetStorage;
+    m_edgeAngles = m_edgeAngleStorage;
+    m_edgeCompass = m_edgeCompassStorage;
+    m_streetOffsets = m_streetOffsetStorage;
+    m_streetChars = m_streetCharStorage;
+    m_pois = m_poiStorage;
+    m_poiChars = m_poiCharStorage;
+    m_tiles = m_tileStorage;
 }
@@ -0,0 +1,130 @@
+#include "heuristic.h"
+#include "geodb.h"
+#include "geotools.h"
+#include "search_context.h"
+#include <vector>
+#include <limits>
+#include <algorithm>
+#include <cmath>
+using namespace std;
+
+// Earth's radius in miles, matching distance_earth_miles
+const double earthRadiusMiles = earthRadiusKm * 0.621371;
+
+// Shrinks estimates by a hair so rounding error can never make them exceed an edge's length
+const double ROUNDING_MARGIN = 1 - 1e-9;
+
+GreatCircleHeuristic::GreatCircleHeuristic(const GeoDatabase& geodb) : m_geodb(geodb)
+{
+    if (geodb.is_tiled())
+        return;     // positions are worked out as they're needed, rather than reading in every tile now
+    
+    m_positions.resize(geodb.num_nodes());
+    for (uint32_t n = 0; n < geodb.num_nodes(); n++)
+        m_positions[n] = position(n);
+}
+
+GreatCircleHeuristic::UnitVector GreatCircleHeuristic::position(uint32_t node) const
+{
+    m_geodb.touch_node(node);
+    double lat = deg2rad(m_geodb.get_node_coord(node).latitude());
+    double lon = deg2rad(m_geodb.get_node_coord(node).longitude());
+    return UnitVector{cos(lat) * cos(lon), cos(lat) * sin(lon), sin(lat)};
+}
+
+double GreatCircleHeuristic::estimate(uint32_t node, uint32_t target) const
+{
+    UnitVector p = m_positions.empty() ? position(node) : m_positions[node];
+    UnitVector q = m_positions.empty() ? position(target) : m_positions[target];
+    double dx = p.x - q.x;
+    double dy = p.y - q.y;
+    double dz = p.z - q.z;
+    return sqrt(dx * dx + dy * dy + dz * dz) * earthRadiusMiles * ROUNDING_MARGIN;
+}
+
+// Runs Dijkstra's algorithm from source over the whole graph, writing every node's distance
+static void distancesFrom(const GeoDatabase& geodb, uint32_t source, SearchContext& context, double* distances)
+{
+    context.reset(geodb.num_nodes());
+    context.relax(source, 0, NO_NODE, 0);
+    
+    while ( ! context.open_empty())
+    {
+        uint32_t current = context.pop_min();
+        geodb.touch_node(current);
+        double currentDistance = context.g_score(current);
+        for (uint32_t e = geodb.edges_begin(current); e < geodb.edges_end(current); e++)
+        {
+            uint32_t neighbor = geodb.edge_target(e);
+            double distance = currentDistance + geodb.edge_length(e);
+            if (distance < context.g_score(neighbor))
+                context.relax(neighbor, distance, current, distance);
+        }
+    }
+    
+    for (uint32_t n = 0; n < geodb.num_nodes(); n++)
+        distances[n] = context.g_score(n);   // infinity if never reached
+}
+
+LandmarkHeuristic::LandmarkHeuristic(const GeoDatabase& geodb, int num_landmarks)
+ : m_greatCircle(geodb), m_numNodes(geodb.num_nodes())
+{
+    if (m_numNodes == 0 || num_landmarks <= 0)
+        return;
+    
+    SearchContext context;
+    vector<double> fromStart(m_numNodes);
+    
+    // minDistance[n] is the distance from node n to the nearest landmark chosen so far
+    vector<double> minDistance(m_numNodes, numeric_limits<double>::infinity());
+    
+    // Farthest point selection: the first landmark is the node farthest from an arbitrary node,
+    // and each next landmark is the node farthest from all landmarks chosen so far
+    distancesFrom(geodb, 0, context, fromStart.data());
+    
+    for (int i = 0; i < num_landmarks; i++)
+    {
+        uint32_t landmark = NO_NODE;
+        double farthest = -1;
+        for (uint32_t n = 0; n < m_numNodes; n++)
+        {
+            double distance = (i == 0) ? fromStart[n] : minDistance[n];
+            if (distance != numeric_limits<double>::infinity() && distance > farthest)
+            {
+                farthest = distance;
+                landmark = n;
+            }
+        }
+        
+        if (landmark == NO_NODE || farthest == 0)
+            break;  // every node reachable from the first landmark is a landmark already
+        
+        m_landmarks.push_back(landmark);
+        m_distances.resize(m_landmarks.size() * m_numNodes);
+        double* distances = &m_distances[(m_landmarks.size() - 1) * m_numNodes];
+        distancesFrom(geodb, landmark, context, distances);
+        
+        for (uint32_t n = 0; n < m_numNodes; n++)
+            minDistance[n] = min(minDistance[n], distances[n]);
+    }
+}
+
+double LandmarkHeuristic::estimate(uint32_t node, uint32_t target) const
+{
+    double best = m_greatCircle.estimate(node, target);
+    
+    for (size_t i = 0; i < m_landmarks.size(); i++)
+    {
+        const double* distances = &m_distances[i * m_numNodes];
+        double toNode = distances[node];
+        double toTarget = distances[target];
+        
+        // a landmark that can't reach both nodes says nothing about them
+        if (toNode == numeric_limits<double>::infinity() || toTarget == numeric_limits<double>::infinity())
+            continue;
+        
+        best = max(best, abs(toTarget - toNode) * ROUNDING_MARGIN);
+    }
+    
+    return best;
+}
@@ -0,0 +1,316 @@
+#include "json.h"
+#include <string>
+#include <string_view>
+#include <charconv>
+#include <cstdint>
+using namespace std;
+
+// Parses JSON text by recursive descent, from the front of the remaining text
+class JsonParser
+{
+public:
+    JsonParser(string_view text) : m_text(text), m_pos(0) {}
+    
+    bool parse(JsonValue& value, int depth = 0)
+    {
+        if (depth > MAX_DEPTH)
+            return false;
+        
+        skip_whitespace();
+        if (m_pos >= m_text.size())
+            return false;
+        
+        char c = m_text[m_pos];
+        if (c == '{')
+            return parse_object(value, depth);
+        if (c == '[')
+            return parse_array(value, depth);
+        if (c == '"')
+        {
+            value.type = JsonValue::STRING;
+            return parse_string(value.text);
+        }
+        if (c == '-' || (c >= '0' && c <= '9'))
+            return parse_number(value);
+        if (literal("true"))
+        {
+            value.type = JsonValue::BOOLEAN;
+            value.boolean = true;
+            return true;
+        }
+        if (literal("false"))
+        {
+            value.type = JsonValue::BOOLEAN;
+            value.boolean = false;
+            return true;
+        }
+        if (literal("null"))
+        {
+            value.type = JsonValue::NUL;
+            return true;
+        }
+        return false;
+    }
+    
+    // test if only whitespace is left
+    bool at_end()
+    {
+        skip_whitespace();
+        return m_pos == m_text.size();
+    }
+private:
+    static const int MAX_DEPTH = 64;    // so hostile input can't overflow the stack
+    
+    string_view m_text;
+    size_t m_pos;
+    
+    void skip_whitespace()
+    {
+        while (m_pos < m_text.size() && (m_text[m_pos] == ' ' || m_text[m_pos] == '\t' || m_text[m_pos] == '\r' || m_text[m_pos] == '\n'))
+            m_pos++;
+    }
+    
+    // Consumes c, after any whitespace, if it's next
+    bool consume(char c)
+    {
+        skip_whitespace();
+        if (m_pos < m_text.size() && m_text[m_pos] == c)
+        {
+            m_pos++;
+            return true;
+        }
+        return false;
+    }
+    
+    bool literal(string_view word)
+    {
+        if (m_text.substr(m_pos, word.size()) != word)
+            return false;
+        m_pos += word.size();
+        return true;
+    }
+    
+    bool parse_object(JsonValue& value, int depth)
+    {
+        value.type = JsonValue::OBJECT;
+        m_pos++;    // {
+        if (consume('}'))
+            return true;
+        
+        do
+        {
+            skip_whitespace();
+            string name;
+            if (m_pos >= m_text.size() || m_text[m_pos] != '"' || ! parse_string(name) || ! consume(':'))
+                return false;
+            
+            value.members.emplace_back(move(name), JsonValue());
+            if ( ! parse(value.members.back().second, depth + 1))
+                return false;
+        } while (consume(','));
+        
+        return consume('}');
+    }
+    
+    bool parse_array(JsonValue& value, int depth)
+    {
+        value.type = JsonValue::ARRAY;
+        m_pos++;    // [
+        if (consume(']'))
+            return true;
+        
+        do
+        {
+            value.items.emplace_back();
+            if ( ! parse(value.items.back(), depth + 1))
+                return false;
+        } while (consume(','));
+        
+        return consume(']');
+    }
+    
+    bool parse_number(JsonValue& value)
+    {
+        size_t start = m_pos;
+        if (m_text[m_pos] == '-')
+            m_pos++;
+        while (m_pos < m_text.size() && string_view("0123456789.eE+-").find(m_text[m_pos]) != string_view::npos)
+            m_pos++;
+        
+        value.type = JsonValue::NUMBER;
+        value.text = string(m_text.substr(start, m_pos - start));
+        auto result = from_chars(m_text.data() + start, m_text.data() + m_pos, value.number);
+        return result.ec == errc() && result.ptr == m_text.data() + m_pos;
+    }
+    
+    // Reads 4 hex digits of a \u escape
+    bool parse_hex(uint32_t& code)
+    {
+        if (m_text.size() - m_pos < 4)
+            return false;
+        auto result = from_chars(m_text.data() + m_pos, m_text.data() + m_pos + 4, code, 16);
+        if (result.ec != errc() || result.ptr != m_text.data() + m_pos + 4)
+            return false;
+        m_pos += 4;
+        return true;
+    }
+    
+    bool parse_string(string& out)
+    {
+        m_pos++;    // opening quote
+        while (m_pos < m_text.size())
+        {
+            char c = m_text[m_pos++];
+            if (c == '"')
+                return true;
+            if (static_cast<unsigned char>(c) < 0x20)
+                return false;   // control characters must be escaped
+            if (c != '\\')
+            {
+                out += c;
+                continue;
+            }
+            
+            if (m_pos >= m_text.size())
+                return false;
+            switch (m_text[m_pos++])
+            {
+                case '"': out += '"'; break;
+                case '\\': out += '\\'; break;
+                case '/': out += '/'; break;
+                case 'b': out += '\b'; break;
+                case 'f': out += '\f'; break;
+                case 'n': out += '\n'; break;
+                case 'r': out += '\r'; break;
+                case 't': out += '\t'; break;
+                case 'u':
+                {
+                    uint32_t code;
+                    if ( ! parse_hex(code))
+                        return false;
+                    // a surrogate pair encodes one character outside the basic plane
+                    if (code >= 0xD800 && code < 0xDC00 && m_text.substr(m_pos, 2) == "\\u")
+                    {
+                        m_pos += 2;
+                        uint32_t low;
+                        if ( ! parse_hex(low) || low < 0xDC00 || low >= 0xE000)
+                            return false;
+                        code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                    }
+                    append_utf8(out, code);
+                    break;
+                }
+                default:
+                    return false;
+            }
+        }
+        return false;   // unterminated
+    }
+    
+    static void append_utf8(string& out, uint32_t code)
+    {
+        if (code < 0x80)
+            out += static_cast<char>(code);
+        else if (code < 0x800)
+        {
+            out += static_cast<char>(0xC0 | (code >> 6));
+            out += static_cast<char>(0x80 | (code & 0x3F));
+        }
+        else if (code < 0x10000)
+        {
+            out += static_cast<char>(0xE0 | (code >> 12));
+            out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+            out += static_cast<char>(0x80 | (code & 0x3F));
+        }
+        else
+        {
+            out += static_cast<char>(0xF0 | (code >> 18));
+            out += static_cast<char>(0x80 | ((code >> 12) & 0x3F));
+            out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+            out += static_cast<char>(0x80 | (code & 0x3F));
+        }
+    }
+};
+
+const JsonValue* JsonValue::find(std::string_view name) const
+{
+    for (const auto& member : members)
+        if (member.first == name)
+            return &member.second;
+    return nullptr;
+}
+
+bool parse_json(std::string_view text, JsonValue& value)
+{
+    value = JsonValue();
+    JsonParser parser(text);
+    return parser.parse(value) && parser.at_end();
+}
+
+void write_json(std::string& out, const JsonValue& value)
+{
+    switch (value.type)
+    {
+        case JsonValue::NUL:
+            out += "null";
+            break;
+        case JsonValue::BOOLEAN:
+            out += value.boolean ? "true" : "false";
+            break;
+        case JsonValue::NUMBER:
+            out += value.text;
+            break;
+        case JsonValue::STRING:
+            write_json_string(out, value.text);
+            break;
+        case JsonValue::ARRAY:
+            out += '[';
+            for (size_t i = 0; i < value.items.size(); i++)
+            {
+                if (i > 0)
+                    out += ',';
+                write_json(out, value.items[i]);
+            }
+            out += ']';
+            break;
+        case JsonValue::OBJECT:
+            out += '{';
+            for (size_t i = 0; i < value.members.size(); i++)
+            {
+                if (i > 0)
+                    out += ',';
+                write_json_string(out, value.members[i].first);
+                out += ':';
+                write_json(out, value.members[i].second);
+            }
+            out += '}';
+            break;
+    }
+}
+
+void write_json_string(std::string& out, std::string_view text)
+{
+    out += '"';
+    for (char c : text)
+    {
+        switch (c)
+        {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20)
+                {
+                    const char* hex = "0123456789abcdef";
+                    out += "\\u00";
+                    out += hex[c >> 4];
+                    out += hex[c & 0xF];
+                }
+                else
+                    out += c;
+        }
+    }
+    out += '"';
+}
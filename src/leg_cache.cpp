@@ -0,0 +1,263 @@
+#include "leg_cache.h"
+#include "base_classes.h"
+#include "geopoint.h"
+#include "geocoord.h"
+#include "geo_batch.h"
+#include "map_snapshot.h"
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iterator>
+#include <cstring>
+using namespace std;
+
+// On-disk layout of a saved cache: a LegCacheHeader, then for every leg a LegKey,
+// its distance, its number of points and its points as GeoCoords, then its number of edges and its edges
+const char LEG_CACHE_MAGIC[8] = {'B', 'T', 'O', 'U', 'R', 'L', 'E', 'G'};
+const uint32_t LEG_CACHE_VERSION = 2;
+
+struct LegCacheHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint64_t mapFingerprint;
+    uint64_t checksum;      // of every byte after the header
+    uint64_t numLegs;
+};
+
+LegCache::LegCache(const RouterBase& router, const GeoDatabase& geodb, std::size_t capacity)
+ : m_router(router), m_geodb(geodb), m_edgeRouter(dynamic_cast<const EdgeRouter*>(&router)),
+   m_shardCapacity(max<size_t>(1, (capacity + NUM_SHARDS - 1) / NUM_SHARDS)), m_hits(0), m_misses(0) {}
+
+LegCache::~LegCache() {}
+
+std::vector<GeoPoint> LegCache::route(const GeoPoint& pt1, const GeoPoint& pt2) const
+{
+    return leg(pt1, pt2)->path;
+}
+
+std::vector<GeoPoint> LegCache::route(const GeoPoint& pt1, const GeoPoint& pt2, std::vector<uint32_t>& edges) const
+{
+    shared_ptr<const CachedLeg> found = leg(pt1, pt2);
+    edges = found->edges;
+    return found->path;
+}
+
+std::shared_ptr<const CachedLeg> LegCache::leg(const GeoPoint& pt1, const GeoPoint& pt2) const
+{
+    GeoCoord from;
+    GeoCoord to;
+    bool cacheable = to_geocoord(pt1, from) && to_geocoord(pt2, to);
+    LegKey key{from.key(), to.key()};
+    
+    shared_ptr<const CachedLeg> found;
+    if (cacheable)
+    {
+        Shard& s = shard(key);
+        lock_guard<mutex> guard(s.lock);
+        auto it = s.index.find(key);
+        if (it != s.index.end())
+        {
+            // leg found, so it becomes the most recently used
+            s.legs.splice(s.legs.begin(), s.legs, it->second);
+            found = it->second->second;
+        }
+    }
+    
+    if (found != nullptr)
+    {
+        // the router would have read in the leg's tiles, so a hit reads them in too
+        m_hits++;
+        touch(*found);
+        return found;
+    }
+    
+    // leg not found, so route it without holding the lock
+    m_misses++;
+    auto leg = make_shared<CachedLeg>();
+    leg->path = (m_edgeRouter != nullptr) ? m_edgeRouter->route(pt1, pt2, leg->edges) : m_router.route(pt1, pt2);
+    leg->distance = path_length_miles(leg->path);
+    
+    if (cacheable)
+        insert(key, leg);
+    return leg;
+}
+
+// Adds a leg as the most recently used one, dropping the least recently used leg if the shard is full
+// If another thread cached the same leg meanwhile, it's replaced
+void LegCache::insert(const LegKey& key, std::shared_ptr<const CachedLeg> leg) const
+{
+    Shard& s = shard(key);
+    lock_guard<mutex> guard(s.lock);
+    
+    auto it = s.index.find(key);
+    if (it != s.index.end())
+    {
+        s.legs.erase(it->second);
+        s.index.erase(it);
+    }
+    
+    s.legs.emplace_front(key, move(leg));
+    s.index[key] = s.legs.begin();
+    
+    if (s.legs.size() > m_shardCapacity)
+    {
+        s.index.erase(s.legs.back().first);
+        s.legs.pop_back();
+    }
+}
+
+// Marks the nodes along a leg as used, as routing it would have
+void LegCache::touch(const CachedLeg& leg) const
+{
+    uint32_t node;
+    if ( ! leg.path.empty() && m_geodb.get_node_id(leg.path.front(), node))
+        m_geodb.touch_node(node);
+    if (leg.edges.empty())
+    {
+        // the router doesn't give its edges, so find the nodes from the path's points
+        for (const GeoPoint& pt : leg.path)
+            if (m_geodb.get_node_id(pt, node))
+                m_geodb.touch_node(node);
+        return;
+    }
+    for (uint32_t edge : leg.edges)
+        m_geodb.touch_node(m_geodb.edge_target(edge));
+}
+
+std::size_t LegCache::size() const
+{
+    size_t total = 0;
+    for (Shard& s : m_shards)
+    {
+        lock_guard<mutex> guard(s.lock);
+        total += s.legs.size();
+    }
+    return total;
+}
+
+// Appends a value's bytes to a file being built in memory
+template <typename T>
+static void appendValue(vector<char>& file, const T& value)
+{
+    const char* bytes = reinterpret_cast<const char*>(&value);
+    file.insert(file.end(), bytes, bytes + sizeof(T));
+}
+
+// Reads a value's bytes from the front of a file's remaining bytes
+// returns false if there aren't enough left
+template <typename T>
+static bool readValue(const char*& pos, const char* end, T& value)
+{
+    if (static_cast<size_t>(end - pos) < sizeof(T))
+        return false;
+    memcpy(&value, pos, sizeof(T));
+    pos += sizeof(T);
+    return true;
+}
+
+bool LegCache::save(const std::string& cache_file, uint64_t map_fingerprint) const
+{
+    LegCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, LEG_CACHE_MAGIC, sizeof(LEG_CACHE_MAGIC));
+    header.version = LEG_CACHE_VERSION;
+    header.byteOrder = SNAPSHOT_BYTE_ORDER;
+    header.mapFingerprint = map_fingerprint;
+    
+    // build the whole file in memory, leaving room for the header
+    // each shard's legs are written from least to most recently used, so loading them keeps their order
+    vector<char> file(sizeof(header), 0);
+    for (Shard& s : m_shards)
+    {
+        lock_guard<mutex> guard(s.lock);
+        for (auto it = s.legs.rbegin(); it != s.legs.rend(); it++)
+        {
+            const CachedLeg& leg = *it->second;
+            appendValue(file, it->first);
+            appendValue(file, leg.distance);
+            appendValue(file, static_cast<uint64_t>(leg.path.size()));
+            for (const GeoPoint& pt : leg.path)
+            {
+                GeoCoord coord;
+                to_geocoord(pt, coord);
+                appendValue(file, coord);
+            }
+            appendValue(file, static_cast<uint64_t>(leg.edges.size()));
+            for (uint32_t edge : leg.edges)
+                appendValue(file, edge);
+            header.numLegs++;
+        }
+    }
+    
+    header.checksum = snapshot_checksum(file.data() + sizeof(header), file.size() - sizeof(header));
+    memcpy(file.data(), &header, sizeof(header));
+    
+    ofstream outf(cache_file, ios::binary | ios::trunc);
+    if ( ! outf)    // file can't be created
+        return false;
+    
+    outf.write(file.data(), file.size());
+    return static_cast<bool>(outf);
+}
+
+bool LegCache::load(const std::string& cache_file, uint64_t map_fingerprint)
+{
+    ifstream inf(cache_file, ios::binary);
+    if ( ! inf) // file not found
+        return false;
+    vector<char> file((istreambuf_iterator<char>(inf)), istreambuf_iterator<char>());
+    
+    LegCacheHeader header;
+    if (file.size() < sizeof(header))
+        return false;   // truncated header
+    memcpy(&header, file.data(), sizeof(header));
+    
+    if (memcmp(header.magic, LEG_CACHE_MAGIC, sizeof(LEG_CACHE_MAGIC)) != 0 || header.version != LEG_CACHE_VERSION ||
+        header.byteOrder != SNAPSHOT_BYTE_ORDER || header.mapFingerprint != map_fingerprint)
+        return false;   // not a cache, or written by a different version or machine, or for a different map
+    
+    if (header.checksum != snapshot_checksum(file.data() + sizeof(header), file.size() - sizeof(header)))
+        return false;   // corrupted
+    
+    // read every leg before adding any, so a malformed file adds nothing
+    vector<pair<LegKey, shared_ptr<const CachedLeg>>> legs;
+    const char* pos = file.data() + sizeof(header);
+    const char* end = file.data() + file.size();
+    for (uint64_t i = 0; i < header.numLegs; i++)
+    {
+        LegKey key;
+        auto leg = make_shared<CachedLeg>();
+        uint64_t numPoints;
+        if ( ! readValue(pos, end, key) || ! readValue(pos, end, leg->distance) || ! readValue(pos, end, numPoints) ||
+            numPoints > static_cast<uint64_t>(end - pos) / sizeof(GeoCoord))
+            return false;
+        
+        leg->path.reserve(numPoints);
+        for (uint64_t j = 0; j < numPoints; j++)
+        {
+            GeoCoord coord;
+            readValue(pos, end, coord);
+            leg->path.push_back(to_geopoint(coord));
+        }
+        
+        // the map's fingerprint covers its edge tables, so the edges are the same ones on this map,
+        // but a file that names an edge past the end of them wasn't saved for it
+        uint64_t numEdges;
+        if ( ! readValue(pos, end, numEdges) || numEdges > static_cast<uint64_t>(end - pos) / sizeof(uint32_t))
+            return false;
+        leg->edges.resize(numEdges);
+        for (uint64_t j = 0; j < numEdges; j++)
+        {
+            readValue(pos, end, leg->edges[j]);
+            if (leg->edges[j] >= m_geodb.num_edges())
+                return false;
+        }
+        legs.emplace_back(key, move(leg));
+    }
+    
+    for (auto& leg : legs)
+        insert(leg.first, move(leg.second));
+    return true;
+}
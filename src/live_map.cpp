@@ -0,0 +1,183 @@
+#include "live_map.h"
+#include "geodb.h"
+#include "map_delta.h"
+#include "trace.h"
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+using namespace std;
+
+static double elapsedMs(chrono::steady_clock::time_point start)
+{
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+MapVersion::MapVersion(std::shared_ptr<const GeoDatabase> geodb, uint64_t epoch)
+ : m_geodb(move(geodb)), m_epoch(epoch) {}
+
+MapVersion::~MapVersion() {}
+
+bool MapVersion::build(const RoutingOptions& options, PhaseTimes* phases, const MapVersion* reweighted)
+{
+    // with landmarks, the router uses ALT bounds instead of just great-circle distance
+    if (options.numLandmarks > 0)
+    {
+        auto start = chrono::steady_clock::now();
+        TraceSpan span("landmarks");
+        m_landmarks = make_unique<LandmarkHeuristic>(*m_geodb, options.numLandmarks);
+        if (phases != nullptr)
+            phases->emplace_back("landmarks", elapsedMs(start));
+    }
+
+    // with a contraction hierarchy, built now or loaded from a file, the router searches the hierarchy instead
+    if (options.useHierarchy)
+    {
+        auto start = chrono::steady_clock::now();
+        TraceSpan span("hierarchy");
+        m_hierarchy = make_unique<ContractionHierarchy>();
+        const ContractionHierarchy* order = (reweighted != nullptr) ? reweighted->m_hierarchy.get() : nullptr;
+        if (order != nullptr && order->num_nodes() == m_geodb->num_nodes())
+            m_hierarchy->build(*m_geodb, *order);
+        else if (options.hierarchyFile.empty())
+            m_hierarchy->build(*m_geodb);
+        else if ( ! m_hierarchy->load(options.hierarchyFile, *m_geodb))
+            return false;
+        if (phases != nullptr)
+            phases->emplace_back("hierarchy", elapsedMs(start));
+    }
+
+    if (options.useHierarchy)
+        m_router = make_unique<CHRouter>(*m_geodb, *m_hierarchy);
+    else if (options.bidirectional)
+        m_router = make_unique<BidirectionalRouter>(*m_geodb, m_landmarks.get());
+    else
+        m_router = make_unique<Router>(*m_geodb, m_landmarks.get());
+
+    // with a leg cache, legs routed by an earlier run are reused
+    const RouterBase* router = m_router.get();
+    if (options.legCache)
+    {
+        m_legCache = make_unique<LegCache>(*m_router, *m_geodb);
+        if ( ! options.legCacheFile.empty())
+            m_legCache->load(options.legCacheFile, m_geodb->fingerprint());  // a missing or outdated cache starts empty
+        router = m_legCache.get();
+    }
+
+    // locations that aren't points of the map, such as GPS positions, are snapped to the nearest street
+    {
+        auto start = chrono::steady_clock::now();
+        TraceSpan span("spatial index");
+        m_spatialIndex = make_unique<SpatialIndex>(*m_geodb);
+        if (phases != nullptr)
+            phases->emplace_back("spatial index", elapsedMs(start));
+    }
+    m_snappingRouter = make_unique<SnappingRouter>(*router, *m_geodb, *m_spatialIndex, options.maxSnapMiles);
+
+    m_generator = make_unique<TourGenerator>(*m_geodb, *m_snappingRouter);
+    if (options.optimizeOrder)
+        m_generator->optimize_order(options.keepLast);
+
+    if (options.poiIndex)
+        m_poiIndex = make_unique<PoiIndex>(*m_geodb);
+    return true;
+}
+
+LiveMap::LiveMap(const RoutingOptions& options)
+ : m_options(options), m_newestEpoch(0), m_builtEpoch(0), m_reweights(0), m_stopping(false) {}
+
+LiveMap::~LiveMap()
+{
+    {
+        lock_guard<mutex> guard(m_updateLock);
+        m_stopping = true;
+    }
+    m_updated.notify_one();
+    if (m_builder.joinable())
+        m_builder.join();
+}
+
+bool LiveMap::start(std::shared_ptr<const GeoDatabase> geodb, PhaseTimes* phases)
+{
+    auto version = make_shared<MapVersion>(geodb, 0);
+    if ( ! version->build(m_options, phases))
+        return false;
+
+    m_newest = move(geodb);
+    {
+        lock_guard<mutex> guard(m_lock);
+        m_current = move(version);
+    }
+    m_builder = thread(&LiveMap::build_versions, this);
+    return true;
+}
+
+std::shared_ptr<const MapVersion> LiveMap::current() const
+{
+    lock_guard<mutex> guard(m_lock);
+    return m_current;
+}
+
+bool LiveMap::update(const std::vector<MapChange>& changes, std::size_t& failed, uint64_t& epoch)
+{
+    lock_guard<mutex> updateGuard(m_updateLock);
+    auto geodb = make_shared<GeoDatabase>();
+    if ( ! geodb->load(*m_newest, changes, failed))
+        return false;
+
+    m_newest = move(geodb);
+    epoch = ++m_newestEpoch;
+    for (const MapChange& change : changes)
+        m_reweights = (change.kind == MapChange::REWEIGHT_SEGMENT && m_reweights != SIZE_MAX) ? m_reweights + 1 : SIZE_MAX;
+    m_updated.notify_one();
+    return true;
+}
+
+void LiveMap::wait_for(uint64_t epoch) const
+{
+    unique_lock<mutex> guard(m_lock);
+    m_published.wait(guard, [&] { return m_current->epoch() >= epoch; });
+}
+
+// Builds a version over the newest map whenever there's one newer than the last built, until stopped
+void LiveMap::build_versions()
+{
+    // files saved for the map as loaded don't fit an updated map, so everything is built afresh
+    RoutingOptions options = m_options;
+    options.hierarchyFile.clear();
+    options.legCacheFile.clear();
+
+    unique_lock<mutex> updateGuard(m_updateLock);
+    for (;;)
+    {
+        m_updated.wait(updateGuard, [&] { return m_stopping || m_builtEpoch < m_newestEpoch; });
+        if (m_stopping)
+            return;
+
+        shared_ptr<const GeoDatabase> geodb = m_newest;
+        uint64_t epoch = m_newestEpoch;
+        m_builtEpoch = epoch;
+        size_t reweights = m_reweights;
+        m_reweights = 0;
+        updateGuard.unlock();
+
+        // the current version is the last one built, so if only edge lengths changed since, its
+        // hierarchy's node order still fits; it stays a good order with a few segments reweighted,
+        // but contracting in it gets slower than ordering afresh as more are
+        bool sameOrder = reweights <= geodb->num_nodes() / 100;
+        shared_ptr<const MapVersion> base = current();
+        auto version = make_shared<MapVersion>(move(geodb), epoch);
+        version->build(options, nullptr, sameOrder ? base.get() : nullptr);
+        base.reset();
+        {
+            lock_guard<mutex> guard(m_lock);
+            m_current = move(version);
+        }
+        m_published.notify_all();
+
+        updateGuard.lock();
+    }
+}
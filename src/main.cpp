@@ -1,14 +1,26 @@
+#include <chrono>
 #include <cstdio>
+#include <cstdlib>
 #include <iomanip>
 #include <iostream>
 #include <map>
+#include <memory>
+#include <string>
+#include <string_view>
 #include <vector>
 
+#include "geocoord.h"
 #include "geodb.h"
-#include "router.h"
+#include "json.h"
+#include "leg_cache.h"
+#include "live_map.h"
+#include "map_delta.h"
+#include "search_stats.h"
 #include "stops.h"
 #include "tourcmd.h"
+#include "trace.h"
 #include "tour_generator.h"
+#include "tour_server.h"
 
 using namespace std;
 
@@ -53,36 +65,315 @@ void print_tour(vector<TourCommand>& tcs)
     cout << "Total tour distance: " << std::fixed << std::setprecision(3) << total_dist << " miles\n";
 }
 
+static double elapsedMs(chrono::steady_clock::time_point start)
+{
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+// Reports where the time and search work went, for --stats
+void print_stats(ostream& out, bool json, const PhaseTimes& phases, const TourStats* tour, const LegCache* legCache,
+                 const TileStats* tiles)
+{
+    SearchStats process = process_search_stats();
+    if (json)
+    {
+        string text = "{\"phases_ms\":{";
+        for (size_t i = 0; i < phases.size(); i++)
+        {
+            if (i > 0)
+                text += ',';
+            write_json_string(text, phases[i].first);
+            text += ':' + to_string(phases[i].second);
+        }
+        text += '}';
+        if (tour != nullptr)
+        {
+            text += ",\"tour\":{\"ms\":" + to_string(tour->micros / 1000) + ",\"order_ms\":" + to_string(tour->orderMicros / 1000) + ",\"search\":";
+            tour->search.write_json(text);
+            text += ",\"legs\":[";
+            for (size_t k = 0; k < tour->legs.size(); k++)
+            {
+                text += (k == 0) ? "{\"from\":" : ",{\"from\":";
+                write_json_string(text, tour->legs[k].from);
+                text += ",\"to\":";
+                write_json_string(text, tour->legs[k].to);
+                text += ",\"ms\":" + to_string(tour->legs[k].micros / 1000) + ",\"search\":";
+                tour->legs[k].search.write_json(text);
+                text += '}';
+            }
+            text += "]}";
+        }
+        if (legCache != nullptr)
+            text += ",\"leg_cache\":{\"hits\":" + to_string(legCache->hits()) + ",\"misses\":" + to_string(legCache->misses()) + "}";
+        if (tiles != nullptr)
+        {
+            text += ",\"tiles\":{\"tiles\":" + to_string(tiles->tiles) + ",\"resident\":" + to_string(tiles->resident) +
+                ",\"resident_bytes\":" + to_string(tiles->residentBytes) + ",\"loads\":" + to_string(tiles->loads) +
+                ",\"evictions\":" + to_string(tiles->evictions) + ",\"damaged\":" + to_string(tiles->damaged) + "}";
+        }
+        text += ",\"process\":";
+        process.write_json(text);
+        out << text << "}" << endl;
+        return;
+    }
+
+    out << std::fixed << std::setprecision(3) << "\nStats:\n";
+    for (const auto& phase : phases)
+        out << "  " << phase.first << ": " << phase.second << " ms\n";
+    if (tour != nullptr)
+    {
+        out << "  tour: " << tour->micros / 1000 << " ms, " << tour->orderMicros / 1000 << " ms of it ordering the stops\n";
+        for (const LegStats& leg : tour->legs)
+        {
+            out << "  leg " << leg.from << " -> " << leg.to << ": " << leg.micros / 1000 << " ms, "
+                << leg.search.nodesExpanded << " nodes expanded, " << leg.search.edgesScanned << " edges scanned\n";
+        }
+        out << "  tour totals:\n";
+        tour->search.print(out, "    ");
+    }
+    if (legCache != nullptr)
+        out << "  leg cache: " << legCache->hits() << " hits, " << legCache->misses() << " misses\n";
+    if (tiles != nullptr)
+    {
+        out << "  tiles: " << tiles->resident << " of " << tiles->tiles << " resident (" << tiles->residentBytes / 1048576.0 << " MB), "
+            << tiles->loads << " loads, " << tiles->evictions << " evictions, " << tiles->damaged << " damaged\n";
+    }
+    out << "  process totals:\n";
+    process.print(out, "    ");
+}
+
+// Reads a location given as "latitude,longitude", such as a GPS position
+bool parse_location(const string& text, GeoPoint& location)
+{
+    size_t comma = text.find(',');
+    GeoCoord coord;
+    if (comma == string::npos || !parse_location(string_view(text).substr(0, comma), string_view(text).substr(comma + 1), coord))
+        return false;
+    location = to_geopoint(coord);
+    return true;
+}
+
 int main(int argc, char *argv[])
 {
-    if (argc != 3)
+    // options come first, then the map and stops files
+    RoutingOptions options;
+    string legCacheFile;
+    vector<string> deltaFiles;
+    bool serve = false;
+    string socketPath;
+    bool stats = false;
+    bool statsJson = false;
+    string traceFile;
+    size_t tileCacheMB = 0;     // 0 for no cap
+    bool verifyMap = false;
+    string fromLocation;        // to start the tour from, before the first stop
+    int arg = 1;
+    for (; arg < argc && string(argv[arg]).rfind("--", 0) == 0; arg++)
+    {
+        string option = argv[arg];
+        if (option.rfind("--landmarks=", 0) == 0)
+            options.numLandmarks = atoi(option.c_str() + 12);
+        else if (option == "--bidirectional")
+            options.bidirectional = true;
+        else if (option == "--optimize-order")
+            options.optimizeOrder = true;
+        else if (option == "--keep-last")
+            options.keepLast = true;
+        else if (option.rfind("--leg-cache=", 0) == 0)
+            legCacheFile = option.substr(12);
+        else if (option == "--serve")
+            serve = true;
+        else if (option.rfind("--serve=", 0) == 0)
+        {
+            serve = true;
+            socketPath = option.substr(8);
+        }
+        else if (option == "--stats")
+            stats = true;
+        else if (option == "--stats=json")
+            stats = statsJson = true;
+        else if (option.rfind("--trace=", 0) == 0)
+            traceFile = option.substr(8);
+        else if (option.rfind("--delta=", 0) == 0)
+            deltaFiles.push_back(option.substr(8));
+        else if (option.rfind("--from=", 0) == 0)
+            fromLocation = option.substr(7);
+        else if (option.rfind("--tile-cache=", 0) == 0)
+            tileCacheMB = strtoull(option.c_str() + 13, nullptr, 10);
+        else if (option == "--verify-map")
+            verifyMap = true;
+        else if (option == "--ch")
+            options.useHierarchy = true;
+        else if (option.rfind("--ch=", 0) == 0)
+        {
+            options.useHierarchy = true;
+            options.hierarchyFile = option.substr(5);
+        }
+        else
+            break;  // unknown option
+    }
+
+    // a server takes its stops from requests instead of a stops file
+    if (argc - arg != (serve ? 1 : 2))
+    {
+        cout << "usage: BruinTour [--landmarks=K] [--bidirectional] [--ch[=mapdata.ch]] [--optimize-order [--keep-last]] [--leg-cache=legs.bin] [--stats[=json]] [--trace=trace.json] [--tile-cache=MB] [--verify-map] [--delta=changes.txt] [--from=LAT,LON] mapdata.txt stops.txt\n";
+        cout << "       BruinTour [options] --serve[=socket] mapdata.txt\n";
+        return 1;
+    }
+    const char* mapFile = argv[arg];
+    const char* stopsFile = serve ? "" : argv[arg + 1];
+
+    if (!traceFile.empty())
+        start_tracing();
+
+    PhaseTimes phases;
+    auto phaseStart = chrono::steady_clock::now();
+    auto geodb = make_shared<GeoDatabase>();
+    if (!geodb->load(mapFile))
     {
-        cout << "usage: BruinTour mapdata.txt stops.txt\n";
+        cout << "Unable to load map data: " << mapFile << endl;
         return 1;
     }
+    phases.emplace_back("load", elapsedMs(phaseStart));
+    if (verifyMap)
+    {
+        phaseStart = chrono::steady_clock::now();
+        if (!geodb->verify_snapshot())
+        {
+            cout << "Map snapshot is corrupted: " << mapFile << endl;
+            return 1;
+        }
+        phases.emplace_back("verify", elapsedMs(phaseStart));
+    }
+    geodb->set_tile_memory_cap(tileCacheMB * 1048576);  // only a tiled snapshot reads its tiles in as needed
+    shared_ptr<const GeoDatabase> loaded = geodb;       // for the tile stats, which an updated map has none of
+    TileStats tileStats;
+
+    // deltas, such as road closures, change the map before anything is built over it
+    for (const string& deltaFile : deltaFiles)
+    {
+        phaseStart = chrono::steady_clock::now();
+        vector<MapChange> changes;
+        size_t badLine;
+        if (!load_map_delta(deltaFile, changes, badLine))
+        {
+            if (badLine == 0)
+                cout << "Unable to load map delta: " << deltaFile << endl;
+            else
+                cout << "Malformed change in map delta: " << deltaFile << ", line " << badLine << endl;
+            return 1;
+        }
+
+        auto updated = make_shared<GeoDatabase>();
+        size_t failed;
+        if (!updated->load(*geodb, changes, failed))
+        {
+            cout << "No such segment or point of interest in map delta: " << deltaFile << ", line " << changes[failed].line << endl;
+            return 1;
+        }
+        geodb = updated;
+        phases.emplace_back("delta", elapsedMs(phaseStart));
+    }
 
-    GeoDatabase geodb;
-    if (!geodb.load(argv[1]))
+    // the router and the rest are built over each version of the map; only a server ever sees a second one
+    options.legCache = !legCacheFile.empty();
+    options.legCacheFile = legCacheFile;    // a missing or outdated cache starts empty
+    options.poiIndex = serve;
+    LiveMap liveMap(options);
+    if (!liveMap.start(geodb, &phases))
     {
-        cout << "Unable to load map data: " << argv[1] << endl;
+        cout << "Unable to load contraction hierarchy: " << options.hierarchyFile << endl;
         return 1;
     }
 
-    Router router(geodb);
-    TourGenerator tg(geodb, router);
+    if (serve)
+    {
+        // answer tour requests until stdin ends, or for as long as the socket accepts connections
+        TourServer server(liveMap, 0);
+        if (socketPath.empty())
+            server.serve(cin, cout);
+        else if (!server.serve_socket(socketPath))
+        {
+            cout << "Unable to listen on socket: " << socketPath << endl;
+            return 1;
+        }
+
+        // this run's legs are saved for the next, as routed on the map as it was last updated
+        shared_ptr<const MapVersion> last = liveMap.current();
+        if (!legCacheFile.empty() && !last->leg_cache()->save(legCacheFile, last->geodb().fingerprint()))
+            cout << "Unable to write leg cache: " << legCacheFile << endl;
+        tileStats = loaded->tile_stats();
+        if (stats)
+            print_stats(cerr, statsJson, phases, nullptr, last->leg_cache(), loaded->is_tiled() ? &tileStats : nullptr);
+        if (!traceFile.empty() && !write_trace(traceFile))
+            cout << "Unable to write trace: " << traceFile << endl;
+        if (tileStats.damaged > 0)
+        {
+            cout << "Map snapshot is damaged: " << tileStats.damaged << " tiles failed their checksum" << endl;
+            return 1;
+        }
+        return 0;
+    }
 
     Stops stops;
-    if (!stops.load(argv[2]))
+    if (!stops.load(stopsFile))
     {
-        cout << "Unable to load tour data: " << argv[2] << endl;
+        cout << "Unable to load tour data: " << stopsFile << endl;
         return 1;
     }
 
+    shared_ptr<const MapVersion> version = liveMap.current();
+    vector<TourStop> tourStops(stops.size());
+    for (int i = 0; i < stops.size(); i++)
+        stops.get_poi_data(i, tourStops[i].poi, tourStops[i].talking_points);
+
+    // a tour can start from anywhere, such as a GPS position, named after the street it's on
+    if (!fromLocation.empty())
+    {
+        TourStop start;
+        if (!parse_location(fromLocation, start.location))
+        {
+            cout << "Unable to read starting location: " << fromLocation << endl;
+            return 1;
+        }
+        GeoPoint snapped;
+        if (!version->router().snap(start.location, snapped))
+        {
+            cout << "Starting location is off the map, too far from any street to route: " << fromLocation << endl;
+            return 1;
+        }
+        start.at_location = true;
+        start.poi = version->spatial_index().street_at(start.location);
+        if (start.poi.empty())
+            start.poi = UNNAMED_LOCATION;
+        tourStops.insert(tourStops.begin(), start);
+    }
+
     std::cout << "Routing...\n\n";
 
-    vector<TourCommand> tcs = tg.generate_tour(stops);
+    TourStats tourStats;
+    vector<TourCommand> tcs = version->generator().generate_tour(tourStops, stats ? &tourStats : nullptr);
+
+    // a tile whose checksum failed can't be trusted, and neither can a tour over it
+    tileStats = loaded->tile_stats();
+    if (tileStats.damaged > 0)
+    {
+        cout << "Map snapshot is damaged: " << tileStats.damaged << " tiles failed their checksum" << endl;
+        return 1;
+    }
+
     if (tcs.empty())
         cout << "Unable to generate tour!\n";
     else
         print_tour(tcs);
+
+    // this run's legs are saved for the next
+    if (!legCacheFile.empty() && !version->leg_cache()->save(legCacheFile, version->geodb().fingerprint()))
+        cout << "Unable to write leg cache: " << legCacheFile << endl;
+
+    // on stderr, so the tour on stdout reads the same with or without them
+    if (stats)
+        print_stats(cerr, statsJson, phases, &tourStats, version->leg_cache(), loaded->is_tiled() ? &tileStats : nullptr);
+    if (!traceFile.empty() && !write_trace(traceFile))
+        cout << "Unable to write trace: " << traceFile << endl;
 }
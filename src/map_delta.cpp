@@ -0,0 +1,377 @@
+#include "map_delta.h"
+#include "map_parser.h"
+#include "geodb.h"
+#include "geo_batch.h"
+#include "hashmap.h"
+#include "trace.h"
+#include <string>
+#include <string_view>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <charconv>
+#include <cmath>
+#include <unordered_set>
+using namespace std;
+
+static bool isBlank(char c)
+{
+    return (c == ' ' || c == '\t' || c == '\r');
+}
+
+static string_view trimmed(string_view text)
+{
+    while ( ! text.empty() && isBlank(text.front()))
+        text.remove_prefix(1);
+    while ( ! text.empty() && isBlank(text.back()))
+        text.remove_suffix(1);
+    return text;
+}
+
+static bool parseCoord(string_view& text, GeoCoord& coord)
+{
+    return parse_fixed7(text, coord.lat) && parse_fixed7(text, coord.lon);
+}
+
+// Splits the text before the next '|' off the front of text, which must have one
+static bool splitName(string_view& text, string& name)
+{
+    size_t bar = text.find('|');
+    if (bar == string_view::npos)
+        return false;
+    name = string(trimmed(text.substr(0, bar)));
+    text.remove_prefix(bar + 1);
+    return ! name.empty();
+}
+
+static bool parseChange(string_view line, MapChange& change)
+{
+    size_t space = line.find_first_of(" \t");
+    string_view keyword = line.substr(0, space);
+    string_view rest = (space == string_view::npos) ? string_view() : line.substr(space + 1);
+
+    bool ok;
+    if (keyword == "add")
+    {
+        change.kind = MapChange::ADD_SEGMENT;
+        ok = splitName(rest, change.name) && parseCoord(rest, change.from) && parseCoord(rest, change.to);
+    }
+    else if (keyword == "remove")
+    {
+        change.kind = MapChange::REMOVE_SEGMENT;
+        ok = parseCoord(rest, change.from) && parseCoord(rest, change.to);
+    }
+    else if (keyword == "reweight")
+    {
+        change.kind = MapChange::REWEIGHT_SEGMENT;
+        ok = parseCoord(rest, change.from) && parseCoord(rest, change.to);
+        rest = trimmed(rest);
+        auto result = from_chars(rest.data(), rest.data() + rest.size(), change.factor);
+        ok = ok && result.ec == errc() && isfinite(change.factor) && change.factor >= 1;
+        rest.remove_prefix(ok ? result.ptr - rest.data() : 0);
+    }
+    else if (keyword == "add-poi")
+    {
+        change.kind = MapChange::ADD_POI;
+        ok = splitName(rest, change.name) && parseCoord(rest, change.poi);
+        rest = trimmed(rest);
+        ok = ok && ! rest.empty() && rest.front() == '|';
+        if (ok)
+        {
+            rest.remove_prefix(1);
+            ok = parseCoord(rest, change.from) && parseCoord(rest, change.to);
+        }
+    }
+    else if (keyword == "remove-poi")
+    {
+        change.kind = MapChange::REMOVE_POI;
+        change.name = string(trimmed(rest));
+        ok = ! change.name.empty();
+        rest = string_view();
+    }
+    else
+        return false;   // unknown change
+
+    return ok && trimmed(rest).empty();
+}
+
+bool parse_map_delta(std::string_view text, std::vector<MapChange>& changes, std::size_t& bad_line)
+{
+    changes.clear();
+    size_t lineNumber = 0;
+    while ( ! text.empty())
+    {
+        size_t newline = text.find('\n');
+        string_view line = trimmed(text.substr(0, newline));
+        text.remove_prefix(newline == string_view::npos ? text.size() : newline + 1);
+        lineNumber++;
+        if (line.empty() || line.front() == '#')
+            continue;   // blank line or comment
+
+        MapChange change = MapChange();
+        change.line = lineNumber;
+        if ( ! parseChange(line, change))
+        {
+            bad_line = lineNumber;
+            return false;
+        }
+        changes.push_back(change);
+    }
+    return true;
+}
+
+bool load_map_delta(const std::string& delta_file, std::vector<MapChange>& changes, std::size_t& bad_line)
+{
+    ifstream inf(delta_file);
+    if ( ! inf)
+    {
+        bad_line = 0;
+        return false;
+    }
+
+    stringstream text;
+    text << inf.rdbuf();
+    return parse_map_delta(text.str(), changes, bad_line);
+}
+
+// The length of a straight edge in miles, measured as a text map's edges are
+static double groundMiles(const GeoCoord& from, const GeoCoord& to)
+{
+    double fromLat = from.latitude(), fromLon = from.longitude();
+    double toLat = to.latitude(), toLon = to.longitude();
+    double miles;
+    batch_distance_miles(&fromLat, &fromLon, &toLat, &toLon, 1, &miles);
+    return miles;
+}
+
+bool GeoDatabase::load(const GeoDatabase& base, const std::vector<MapChange>& changes, std::size_t& failed)
+{
+    TraceSpan span("update");
+    clear();
+
+    // The base map's contents as a text map would be parsed into, but keeping its edges' lengths, which
+    // may have been reweighted; its streets keep their IDs, and each node's edges keep their order
+    ParsedMap parsed;
+    for (uint32_t street = 0; street < base.num_streets(); street++)
+        parsed.streets.push_back(base.street_name(street));
+    if (parsed.streets.empty())
+        parsed.streets.push_back("a path");
+    parsed.edges.reserve(base.num_edges());
+    parsed.lengths.reserve(base.num_edges());
+    for (uint32_t node = 0; node < base.num_nodes(); node++)
+    {
+        base.touch_node(node);
+        for (uint32_t e = base.edges_begin(node); e < base.edges_end(node); e++)
+        {
+            parsed.edges.push_back(RawEdge{base.get_node_coord(node), base.get_node_coord(base.edge_target(e)), base.edge_street(e)});
+            parsed.lengths.push_back(base.edge_length(e));
+        }
+    }
+
+    // Points of interest, by name while they're still on the map
+    vector<char> poiRemoved(base.num_pois(), false);
+    HashMap<size_t> poiByName;
+    HashMap<int, GeoCoord, GeoCoordHash> poisAt;
+    for (uint32_t poi = 0; poi < base.num_pois(); poi++)
+    {
+        parsed.pois.emplace_back(base.poi_name(poi), base.get_node_coord(base.poi_node(poi)));
+        poiByName[base.poi_name(poi)] = poi;
+        poisAt[parsed.pois.back().second]++;
+    }
+
+    // Only edges touching a point some change names need to be found again, so only they are indexed,
+    // under each of their ends that is such a point
+    HashMap<bool, GeoCoord, GeoCoordHash> named;
+    for (const MapChange& change : changes)
+    {
+        if (change.kind == MapChange::ADD_POI || change.kind == MapChange::REMOVE_POI)
+        {
+            const size_t* poi = poiByName.find(change.name);
+            if (poi != nullptr)
+                named.insert(parsed.pois[*poi].second, true);
+        }
+        if (change.kind == MapChange::ADD_POI)
+            named.insert(change.poi, true);
+        if (change.kind != MapChange::REMOVE_POI)
+        {
+            named.insert(change.from, true);
+            named.insert(change.to, true);
+            named.insert(midpoint(change.from, change.to), true);
+        }
+    }
+    HashMap<vector<uint32_t>, GeoCoord, GeoCoordHash> touching;
+    auto index = [&](uint32_t e)
+    {
+        const RawEdge& edge = parsed.edges[e];
+        if (named.find(edge.from) != nullptr)
+            touching[edge.from].push_back(e);
+        if (edge.to != edge.from && named.find(edge.to) != nullptr)
+            touching[edge.to].push_back(e);
+    };
+    for (uint32_t e = 0; e < parsed.edges.size(); e++)
+        index(e);
+
+    vector<char> removed(parsed.edges.size(), false);
+    auto addEdge = [&](const GeoCoord& from, const GeoCoord& to, uint32_t street)
+    {
+        parsed.edges.push_back(RawEdge{from, to, street});
+        parsed.lengths.push_back(groundMiles(from, to));
+        removed.push_back(false);
+        index(static_cast<uint32_t>(parsed.edges.size() - 1));
+    };
+
+    // The edges still on the map between two points, either way, on the given street or any but a path
+    auto edgesBetween = [&](const GeoCoord& a, const GeoCoord& b, uint32_t street)
+    {
+        vector<uint32_t> found;
+        const vector<uint32_t>* edges = touching.find(a);
+        if (edges == nullptr)
+            return found;
+        for (uint32_t e : *edges)
+        {
+            const RawEdge& edge = parsed.edges[e];
+            bool between = (edge.from == a && edge.to == b) || (edge.from == b && edge.to == a);
+            bool onStreet = (street == NO_STREET) ? edge.street != PATH_STREET : edge.street == street;
+            if ( ! removed[e] && between && onStreet)
+                found.push_back(e);
+        }
+        return found;
+    };
+
+    // A segment's edges, with the halves it was split into for points of interest on it
+    auto segmentEdges = [&](const MapChange& change)
+    {
+        vector<uint32_t> found = edgesBetween(change.from, change.to, NO_STREET);
+        if (found.empty())
+            return found;   // no such segment
+
+        GeoCoord mid = midpoint(change.from, change.to);
+        unordered_set<uint32_t> streets;
+        for (uint32_t e : found)
+            streets.insert(parsed.edges[e].street);
+        for (uint32_t street : streets)
+        {
+            for (const GeoCoord& end : {change.from, change.to})
+            {
+                vector<uint32_t> half = edgesBetween(end, mid, street);
+                found.insert(found.end(), half.begin(), half.end());
+            }
+        }
+        return found;
+    };
+
+    // Takes a point of interest off the map, with its paths unless another point of interest shares them
+    auto removePoi = [&](size_t poi)
+    {
+        poiRemoved[poi] = true;
+        poiByName.erase(parsed.pois[poi].first);
+        GeoCoord location = parsed.pois[poi].second;
+        if (--poisAt[location] > 0)
+            return;
+        for (uint32_t e : touching[location])
+            if (parsed.edges[e].street == PATH_STREET)
+                removed[e] = true;
+    };
+
+    for (size_t i = 0; i < changes.size(); i++)
+    {
+        const MapChange& change = changes[i];
+        bool ok = true;
+        switch (change.kind)
+        {
+            case MapChange::ADD_SEGMENT:
+            {
+                parsed.streets.push_back(change.name);
+                uint32_t street = static_cast<uint32_t>(parsed.streets.size() - 1);
+                addEdge(change.from, change.to, street);
+                addEdge(change.to, change.from, street);
+                break;
+            }
+            case MapChange::REMOVE_SEGMENT:
+            {
+                vector<uint32_t> edges = segmentEdges(change);
+                ok = ! edges.empty();
+                for (uint32_t e : edges)
+                    removed[e] = true;
+                break;
+            }
+            case MapChange::REWEIGHT_SEGMENT:
+            {
+                vector<uint32_t> edges = segmentEdges(change);
+                ok = ! edges.empty();
+                for (uint32_t e : edges)
+                    parsed.lengths[e] = change.factor * groundMiles(parsed.edges[e].from, parsed.edges[e].to);
+                break;
+            }
+            case MapChange::ADD_POI:
+            {
+                // the street the segment's connection read last is on names it, as it does a route
+                vector<uint32_t> edges = edgesBetween(change.from, change.to, NO_STREET);
+                ok = ! edges.empty();
+                if ( ! ok)
+                    break;
+                uint32_t street = parsed.edges[edges.back()].street;
+
+                const size_t* old = poiByName.find(change.name);
+                if (old != nullptr)
+                    removePoi(*old);
+
+                // like a point of interest in the map data, it's reached by a path from the segment's midpoint
+                GeoCoord mid = midpoint(change.from, change.to);
+                if (edgesBetween(change.from, mid, street).empty())
+                {
+                    addEdge(change.from, mid, street);
+                    addEdge(mid, change.from, street);
+                    addEdge(mid, change.to, street);
+                    addEdge(change.to, mid, street);
+                }
+                addEdge(mid, change.poi, PATH_STREET);
+                addEdge(change.poi, mid, PATH_STREET);
+
+                parsed.pois.emplace_back(change.name, change.poi);
+                poiRemoved.push_back(false);
+                poiByName[change.name] = parsed.pois.size() - 1;
+                poisAt[change.poi]++;
+                break;
+            }
+            case MapChange::REMOVE_POI:
+            {
+                const size_t* poi = poiByName.find(change.name);
+                ok = (poi != nullptr);
+                if (ok)
+                    removePoi(*poi);
+                break;
+            }
+        }
+
+        if ( ! ok)  // names a segment or point of interest that isn't on the map
+        {
+            failed = i;
+            clear();
+            return false;
+        }
+    }
+
+    // what's left is built like a text map
+    size_t kept = 0;
+    for (size_t e = 0; e < parsed.edges.size(); e++)
+    {
+        if (removed[e])
+            continue;
+        parsed.edges[kept] = parsed.edges[e];
+        parsed.lengths[kept] = parsed.lengths[e];
+        kept++;
+    }
+    parsed.edges.resize(kept);
+    parsed.lengths.resize(kept);
+
+    kept = 0;
+    for (size_t poi = 0; poi < parsed.pois.size(); poi++)
+        if ( ! poiRemoved[poi])
+            parsed.pois[kept++] = parsed.pois[poi];
+    parsed.pois.resize(kept);
+
+    TraceSpan buildSpan("update.build_tables");
+    build_tables(parsed);
+    return true;
+}
@@ -0,0 +1,191 @@
+#include "map_parser.h"
+#include "parallel.h"
+#include "trace.h"
+#include <charconv>
+#include <cstring>
+#include <string_view>
+#include <vector>
+using namespace std;
+
+// Returns the line starting at pos, without its newline, and moves pos to the start of the next line
+static string_view nextLine(const char* data, size_t size, size_t& pos)
+{
+    const char* start = data + pos;
+    const char* newline = static_cast<const char*>(memchr(start, '\n', size - pos));
+    size_t length = (newline == nullptr) ? size - pos : newline - start;
+    pos += (newline == nullptr) ? length : length + 1;
+    return string_view(start, length);
+}
+
+static bool isBlank(char c)
+{
+    return (c == ' ' || c == '\t' || c == '\r');
+}
+
+static bool isBlankLine(string_view line)
+{
+    for (char c : line)
+        if ( ! isBlank(c))
+            return false;
+    return true;
+}
+
+// Reads a number from the front of text, skipping blanks before it, and removes it from text
+template <typename T>
+static bool parseNumber(string_view& text, T& value)
+{
+    while ( ! text.empty() && isBlank(text.front()))
+        text.remove_prefix(1);
+
+    auto result = from_chars(text.data(), text.data() + text.size(), value);
+    if (result.ec != errc())
+        return false;
+
+    text.remove_prefix(result.ptr - text.data());
+    return true;
+}
+
+static bool parseCoord(string_view& text, GeoCoord& coord)
+{
+    return parse_fixed7(text, coord.lat) && parse_fixed7(text, coord.lon);
+}
+
+// Parses the street segments in [begin, end) of the text
+// Street indices in the result are 1 + the segment's index within the chunk, or PATH_STREET
+static bool parseChunk(const char* data, size_t begin, size_t end, ParsedMap& chunk)
+{
+    // Each "block" of lines in the map data file has
+    // A line with the name of the street segment
+    // A line with the starting and ending GeoPoints of the street segment
+    // A line with the number (P) of points of interest reachable from the street segment
+    // P lines with the names and locations of the points of interest found on the street segment
+    size_t pos = begin;
+    while (pos < end)
+    {
+        string_view street = nextLine(data, end, pos);
+        chunk.streets.push_back(street);
+        uint32_t streetIndex = static_cast<uint32_t>(chunk.streets.size());
+
+        // Get the starting and ending locations of the street segment
+        string_view coords = nextLine(data, end, pos);
+        GeoCoord start;
+        GeoCoord stop;
+        if ( ! parseCoord(coords, start) || ! parseCoord(coords, stop))
+            return false;
+
+        // start is connected to stop, and vice versa, by the street
+        chunk.edges.push_back(RawEdge{start, stop, streetIndex});
+        chunk.edges.push_back(RawEdge{stop, start, streetIndex});
+
+        // Get the number of points of interest
+        string_view countLine = nextLine(data, end, pos);
+        int numPoI;
+        if ( ! parseNumber(countLine, numPoI))
+            return false;
+
+        if (numPoI < 1)
+            continue;
+
+        // Create midpoint connections by the street
+        GeoCoord mid = midpoint(start, stop);
+        chunk.edges.push_back(RawEdge{start, mid, streetIndex});
+        chunk.edges.push_back(RawEdge{mid, start, streetIndex});
+        chunk.edges.push_back(RawEdge{mid, stop, streetIndex});
+        chunk.edges.push_back(RawEdge{stop, mid, streetIndex});
+
+        for (int i = 0; i < numPoI; i++)
+        {
+            // Get the point of interest name, up to the '|', and location
+            string_view poiLine = nextLine(data, end, pos);
+            size_t bar = poiLine.find('|');
+            if (bar == string_view::npos)
+                return false;
+
+            string_view rest = poiLine.substr(bar + 1);
+            GeoCoord poi;
+            if ( ! parseCoord(rest, poi))
+                return false;
+
+            chunk.pois.push_back(pair(poiLine.substr(0, bar), poi));
+
+            // mid is connected to the point of interest, and vice versa, by "a path"
+            chunk.edges.push_back(RawEdge{mid, poi, PATH_STREET});
+            chunk.edges.push_back(RawEdge{poi, mid, PATH_STREET});
+        }
+    }
+
+    return true;
+}
+
+bool parse_map_data(const char* data, std::size_t size, ParsedMap& map)
+{
+    // Find where every street segment starts by skimming line boundaries and point of interest counts,
+    // so the text can be split into chunks that never cut a segment in two
+    TraceSpan scanSpan("parse.scan");
+    vector<size_t> segmentStarts;
+    size_t pos = 0;
+    while (pos < size)
+    {
+        size_t start = pos;
+        if (isBlankLine(nextLine(data, size, pos)) && pos >= size)
+            break;  // trailing blank line
+
+        nextLine(data, size, pos);  // coordinates
+        string_view countLine = nextLine(data, size, pos);
+        int numPoI;
+        if ( ! parseNumber(countLine, numPoI))
+            return false;
+
+        for (int i = 0; i < numPoI && pos < size; i++)
+            nextLine(data, size, pos);
+
+        segmentStarts.push_back(start);
+    }
+    size_t numSegments = segmentStarts.size();
+    segmentStarts.push_back(pos);
+    scanSpan.end();
+
+    // Parse several chunks per thread so uneven chunks balance out
+    size_t numChunks = min(numSegments, hardware_threads() * 4);
+    vector<ParsedMap> chunks(numChunks);
+    vector<char> chunkOk(numChunks, false);
+    parallel_for(numChunks, [&](size_t c)
+    {
+        TraceSpan chunkSpan("parse.chunk");
+        size_t first = numSegments * c / numChunks;
+        size_t last = numSegments * (c + 1) / numChunks;
+        chunkOk[c] = parseChunk(data, segmentStarts[first], segmentStarts[last], chunks[c]);
+    });
+
+    // Append the chunks in file order, so the result is the same for any number of threads
+    TraceSpan mergeSpan("parse.merge");
+    size_t numEdges = 0;
+    size_t numPois = 0;
+    for (size_t c = 0; c < numChunks; c++)
+    {
+        if ( ! chunkOk[c])
+            return false;
+        numEdges += chunks[c].edges.size();
+        numPois += chunks[c].pois.size();
+    }
+
+    map.edges.reserve(numEdges);
+    map.streets.reserve(numSegments + 1);
+    map.pois.reserve(numPois);
+    map.streets.push_back("a path");
+
+    for (const auto& chunk : chunks)
+    {
+        uint32_t streetBase = static_cast<uint32_t>(map.streets.size()) - 1;
+        for (RawEdge edge : chunk.edges)
+        {
+            if (edge.street != PATH_STREET)
+                edge.street += streetBase;
+            map.edges.push_back(edge);
+        }
+        map.streets.insert(map.streets.end(), chunk.streets.begin(), chunk.streets.end());
+        map.pois.insert(map.pois.end(), chunk.pois.begin(), chunk.pois.end());
+    }
+
+    return true;
+}
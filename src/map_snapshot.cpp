@@ -0,0 +1,226 @@
+#include "map_snapshot.h"
+#include "geodb.h"
+#include "trace.h"
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstring>
+#include <cstddef>
+#include <utility>
+#include <memory>
+using namespace std;
+
+uint64_t snapshot_checksum(const char* data, std::size_t size)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= static_cast<unsigned char>(data[i]);
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+bool is_snapshot(const char* data, std::size_t size)
+{
+    return (size >= sizeof(SNAPSHOT_MAGIC) && memcmp(data, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) == 0);
+}
+
+bool edges_well_formed(const ArrayView<uint32_t>& edge_offsets, const ArrayView<uint32_t>& edge_targets,
+                       const ArrayView<uint32_t>& edge_streets, uint32_t num_streets, uint32_t first_node, uint32_t end_node)
+{
+    uint32_t numNodes = static_cast<uint32_t>(edge_offsets.size() - 1);
+    for (uint32_t n = first_node; n < end_node; n++)
+    {
+        if (edge_offsets[n] > edge_offsets[n + 1] || edge_offsets[n + 1] > edge_targets.size())
+            return false;
+        for (uint32_t e = edge_offsets[n]; e < edge_offsets[n + 1]; e++)
+            if (edge_targets[e] >= numNodes || edge_streets[e] >= num_streets)
+                return false;
+    }
+    return true;
+}
+
+// Folds a table's checksum into a running one
+template <typename T>
+static uint64_t combineChecksum(uint64_t hash, const ArrayView<T>& table)
+{
+    return (hash ^ snapshot_checksum(reinterpret_cast<const char*>(table.data()), table.size() * sizeof(T))) * 1099511628211ULL;
+}
+
+// The sections of a tiled snapshot that no tile's checksum covers, which the header's checksum covers instead
+static const SnapshotSection UNTILED_SECTIONS[] = {
+    SECTION_STREET_OFFSETS, SECTION_STREET_CHARS, SECTION_POIS, SECTION_POI_CHARS, SECTION_TILES
+};
+
+static uint64_t untiledChecksum(const char* file, const SnapshotHeader& header)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (SnapshotSection section : UNTILED_SECTIONS)
+        hash = (hash ^ snapshot_checksum(file + header.sections[section].offset, header.sections[section].size)) * 1099511628211ULL;
+    return hash;
+}
+
+uint64_t GeoDatabase::fingerprint() const
+{
+    uint64_t hash = 14695981039346656037ULL;
+    hash = combineChecksum(hash, m_nodes);
+    hash = combineChecksum(hash, m_edgeOffsets);
+    hash = combineChecksum(hash, m_edgeTargets);
+    hash = combineChecksum(hash, m_edgeLengths);
+    return hash;
+}
+
+bool GeoDatabase::save_snapshot(const std::string& snapshot_file) const
+{
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    header.version = SNAPSHOT_VERSION;
+    header.byteOrder = SNAPSHOT_BYTE_ORDER;
+
+    // build the whole file in memory, leaving room for the header
+    vector<char> file(sizeof(header), 0);
+    append_section(file, header.sections[SECTION_NODES], m_nodes);
+    append_section(file, header.sections[SECTION_EDGE_OFFSETS], m_edgeOffsets);
+    append_section(file, header.sections[SECTION_EDGE_TARGETS], m_edgeTargets);
+    append_section(file, header.sections[SECTION_EDGE_LENGTHS], m_edgeLengths);
+    append_section(file, header.sections[SECTION_EDGE_STREETS], m_edgeStreets);
+    append_section(file, header.sections[SECTION_EDGE_ANGLES], m_edgeAngles);
+    append_section(file, header.sections[SECTION_EDGE_COMPASS], m_edgeCompass);
+    append_section(file, header.sections[SECTION_STREET_OFFSETS], m_streetOffsets);
+    append_section(file, header.sections[SECTION_STREET_CHARS], m_streetChars);
+    append_section(file, header.sections[SECTION_POIS], m_pois);
+    append_section(file, header.sections[SECTION_POI_CHARS], m_poiChars);
+    append_section(file, header.sections[SECTION_TILES], m_tiles);
+
+    header.fileSize = file.size();
+    header.tileSize = m_tileSize;
+    if (is_tiled())
+    {
+        // each tile checksums its own rows, so a loader can check it when it first reads it
+        vector<TileExtent> extents;
+        for (size_t i = 0; i < m_tiles.size(); i++)
+        {
+            tile_extents(header, m_edgeOffsets, m_tiles[i], extents);
+            uint64_t checksum = tile_checksum(file.data(), extents);
+            memcpy(file.data() + header.sections[SECTION_TILES].offset + i * sizeof(MapTile) + offsetof(MapTile, checksum),
+                   &checksum, sizeof(checksum));
+        }
+        header.checksum = untiledChecksum(file.data(), header);
+    }
+    else
+        header.checksum = snapshot_checksum(file.data() + sizeof(header), file.size() - sizeof(header));
+    memcpy(file.data(), &header, sizeof(header));
+
+    ofstream outf(snapshot_file, ios::binary | ios::trunc);
+    if ( ! outf)    // file can't be created
+        return false;
+
+    outf.write(file.data(), file.size());
+    return static_cast<bool>(outf);
+}
+
+bool GeoDatabase::load_snapshot()
+{
+    if (m_file.size() < sizeof(SnapshotHeader))
+        return false;   // truncated header
+
+    SnapshotHeader header;
+    memcpy(&header, m_file.data(), sizeof(header));
+
+    if (header.version != SNAPSHOT_VERSION || header.byteOrder != SNAPSHOT_BYTE_ORDER || header.fileSize != m_file.size())
+        return false;   // written by a different version or machine, or truncated
+
+    // checksumming an untiled snapshot would read every page of it, so only verify_snapshot does,
+    // but every ID in it is checked before it's used; a tiled snapshot is checksummed and checked
+    // a tile at a time as the tiles are read, and the rest now
+    bool tiled = (header.tileSize != 0);
+    bool ok = view_section(m_file, header.sections[SECTION_NODES], m_nodes) &&
+        view_section(m_file, header.sections[SECTION_EDGE_OFFSETS], m_edgeOffsets) &&
+        view_section(m_file, header.sections[SECTION_EDGE_TARGETS], m_edgeTargets) &&
+        view_section(m_file, header.sections[SECTION_EDGE_LENGTHS], m_edgeLengths) &&
+        view_section(m_file, header.sections[SECTION_EDGE_STREETS], m_edgeStreets) &&
+        view_section(m_file, header.sections[SECTION_EDGE_ANGLES], m_edgeAngles) &&
+        view_section(m_file, header.sections[SECTION_EDGE_COMPASS], m_edgeCompass) &&
+        view_section(m_file, header.sections[SECTION_STREET_OFFSETS], m_streetOffsets) &&
+        view_section(m_file, header.sections[SECTION_STREET_CHARS], m_streetChars) &&
+        view_section(m_file, header.sections[SECTION_POIS], m_pois) &&
+        view_section(m_file, header.sections[SECTION_POI_CHARS], m_poiChars) &&
+        view_section(m_file, header.sections[SECTION_TILES], m_tiles);
+
+    if (ok && tiled)
+    {
+        TraceSpan tiledChecksumSpan("load.checksum");
+        ok = (header.checksum == untiledChecksum(m_file.data(), header));
+    }
+
+    // the adjacency must have one offset per node plus one, spanning every edge table, which are all
+    // one row per edge, and the tiles must number the nodes in order
+    size_t numEdges = m_edgeTargets.size();
+    if ( ! ok || m_edgeOffsets.size() != m_nodes.size() + 1 || m_nodes.size() >= UINT32_MAX ||
+        m_edgeOffsets[0] != 0 || m_edgeOffsets[m_nodes.size()] != numEdges || m_edgeLengths.size() != numEdges ||
+        m_edgeStreets.size() != numEdges || m_edgeAngles.size() != numEdges || m_edgeCompass.size() != numEdges ||
+        ( ! tiled && ! m_tiles.empty()))
+    {
+        clear();
+        return false;
+    }
+    
+    // names must lie within their character sections, and points of interest must be on the map
+    bool namesOk = true;
+    for (size_t i = 0; i + 1 < m_streetOffsets.size(); i++)
+        namesOk = namesOk && m_streetOffsets[i] <= m_streetOffsets[i + 1];
+    namesOk = namesOk && (m_streetOffsets.empty() || m_streetOffsets[m_streetOffsets.size() - 1] <= m_streetChars.size());
+    for (const PoiRecord& poi : m_pois)
+        namesOk = namesOk && poi.node < m_nodes.size() && static_cast<uint64_t>(poi.nameOffset) + poi.nameLength <= m_poiChars.size();
+    if ( ! namesOk || ( ! tiled && ! edges_well_formed(m_edgeOffsets, m_edgeTargets, m_edgeStreets, num_streets(), 0, num_nodes())))
+    {
+        clear();
+        return false;
+    }
+    for (size_t i = 0; i < m_tiles.size(); i++)
+    {
+        const MapTile& tile = m_tiles[i];
+        uint32_t expectedFirst = (i == 0) ? 0 : m_tiles[i - 1].endNode;
+        bool ordered = (i == 0) || make_pair(m_tiles[i - 1].row, m_tiles[i - 1].col) < make_pair(tile.row, tile.col);
+        if (tile.firstNode != expectedFirst || tile.endNode <= tile.firstNode || ! ordered)
+        {
+            clear();
+            return false;
+        }
+    }
+    if (tiled && (m_tiles.empty() ? m_nodes.size() : m_tiles[m_tiles.size() - 1].endNode) != m_nodes.size())
+    {
+        clear();
+        return false;
+    }
+
+    if (tiled)
+    {
+        m_tileSize = header.tileSize;
+        m_pager = make_unique<TilePager>(m_file, header, m_tiles, m_edgeOffsets);
+    }
+    return true;
+}
+
+bool GeoDatabase::verify_snapshot() const
+{
+    if ( ! is_snapshot(m_file.data(), m_file.size()))
+        return true;    // parsed from text, or built from another map
+
+    TraceSpan span("verify");
+    SnapshotHeader header;
+    memcpy(&header, m_file.data(), sizeof(header));
+    if (header.tileSize == 0)
+        return header.checksum == snapshot_checksum(m_file.data() + sizeof(header), m_file.size() - sizeof(header));
+
+    // the untiled sections were checked by load
+    vector<TileExtent> extents;
+    for (size_t i = 0; i < m_tiles.size(); i++)
+    {
+        if ( ! tile_extents(header, m_edgeOffsets, m_tiles[i], extents) || tile_checksum(m_file.data(), extents) != m_tiles[i].checksum)
+            return false;
+    }
+    return true;
+}
@@ -0,0 +1,329 @@
+#include "map_tiles.h"
+#include "map_snapshot.h"
+#include "geodb.h"
+#include "geocoord.h"
+#include "trace.h"
+#include <string>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <algorithm>
+#include <numeric>
+#include <cmath>
+#include <climits>
+using namespace std;
+
+namespace
+{
+    // Each thread's last tile, so stepping between nodes of one tile skips the tile table
+    struct LastTile
+    {
+        uint64_t pager = 0;
+        uint32_t firstNode = 0;
+        uint32_t endNode = 0;
+    };
+    thread_local LastTile lastTile;
+
+    atomic<uint64_t> nextPagerId(1);
+}
+
+bool tile_extents(const SnapshotHeader& header, const ArrayView<uint32_t>& edge_offsets, const MapTile& tile,
+                  std::vector<TileExtent>& extents)
+{
+    extents.clear();
+    uint64_t firstEdge = edge_offsets[tile.firstNode];
+    uint64_t endEdge = edge_offsets[tile.endNode];
+    if (firstEdge > endEdge)
+        return false;
+
+    auto add = [&](SnapshotSection section, uint64_t first, uint64_t end, uint64_t row_size)
+    {
+        extents.push_back(TileExtent{header.sections[section].offset + first * row_size, (end - first) * row_size});
+        return end * row_size <= header.sections[section].size;
+    };
+    return add(SECTION_NODES, tile.firstNode, tile.endNode, sizeof(GeoCoord)) &&
+        add(SECTION_EDGE_OFFSETS, tile.firstNode, tile.endNode + 1, sizeof(uint32_t)) &&
+        add(SECTION_EDGE_TARGETS, firstEdge, endEdge, sizeof(uint32_t)) &&
+        add(SECTION_EDGE_LENGTHS, firstEdge, endEdge, sizeof(double)) &&
+        add(SECTION_EDGE_STREETS, firstEdge, endEdge, sizeof(uint32_t)) &&
+        add(SECTION_EDGE_ANGLES, firstEdge, endEdge, sizeof(double)) &&
+        add(SECTION_EDGE_COMPASS, firstEdge, endEdge, sizeof(uint8_t));
+}
+
+uint64_t tile_checksum(const char* snapshot, const std::vector<TileExtent>& extents)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (const TileExtent& extent : extents)
+        hash = (hash ^ snapshot_checksum(snapshot + extent.offset, extent.size)) * 1099511628211ULL;
+    return hash;
+}
+
+TilePager::TilePager(const MappedFile& file, const SnapshotHeader& header, ArrayView<MapTile> tiles, ArrayView<uint32_t> edge_offsets)
+ : m_file(file), m_header(header), m_tiles(tiles), m_edgeOffsets(edge_offsets), m_id(nextPagerId++),
+   m_lastUse(new atomic<uint64_t>[tiles.size()]), m_clock(0),
+   m_residentBytes(0), m_memoryCap(0), m_loads(0), m_evictions(0), m_damaged(0)
+{
+    for (size_t i = 0; i < tiles.size(); i++)
+        m_lastUse[i].store(0, memory_order_relaxed);
+    
+    // the loader has checked that these sections fit in the file
+    ArrayView<uint32_t> streetOffsets;
+    view_section(file, header.sections[SECTION_EDGE_TARGETS], m_edgeTargets);
+    view_section(file, header.sections[SECTION_EDGE_STREETS], m_edgeStreets);
+    view_section(file, header.sections[SECTION_STREET_OFFSETS], streetOffsets);
+    m_numStreets = streetOffsets.empty() ? 0 : static_cast<uint32_t>(streetOffsets.size()) - 1;
+}
+
+TilePager::~TilePager() {}
+
+void TilePager::touch_node(uint32_t node)
+{
+    LastTile& last = lastTile;
+    if (last.pager == m_id && node >= last.firstNode && node < last.endNode)
+        return;     // still in the same tile
+
+    // the last tile starting at or before the node
+    auto it = upper_bound(m_tiles.begin(), m_tiles.end(), node, [](uint32_t n, const MapTile& tile) {
+        return n < tile.firstNode;
+    });
+    if (it == m_tiles.begin() || node >= (it - 1)->endNode)
+        return;     // not a node of the map
+
+    --it;
+    last = LastTile{m_id, it->firstNode, it->endNode};
+    load(static_cast<uint32_t>(it - m_tiles.begin()));
+}
+
+void TilePager::load(uint32_t tile)
+{
+    // a resident tile only needs its last use moved up, unless it is dropped meanwhile
+    uint64_t used = m_lastUse[tile].load(memory_order_relaxed);
+    while (used != 0)
+    {
+        if (m_lastUse[tile].compare_exchange_weak(used, m_clock.fetch_add(1, memory_order_relaxed) + 1, memory_order_relaxed))
+            return;
+    }
+
+    lock_guard<mutex> guard(m_lock);
+    if (m_lastUse[tile].load(memory_order_relaxed) != 0)
+        return;     // another thread read it in meanwhile
+
+    TraceSpan span("tile.load");
+    if (span.active())
+        span.set_detail(to_string(m_tiles[tile].row) + ", " + to_string(m_tiles[tile].col));
+
+    // checking the tile reads every byte of it, which the prefetch lets the OS start on at once
+    vector<TileExtent> extents;
+    size_t bytes = 0;
+    if (tile_extents(m_header, m_edgeOffsets, m_tiles[tile], extents))
+    {
+        for (const TileExtent& extent : extents)
+        {
+            m_file.prefetch(extent.offset, extent.size);
+            bytes += extent.size;
+        }
+        if (tile_checksum(m_file.data(), extents) != m_tiles[tile].checksum ||
+            ! edges_well_formed(m_edgeOffsets, m_edgeTargets, m_edgeStreets, m_numStreets, m_tiles[tile].firstNode, m_tiles[tile].endNode))
+            m_damaged++;
+    }
+    else
+        m_damaged++;    // its edges run outside the edge tables
+
+    m_lastUse[tile].store(m_clock.fetch_add(1, memory_order_relaxed) + 1, memory_order_relaxed);
+    m_resident.push_back(tile);
+    m_residentBytes += bytes;
+    m_loads++;
+    evict_over_cap(tile);
+}
+
+// Drops the least recently used tiles other than keep until the resident tiles fit under the cap
+// Must be called holding m_lock
+void TilePager::evict_over_cap(uint32_t keep)
+{
+    while (m_memoryCap != 0 && m_residentBytes > m_memoryCap)
+    {
+        size_t oldest = m_resident.size();
+        for (size_t i = 0; i < m_resident.size(); i++)
+        {
+            if (m_resident[i] != keep && (oldest == m_resident.size() ||
+                m_lastUse[m_resident[i]].load(memory_order_relaxed) < m_lastUse[m_resident[oldest]].load(memory_order_relaxed)))
+                oldest = i;
+        }
+        if (oldest == m_resident.size())
+            return;     // only the tile just read is left
+
+        // a damaged tile was counted as no bytes when it was read in
+        uint32_t tile = m_resident[oldest];
+        vector<TileExtent> extents;
+        if (tile_extents(m_header, m_edgeOffsets, m_tiles[tile], extents))
+        {
+            for (const TileExtent& extent : extents)
+            {
+                m_file.release(extent.offset, extent.size);
+                m_residentBytes -= extent.size;
+            }
+        }
+
+        m_lastUse[tile].store(0, memory_order_relaxed);
+        m_resident[oldest] = m_resident.back();
+        m_resident.pop_back();
+        m_evictions++;
+    }
+}
+
+void TilePager::set_memory_cap(std::size_t bytes)
+{
+    lock_guard<mutex> guard(m_lock);
+    m_memoryCap = bytes;
+    evict_over_cap(UINT32_MAX);
+}
+
+TileStats TilePager::stats() const
+{
+    lock_guard<mutex> guard(m_lock);
+    TileStats stats;
+    stats.tiles = m_tiles.size();
+    stats.resident = m_resident.size();
+    stats.residentBytes = m_residentBytes;
+    stats.loads = m_loads;
+    stats.evictions = m_evictions;
+    stats.damaged = m_damaged;
+    return stats;
+}
+
+bool GeoDatabase::tile(double tile_degrees)
+{
+    double units = round(tile_degrees * 1e7);
+    if ( ! (units >= 1 && units <= INT32_MAX))
+        return false;   // smaller than the map's precision, or larger than the world
+    uint32_t tileSize = static_cast<uint32_t>(units);
+
+    // the new numbering: by tile, then by key within the tile
+    uint32_t numNodes = num_nodes();
+    auto tileOf = [&](uint32_t node) {
+        return make_pair(tile_index(m_nodes[node].lat, tileSize), tile_index(m_nodes[node].lon, tileSize));
+    };
+    vector<uint32_t> order(numNodes);
+    iota(order.begin(), order.end(), 0);
+    sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+        auto tileA = tileOf(a);
+        auto tileB = tileOf(b);
+        return (tileA != tileB) ? tileA < tileB : m_nodes[a] < m_nodes[b];
+    });
+    vector<uint32_t> newId(numNodes);
+    for (uint32_t i = 0; i < numNodes; i++)
+        newId[order[i]] = i;
+
+    // every table is rebuilt in the new order; edges leaving a node keep their order
+    vector<GeoCoord> nodes(numNodes);
+    vector<uint32_t> edgeOffsets(numNodes + 1, 0);
+    vector<uint32_t> edgeTargets, edgeStreets;
+    vector<double> edgeLengths, edgeAngles;
+    vector<uint8_t> edgeCompass;
+    vector<MapTile> tiles;
+    for (uint32_t i = 0; i < numNodes; i++)
+    {
+        uint32_t old = order[i];
+        nodes[i] = m_nodes[old];
+        for (uint32_t e = edges_begin(old); e < edges_end(old); e++)
+        {
+            edgeTargets.push_back(newId[m_edgeTargets[e]]);
+            edgeLengths.push_back(m_edgeLengths[e]);
+            edgeStreets.push_back(m_edgeStreets[e]);
+            edgeAngles.push_back(m_edgeAngles[e]);
+            edgeCompass.push_back(m_edgeCompass[e]);
+        }
+        edgeOffsets[i + 1] = static_cast<uint32_t>(edgeTargets.size());
+
+        auto tileIndex = tileOf(old);
+        if (tiles.empty() || tiles.back().row != tileIndex.first || tiles.back().col != tileIndex.second)
+            tiles.push_back(MapTile{tileIndex.first, tileIndex.second, i, i, 0});
+        tiles.back().endNode = i + 1;
+    }
+
+    vector<PoiRecord> pois(m_pois.begin(), m_pois.end());
+    for (PoiRecord& poi : pois)
+        poi.node = newId[poi.node];
+    vector<uint32_t> streetOffsets(m_streetOffsets.begin(), m_streetOffsets.end());
+    vector<char> streetChars(m_streetChars.begin(), m_streetChars.end());
+    vector<char> poiChars(m_poiChars.begin(), m_poiChars.end());
+
+    m_pager.reset();
+    m_nodeStorage = move(nodes);
+    m_edgeOffsetStorage = move(edgeOffsets);
+    m_edgeTargetStorage = move(edgeTargets);
+    m_edgeLengthStorage = move(edgeLengths);
+    m_edgeStreetStorage = move(edgeStreets);
+    m_edgeAngleStorage = move(edgeAngles);
+    m_edgeCompassStorage = move(edgeCompass);
+    m_streetOffsetStorage = move(streetOffsets);
+    m_streetCharStorage = move(streetChars);
+    m_poiStorage = move(pois);
+    m_poiCharStorage = move(poiChars);
+    m_tileStorage = move(tiles);
+    m_tileSize = tileSize;
+    use_storage();
+    m_file.close();     // the tables no longer view a snapshot, if they did
+    return true;
+}
+
+bool GeoDatabase::find_tile(int32_t row, int32_t col, uint32_t& tile) const
+{
+    auto it = lower_bound(m_tiles.begin(), m_tiles.end(), make_pair(row, col), [](const MapTile& t, const pair<int32_t, int32_t>& key) {
+        return make_pair(t.row, t.col) < key;
+    });
+
+    if (it == m_tiles.end() || it->row != row || it->col != col)
+        return false;   // no nodes in that tile
+
+    tile = static_cast<uint32_t>(it - m_tiles.begin());
+    return true;
+}
+
+void GeoDatabase::load_tiles_around(const GeoPoint& pt, int radius) const
+{
+    if (m_pager)
+        tiles_around(pt, radius);
+}
+
+std::vector<uint32_t> GeoDatabase::tiles_around(const GeoPoint& pt, int radius) const
+{
+    vector<uint32_t> tiles;
+    GeoCoord coord;
+    if ( ! is_tiled() || ! to_geocoord(pt, coord))
+        return tiles;
+
+    int32_t row = tile_index(coord.lat, m_tileSize);
+    int32_t col = tile_index(coord.lon, m_tileSize);
+    for (int32_t r = row - radius; r <= row + radius; r++)
+    {
+        for (int32_t c = col - radius; c <= col + radius; c++)
+        {
+            uint32_t tile;
+            if (find_tile(r, c, tile))
+            {
+                if (m_pager)
+                    m_pager->load(tile);
+                tiles.push_back(tile);
+            }
+        }
+    }
+    return tiles;
+}
+
+void GeoDatabase::set_tile_memory_cap(std::size_t bytes)
+{
+    if (m_pager)
+        m_pager->set_memory_cap(bytes);
+}
+
+TileStats GeoDatabase::tile_stats() const
+{
+    if (m_pager)
+        return m_pager->stats();
+
+    // a map tiled in memory has every tile in memory
+    TileStats stats;
+    stats.tiles = stats.resident = m_tiles.size();
+    return stats;
+}
@@ -0,0 +1,68 @@
+#include "mapped_file.h"
+#include <string>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+using namespace std;
+
+MappedFile::MappedFile() : m_data(nullptr), m_size(0) {}
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+bool MappedFile::open(const std::string& file)
+{
+    close();
+    
+    int fd = ::open(file.c_str(), O_RDONLY);
+    if (fd < 0)     // file not found
+        return false;
+    
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0)   // can't map an empty file
+    {
+        ::close(fd);
+        return false;
+    }
+    
+    void* addr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);    // the mapping stays valid after the descriptor is closed
+    
+    if (addr == MAP_FAILED)
+        return false;
+    
+    m_data = static_cast<const char*>(addr);
+    m_size = st.st_size;
+    return true;
+}
+
+void MappedFile::prefetch(std::size_t offset, std::size_t size) const
+{
+    // madvise takes page aligned ranges, so round the start down
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t start = offset - offset % page;
+    if (m_data != nullptr && size > 0)
+        madvise(const_cast<char*>(m_data) + start, offset + size - start, MADV_WILLNEED);
+}
+
+void MappedFile::release(std::size_t offset, std::size_t size) const
+{
+    // only the pages wholly inside the range, since the rest may hold data still in use
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t start = (offset + page - 1) / page * page;
+    size_t end = (offset + size) / page * page;
+    if (m_data != nullptr && end > start)
+        madvise(const_cast<char*>(m_data) + start, end - start, MADV_DONTNEED);
+}
+
+void MappedFile::close()
+{
+    if (m_data != nullptr)
+        munmap(const_cast<char*>(m_data), m_size);
+    
+    m_data = nullptr;
+    m_size = 0;
+}
@@ -0,0 +1,56 @@
+#include "parallel.h"
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+using namespace std;
+
+ThreadPool& ThreadPool::shared()
+{
+    static ThreadPool pool(hardware_threads() - 1);
+    return pool;
+}
+
+ThreadPool::ThreadPool(std::size_t num_threads) : m_stopping(false)
+{
+    for (size_t i = 0; i < num_threads; i++)
+        m_threads.emplace_back(&ThreadPool::work, this);
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        lock_guard<mutex> guard(m_lock);
+        m_stopping = true;
+    }
+    m_ready.notify_all();
+
+    for (auto& thread : m_threads)
+        thread.join();
+}
+
+void ThreadPool::submit(std::function<void()> task)
+{
+    {
+        lock_guard<mutex> guard(m_lock);
+        m_tasks.push_back(move(task));
+    }
+    m_ready.notify_one();
+}
+
+void ThreadPool::work()
+{
+    for (;;)
+    {
+        function<void()> task;
+        {
+            unique_lock<mutex> guard(m_lock);
+            m_ready.wait(guard, [this] { return m_stopping || ! m_tasks.empty(); });
+            if (m_tasks.empty())
+                return;     // stopping, and nothing is left to do
+            task = move(m_tasks.front());
+            m_tasks.pop_front();
+        }
+        task();
+    }
+}
@@ -0,0 +1,218 @@
+#include "poi_index.h"
+#include "geodb.h"
+#include <string>
+#include <string_view>
+#include <vector>
+#include <algorithm>
+#include <numeric>
+#include <cctype>
+using namespace std;
+
+namespace
+{
+    // Lowercases ASCII letters, drops apostrophes, and turns other punctuation and runs of
+    // blanks into single spaces between words; bytes of UTF-8 sequences are kept as they are
+    string normalize(string_view text)
+    {
+        string normalized;
+        bool space = false;
+        for (char ch : text)
+        {
+            unsigned char c = static_cast<unsigned char>(ch);
+            if (c == '\'')
+                continue;
+            if (c >= 0x80 || isalnum(c))
+            {
+                if (space && ! normalized.empty())
+                    normalized += ' ';
+                normalized += static_cast<char>(tolower(c));
+                space = false;
+            }
+            else
+                space = true;
+        }
+        return normalized;
+    }
+
+    uint32_t trigram(const char* text)
+    {
+        return (static_cast<uint32_t>(static_cast<unsigned char>(text[0])) << 16) |
+            (static_cast<uint32_t>(static_cast<unsigned char>(text[1])) << 8) |
+            static_cast<unsigned char>(text[2]);
+    }
+
+    // The distinct trigrams of text with a space before it, so that a word's first letters make a trigram
+    // of their own, and after it unless it's a query, which may stop partway through a word
+    vector<uint32_t> trigrams_of(string_view text, bool query)
+    {
+        string padded = " " + string(text) + (query ? "" : " ");
+        vector<uint32_t> trigrams;
+        for (size_t i = 0; i + 3 <= padded.size(); i++)
+            trigrams.push_back(trigram(padded.data() + i));
+        sort(trigrams.begin(), trigrams.end());
+        trigrams.erase(unique(trigrams.begin(), trigrams.end()), trigrams.end());
+        return trigrams;
+    }
+
+    // The fewest edits turning query into some prefix of text, or max_edits + 1 if that's more than max_edits
+    int prefix_edit_distance(string_view query, string_view text, int max_edits)
+    {
+        // Levenshtein distance by rows over the query, keeping only the previous row
+        size_t length = min(text.size(), query.size() + max_edits);
+        vector<int> previous(length + 1), current(length + 1);
+        iota(previous.begin(), previous.end(), 0);
+        for (size_t i = 1; i <= query.size(); i++)
+        {
+            current[0] = static_cast<int>(i);
+            int rowMin = current[0];
+            for (size_t j = 1; j <= length; j++)
+            {
+                int substitution = previous[j - 1] + (query[i - 1] != text[j - 1]);
+                current[j] = min(substitution, min(previous[j], current[j - 1]) + 1);
+                rowMin = min(rowMin, current[j]);
+            }
+            if (rowMin > max_edits)
+                return max_edits + 1;   // every later row only gets worse
+            swap(previous, current);
+        }
+        return min(max_edits + 1, *min_element(previous.begin(), previous.end()));
+    }
+
+    bool starts_with(string_view text, string_view prefix)
+    {
+        return text.compare(0, prefix.size(), prefix) == 0;
+    }
+}
+
+PoiIndex::PoiIndex(const GeoDatabase& geodb) : m_geodb(geodb)
+{
+    uint32_t numPois = geodb.num_pois();
+    m_nameOffsets.reserve(numPois + 1);
+    m_nameOffsets.push_back(0);
+    for (uint32_t poi = 0; poi < numPois; poi++)
+    {
+        string normalized = normalize(geodb.poi_name(poi));
+        m_chars.insert(m_chars.end(), normalized.begin(), normalized.end());
+        m_nameOffsets.push_back(static_cast<uint32_t>(m_chars.size()));
+    }
+
+    m_names.resize(numPois);
+    iota(m_names.begin(), m_names.end(), 0);
+    sort(m_names.begin(), m_names.end(), [this](uint32_t lhs, uint32_t rhs) { return name(lhs) < name(rhs); });
+
+    vector<pair<uint32_t, uint32_t>> trigramPois;
+    for (uint32_t poi = 0; poi < numPois; poi++)
+    {
+        for (uint32_t i = m_nameOffsets[poi] + 1; i < m_nameOffsets[poi + 1]; i++)
+        {
+            if (m_chars[i - 1] == ' ')
+                m_words.push_back({poi, i});
+        }
+        for (uint32_t t : trigrams_of(name(poi), false))
+            trigramPois.emplace_back(t, poi);
+    }
+    sort(m_words.begin(), m_words.end(), [this](const WordStart& lhs, const WordStart& rhs) { return rest(lhs) < rest(rhs); });
+
+    // already distinct per POI, so sorting groups each trigram's POIs in order
+    sort(trigramPois.begin(), trigramPois.end());
+    for (const auto& entry : trigramPois)
+    {
+        if (m_trigrams.empty() || m_trigrams.back() != entry.first)
+        {
+            m_trigrams.push_back(entry.first);
+            m_trigramOffsets.push_back(static_cast<uint32_t>(m_postings.size()));
+        }
+        m_postings.push_back(entry.second);
+    }
+    m_trigramOffsets.push_back(static_cast<uint32_t>(m_postings.size()));
+}
+
+PoiIndex::~PoiIndex() {}
+
+std::string_view PoiIndex::name(uint32_t poi) const
+{
+    return string_view(m_chars.data() + m_nameOffsets[poi], m_nameOffsets[poi + 1] - m_nameOffsets[poi]);
+}
+
+std::string_view PoiIndex::rest(const WordStart& word) const
+{
+    return string_view(m_chars.data() + word.offset, m_nameOffsets[word.poi + 1] - word.offset);
+}
+
+std::vector<PoiMatch> PoiIndex::search(const std::string& query, size_t max_results, int max_edits) const
+{
+    vector<PoiMatch> matches;
+    string normalized = normalize(query);
+    if (normalized.empty() || max_results == 0)
+        return matches;
+
+    auto found = [&matches](uint32_t poi) {
+        return any_of(matches.begin(), matches.end(), [poi](const PoiMatch& match) { return match.poi == poi; });
+    };
+    auto add = [&](PoiMatch::Kind kind, uint32_t poi, int edits) {
+        matches.push_back({kind, poi, m_geodb.poi_name(poi), m_geodb.poi_node(poi), edits});
+    };
+
+    // names starting with the query, the exact match first since it sorts before its extensions
+    auto it = lower_bound(m_names.begin(), m_names.end(), normalized, [this](uint32_t poi, const string& q) { return name(poi) < q; });
+    for (; it != m_names.end() && matches.size() < max_results && starts_with(name(*it), normalized); ++it)
+        add(name(*it).size() == normalized.size() ? PoiMatch::EXACT : PoiMatch::PREFIX, *it, 0);
+
+    // then names with a later word starting with it
+    auto word = lower_bound(m_words.begin(), m_words.end(), normalized, [this](const WordStart& w, const string& q) { return rest(w) < q; });
+    for (; word != m_words.end() && matches.size() < max_results && starts_with(rest(*word), normalized); ++word)
+    {
+        if ( ! found(word->poi))
+            add(PoiMatch::WORD_PREFIX, word->poi, 0);
+    }
+
+    // An edit changes at most three of the query's trigrams, so a name within k edits of it
+    // shares all but 3k of them; short queries are allowed fewer edits so that bound still
+    // leaves a trigram to find candidates by
+    vector<uint32_t> queryTrigrams = trigrams_of(normalized, true);
+    int edits = min(max_edits, (static_cast<int>(queryTrigrams.size()) - 1) / 3);
+    if (matches.size() >= max_results || edits < 1)
+        return matches;
+    size_t needed = queryTrigrams.size() - 3 * edits;
+
+    vector<uint32_t> candidates;
+    for (uint32_t t : queryTrigrams)
+    {
+        auto entry = lower_bound(m_trigrams.begin(), m_trigrams.end(), t);
+        if (entry != m_trigrams.end() && *entry == t)
+        {
+            size_t i = entry - m_trigrams.begin();
+            candidates.insert(candidates.end(), m_postings.begin() + m_trigramOffsets[i], m_postings.begin() + m_trigramOffsets[i + 1]);
+        }
+    }
+    sort(candidates.begin(), candidates.end());
+
+    vector<PoiMatch> fuzzy;
+    for (size_t i = 0, j; i < candidates.size(); i = j)
+    {
+        for (j = i; j < candidates.size() && candidates[j] == candidates[i]; j++)
+            ;
+        uint32_t poi = candidates[i];
+        if (j - i < needed || found(poi))
+            continue;
+
+        // the query may be a misspelling of the start of any word of the name
+        string_view poiName = name(poi);
+        int best = edits + 1;
+        for (size_t start = 0; start < poiName.size() && best > 0; start++)
+        {
+            if (start == 0 || poiName[start - 1] == ' ')
+                best = min(best, prefix_edit_distance(normalized, poiName.substr(start), edits));
+        }
+        if (best <= edits)
+            fuzzy.push_back({PoiMatch::FUZZY, poi, m_geodb.poi_name(poi), m_geodb.poi_node(poi), best});
+    }
+
+    // fewest edits first, then in name order
+    sort(fuzzy.begin(), fuzzy.end(), [this](const PoiMatch& lhs, const PoiMatch& rhs) {
+        return lhs.edits != rhs.edits ? lhs.edits < rhs.edits : name(lhs.poi) < name(rhs.poi);
+    });
+    for (size_t i = 0; i < fuzzy.size() && matches.size() < max_results; i++)
+        matches.push_back(fuzzy[i]);
+    return matches;
+}
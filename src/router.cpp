@@ -1,109 +1,192 @@
 #include "router.h"
 #include "base_classes.h"
+#include "geodb.h"
 #include "geopoint.h"
-#include "geotools.h"
+#include "heuristic.h"
+#include "search_context.h"
+#include "search_stats.h"
 #include <vector>
-#include <unordered_map>
-#include <string>
-#include <queue>
-#include <unordered_set>
-#include <list>
-#include <cmath>
+#include <limits>
+#include <algorithm>
 using namespace std;
 
-Router::Router(const GeoDatabaseBase& geo_db) : m_geodb(geo_db) {}
+Router::Router(const GeoDatabase& geo_db, const Heuristic* heuristic)
+ : m_geodb(geo_db), m_greatCircle(geo_db), m_heuristic(heuristic != nullptr ? *heuristic : m_greatCircle) {}
 
 Router::~Router() {}
 
-// Use the A* search algorithm to find an optimal path from pt1 (start) to pt2 (end)
 std::vector<GeoPoint> Router::route(const GeoPoint& pt1, const GeoPoint& pt2) const
 {
+    vector<uint32_t> edges;
+    return route(pt1, pt2, edges);
+}
+
+std::vector<GeoPoint> Router::route(const GeoPoint& pt1, const GeoPoint& pt2, std::vector<uint32_t>& edges) const
+{
+    thread_local SearchContext context;     // reused by every search on this thread
+    return route(pt1, pt2, context, edges);
+}
+
+// Use the A* search algorithm to find an optimal path from pt1 (start) to pt2 (end)
+std::vector<GeoPoint> Router::route(const GeoPoint& pt1, const GeoPoint& pt2, SearchContext& context, std::vector<uint32_t>& edges) const
+{
+    edges.clear();
     // Minimize f(n) = g(n) + h(n)
-    // f(n) is the total cost of using a path with GeoPoint n
-    // g(n) is the cost of moving from the start GeoPoint to GeoPoint n
-    // h(n) is a heuristic function estimating the cost of moving from GeoPoint n to the end GeoPoint
+    // f(n) is the total cost of using a path with node n
+    // g(n) is the cost of moving from the start node to node n
+    // h(n) is a heuristic function estimating the cost of moving from node n to the end node
     
-    // openSet contains (pairs of) GeoPoints along with their fScores
-    // This uses a min heap priority queue to easily access the GeoPoint with the smallest fScore
-    // At first, only the start GeoPoint's fScore is known
-    priority_queue<pair<GeoPoint, double>, vector<pair<GeoPoint, double>>, greater<>> openSet;
-    openSet.push(pair(pt1, heuristic(pt1, pt2)));
+    uint32_t start;
+    uint32_t end;
+    if ( ! m_geodb.get_node_id(pt1, start) || ! m_geodb.get_node_id(pt2, end))
+        return std::vector<GeoPoint>();     // start or end GeoPoint is not on the map
     
-    // geoPoints contains the GeoPoints found in openSet. This is so GeoPoints other than openSet.top() can be accessed
-    unordered_set<string> geoPoints;
-    geoPoints.insert(pt1.to_string());
-
-    // previousMap maps a given GeoPoint to the GeoPoint immediately before it on a path
-    unordered_map<string, GeoPoint> previousMap;
-
-    // gScoreMap maps a given GeoPoint to its gScore
-    // DoubleWrapper is an object that, when default constructed, contains the maximum value a double can hold
-    unordered_map<string, DoubleWrapper> gScoreMap;
-    gScoreMap[pt1.to_string()] = DoubleWrapper(0);
-
-    // fScoreMap maps a given GeoPoint to its fScore
-    unordered_map<string, DoubleWrapper> fScoreMap;
-    fScoreMap[pt1.to_string()] = DoubleWrapper(heuristic(pt1, pt2));
-
-    while ( ! openSet.empty())
+    // The context's open set is a min heap of nodes keyed by fScore, so the node with
+    // the smallest fScore is always next; every node is in it at most once
+    // At first, only the start node's fScore is known
+    context.reset(m_geodb.num_nodes());
+    SearchRecorder recorder(context);
+    context.relax(start, 0, NO_NODE, m_heuristic.estimate(start, end));
+    
+    while ( ! context.open_empty())
     {
-        auto current = openSet.top();   // current is a pair with the GeoPoint with the lowest fScore
-        if (isAtEnd(current.first, pt2))
-            return reconstructPath(previousMap, current.first);
+        uint32_t current = context.pop_min();   // the node with the lowest fScore, now closed
+        m_geodb.touch_node(current);
+        if (current == end)
+        {
+            vector<uint32_t> nodes;
+            reconstructPath(context, end, nodes);
+            return pathPoints(m_geodb, nodes, edges);
+        }
         
-        openSet.pop();
-        geoPoints.erase(current.first.to_string());
-        for (const auto& neighbor : m_geodb.get_connected_points(current.first))
+        double currentGScore = context.g_score(current);
+        context.count_scanned(m_geodb.edges_end(current) - m_geodb.edges_begin(current));
+        for (uint32_t e = m_geodb.edges_begin(current); e < m_geodb.edges_end(current); e++)
         {
-            // tentativeGScore is the cost of moving from the start GeoPoint to the neighbor GeoPoint through the current GeoPoint
-            double tentativeGScore = gScoreMap[current.first.to_string()].m_d + distance_earth_miles(current.first, neighbor);
-            if (tentativeGScore < gScoreMap[neighbor.to_string()].m_d)
+            uint32_t neighbor = m_geodb.edge_target(e);
+            
+            // tentativeGScore is the cost of moving from the start node to the neighbor node through the current node
+            double tentativeGScore = currentGScore + m_geodb.edge_length(e);
+            if (tentativeGScore < context.g_score(neighbor))
             {
-                // This path to the neighbor GeoPoint is better than any previous path
-                previousMap[neighbor.to_string()] = current.first;
-                gScoreMap[neighbor.to_string()] = DoubleWrapper(tentativeGScore);
-                fScoreMap[neighbor.to_string()] = DoubleWrapper(tentativeGScore + heuristic(neighbor, pt2));
-                if (geoPoints.find(neighbor.to_string()) == geoPoints.end())    // not found
-                {
-                    openSet.push(pair(neighbor, fScoreMap[neighbor.to_string()].m_d));
-                    geoPoints.insert(neighbor.to_string());
-                }
+                // This path to the neighbor node is better than any previous path,
+                // so add the neighbor to the open set or lower its fScore there
+                double fScore = tentativeGScore + m_heuristic.estimate(neighbor, end);
+                context.relax(neighbor, tentativeGScore, current, fScore);
             }
         }
     }
         
-    // openSet is empty but a path to the end GeoPoint was never found, so return an empty vector
+    // the open set is empty but a path to the end node was never found, so return an empty vector
     return std::vector<GeoPoint>();
 }
 
-DoubleWrapper::DoubleWrapper(double d) : m_d(d) {}
+BidirectionalRouter::BidirectionalRouter(const GeoDatabase& geo_db, const Heuristic* heuristic)
+ : m_geodb(geo_db), m_greatCircle(geo_db), m_heuristic(heuristic != nullptr ? *heuristic : m_greatCircle) {}
+
+BidirectionalRouter::~BidirectionalRouter() {}
+
+std::vector<GeoPoint> BidirectionalRouter::route(const GeoPoint& pt1, const GeoPoint& pt2) const
+{
+    vector<uint32_t> edges;
+    return route(pt1, pt2, edges);
+}
 
-bool operator>(const std::pair<GeoPoint, double>& lhs, const std::pair<GeoPoint, double>& rhs)
+std::vector<GeoPoint> BidirectionalRouter::route(const GeoPoint& pt1, const GeoPoint& pt2, std::vector<uint32_t>& edges) const
 {
-    return (lhs.second > rhs.second);
+    thread_local SearchContext forward;     // reused by every search on this thread
+    thread_local SearchContext backward;
+    return route(pt1, pt2, forward, backward, edges);
 }
 
-std::vector<GeoPoint> reconstructPath(std::unordered_map<std::string, GeoPoint>& previousMap, const GeoPoint& end)
+std::vector<GeoPoint> BidirectionalRouter::route(const GeoPoint& pt1, const GeoPoint& pt2, SearchContext& forward, SearchContext& backward,
+                                                 std::vector<uint32_t>& edges) const
 {
-    GeoPoint current = end;
-    list<GeoPoint> pathList;    // using a list allows for efficient prepending
-    pathList.push_front(current);
+    edges.clear();
+    uint32_t start;
+    uint32_t end;
+    if ( ! m_geodb.get_node_id(pt1, start) || ! m_geodb.get_node_id(pt2, end))
+        return std::vector<GeoPoint>();     // start or end GeoPoint is not on the map
+    
+    // The forward potential of node n; the backward potential is its negation
+    // A path's length is then the forward fScore plus the backward fScore of any node on it
+    auto potential = [&](uint32_t n) { return (m_heuristic.estimate(n, end) - m_heuristic.estimate(n, start)) / 2; };
+    
+    forward.reset(m_geodb.num_nodes());
+    backward.reset(m_geodb.num_nodes());
+    SearchRecorder forwardRecorder(forward);
+    SearchRecorder backwardRecorder(backward);
+    forward.relax(start, 0, NO_NODE, potential(start));
+    backward.relax(end, 0, NO_NODE, -potential(end));
+    
+    // the shortest path found so far goes through the meeting node
+    double best = (start == end) ? 0 : numeric_limits<double>::infinity();
+    uint32_t meeting = (start == end) ? start : NO_NODE;
     
-    while (previousMap.find(current.to_string()) != previousMap.end())  // found
+    while ( ! forward.open_empty() && ! backward.open_empty())
     {
-        current = previousMap[current.to_string()];
-        pathList.push_front(current);
+        // every path not found yet is at least as long as the two smallest fScores together
+        if (forward.min_f_score() + backward.min_f_score() >= best)
+            break;
+        
+        // advance the direction whose next node has the lower fScore
+        bool isForward = (forward.min_f_score() <= backward.min_f_score());
+        SearchContext& search = isForward ? forward : backward;
+        const SearchContext& other = isForward ? backward : forward;
+        double sign = isForward ? 1 : -1;
+        
+        uint32_t current = search.pop_min();
+        m_geodb.touch_node(current);
+        double currentGScore = search.g_score(current);
+        search.count_scanned(m_geodb.edges_end(current) - m_geodb.edges_begin(current));
+        for (uint32_t e = m_geodb.edges_begin(current); e < m_geodb.edges_end(current); e++)
+        {
+            uint32_t neighbor = m_geodb.edge_target(e);
+            double tentativeGScore = currentGScore + m_geodb.edge_length(e);
+            if (tentativeGScore < search.g_score(neighbor))
+            {
+                search.relax(neighbor, tentativeGScore, current, tentativeGScore + sign * potential(neighbor));
+                
+                // the neighbor joins this search's path to one the other search has found
+                if (tentativeGScore + other.g_score(neighbor) < best)
+                {
+                    best = tentativeGScore + other.g_score(neighbor);
+                    meeting = neighbor;
+                }
+            }
+        }
     }
-
-    return vector<GeoPoint>(pathList.begin(), pathList.end());  // construct a vector of GeoPoints from a list of GeoPoints
+    
+    if (meeting == NO_NODE)
+        return std::vector<GeoPoint>();     // the searches never met, so no route is possible
+    
+    // the forward search's path up to the meeting node, then the backward search's path on to the end
+    vector<uint32_t> nodes;
+    reconstructPath(forward, meeting, nodes);
+    for (uint32_t current = backward.previous(meeting); current != NO_NODE; current = backward.previous(current))
+        nodes.push_back(current);
+    return pathPoints(m_geodb, nodes, edges);
 }
 
-double heuristic(const GeoPoint& current, const GeoPoint& end)
+void reconstructPath(const SearchContext& context, uint32_t end, std::vector<uint32_t>& nodes)
 {
-    return (abs(current.latitude - end.latitude) + abs(current.longitude - end.longitude));
+    size_t first = nodes.size();
+    for (uint32_t current = end; current != NO_NODE; current = context.previous(current))
+        nodes.push_back(current);
+    
+    reverse(nodes.begin() + first, nodes.end());    // the path was built from the end back to the start
 }
 
-bool isAtEnd(const GeoPoint& current, const GeoPoint& end)
+std::vector<GeoPoint> pathPoints(const GeoDatabase& geodb, const std::vector<uint32_t>& nodes, std::vector<uint32_t>& edges)
 {
-    return (current.sLatitude == end.sLatitude && current.sLongitude == end.sLongitude);
+    vector<GeoPoint> path;
+    path.reserve(nodes.size());
+    edges.clear();
+    for (size_t i = 0; i < nodes.size(); i++)
+    {
+        path.push_back(geodb.get_node_point(nodes[i]));
+        if (i + 1 < nodes.size())
+            edges.push_back(geodb.find_edge(nodes[i], nodes[i + 1]));
+    }
+    return path;
 }
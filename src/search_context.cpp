@@ -0,0 +1,126 @@
+#include "search_context.h"
+#include <vector>
+#include <algorithm>
+using namespace std;
+
+SearchContext::SearchContext()
+ : m_generation(0), m_numClosed(0), m_numPushes(0), m_numDecreases(0), m_numReopened(0), m_numScanned(0) {}
+
+void SearchContext::reset(uint32_t numNodes)
+{
+    if (m_stamp.size() < numNodes)
+    {
+        // new nodes get stamp 0, which no search uses
+        m_stamp.resize(numNodes, 0);
+        m_gScore.resize(numNodes);
+        m_previous.resize(numNodes);
+        m_heapPos.resize(numNodes);
+    }
+
+    m_generation++;
+    if (m_generation == 0)  // the generation wrapped around, so old stamps could look current
+    {
+        fill(m_stamp.begin(), m_stamp.end(), 0);
+        m_generation = 1;
+    }
+
+    m_heap.clear();
+    m_numClosed = 0;
+    m_numPushes = 0;
+    m_numDecreases = 0;
+    m_numReopened = 0;
+    m_numScanned = 0;
+}
+
+void SearchContext::relax(uint32_t node, double gScore, uint32_t previous, double fScore)
+{
+    bool inHeap = is_reached(node) && m_heapPos[node] != CLOSED;
+    m_numReopened += is_reached(node) && ! inHeap;
+
+    m_stamp[node] = m_generation;
+    m_gScore[node] = gScore;
+    m_previous[node] = previous;
+
+    if (inHeap)     // already in the open set, so lower its fScore in place
+    {
+        m_numDecreases++;
+        sift_up(m_heapPos[node], HeapEntry{fScore, node});
+    }
+    else
+    {
+        m_numPushes++;
+        m_heap.push_back(HeapEntry{fScore, node});
+        sift_up(static_cast<uint32_t>(m_heap.size() - 1), HeapEntry{fScore, node});
+    }
+}
+
+uint32_t SearchContext::pop_min()
+{
+    uint32_t node = m_heap[0].node;
+    m_heapPos[node] = CLOSED;
+    m_numClosed++;
+
+    HeapEntry last = m_heap.back();
+    m_heap.pop_back();
+    if ( ! m_heap.empty())
+        sift_down(0, last);
+
+    return node;
+}
+
+SearchStats SearchContext::stats() const
+{
+    SearchStats stats;
+    stats.nodesExpanded = m_numClosed;
+    stats.heapPushes = m_numPushes;
+    stats.heapDecreases = m_numDecreases;
+    stats.nodesReopened = m_numReopened;
+    stats.edgesScanned = m_numScanned;
+    return stats;
+}
+
+// Moves an entry from pos toward the root until its parent's fScore is no higher
+void SearchContext::sift_up(uint32_t pos, HeapEntry entry)
+{
+    while (pos > 0)
+    {
+        uint32_t parent = (pos - 1) / ARITY;
+        if (m_heap[parent].fScore <= entry.fScore)
+            break;
+
+        m_heap[pos] = m_heap[parent];
+        m_heapPos[m_heap[pos].node] = pos;
+        pos = parent;
+    }
+
+    m_heap[pos] = entry;
+    m_heapPos[entry.node] = pos;
+}
+
+// Moves an entry from pos toward the leaves until no child's fScore is lower
+void SearchContext::sift_down(uint32_t pos, HeapEntry entry)
+{
+    uint32_t size = static_cast<uint32_t>(m_heap.size());
+    for (;;)
+    {
+        uint32_t firstChild = pos * ARITY + 1;
+        if (firstChild >= size)
+            break;
+
+        uint32_t best = firstChild;
+        uint32_t lastChild = min(firstChild + ARITY, size);
+        for (uint32_t child = firstChild + 1; child < lastChild; child++)
+            if (m_heap[child].fScore < m_heap[best].fScore)
+                best = child;
+
+        if (m_heap[best].fScore >= entry.fScore)
+            break;
+
+        m_heap[pos] = m_heap[best];
+        m_heapPos[m_heap[pos].node] = pos;
+        pos = best;
+    }
+
+    m_heap[pos] = entry;
+    m_heapPos[entry.node] = pos;
+}
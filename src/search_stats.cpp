@@ -0,0 +1,149 @@
+#include "search_stats.h"
+#include "search_context.h"
+#include <string>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <algorithm>
+#include <iostream>
+using namespace std;
+
+namespace
+{
+    // Every counter, in the order they are printed
+    const pair<const char*, uint64_t SearchStats::*> COUNTERS[] = {
+        {"searches", &SearchStats::searches},
+        {"nodes_expanded", &SearchStats::nodesExpanded},
+        {"heap_pushes", &SearchStats::heapPushes},
+        {"heap_decreases", &SearchStats::heapDecreases},
+        {"nodes_reopened", &SearchStats::nodesReopened},
+        {"edges_scanned", &SearchStats::edgesScanned},
+        {"node_lookups", &SearchStats::nodeLookups},
+        {"neighbor_fetches", &SearchStats::neighborFetches},
+        {"street_lookups", &SearchStats::streetLookups},
+        {"search_ns", &SearchStats::searchNanos},
+    };
+    const size_t NUM_COUNTERS = sizeof(COUNTERS) / sizeof(COUNTERS[0]);
+
+    // A thread's totals, which other threads read while it adds to them
+    // Only the owning thread writes, so adding is a relaxed load and store rather than a locked add
+    struct ThreadCounters
+    {
+        atomic<uint64_t> values[NUM_COUNTERS];
+
+        ThreadCounters();
+        ~ThreadCounters();
+
+        SearchStats read() const
+        {
+            SearchStats stats;
+            for (size_t i = 0; i < NUM_COUNTERS; i++)
+                stats.*COUNTERS[i].second = values[i].load(memory_order_relaxed);
+            return stats;
+        }
+    };
+
+    // The counters of running threads, and the totals of finished ones
+    mutex registryLock;
+    vector<const ThreadCounters*> running;
+    SearchStats finished;
+
+    ThreadCounters::ThreadCounters()
+    {
+        for (auto& value : values)
+            value.store(0, memory_order_relaxed);
+        lock_guard<mutex> guard(registryLock);
+        running.push_back(this);
+    }
+
+    ThreadCounters::~ThreadCounters()
+    {
+        lock_guard<mutex> guard(registryLock);
+        finished += read();
+        running.erase(find(running.begin(), running.end(), this));
+    }
+
+    ThreadCounters& thread_counters()
+    {
+        thread_local ThreadCounters counters;
+        return counters;
+    }
+}
+
+SearchStats& SearchStats::operator+=(const SearchStats& other)
+{
+    for (const auto& counter : COUNTERS)
+        this->*counter.second += other.*counter.second;
+    return *this;
+}
+
+SearchStats SearchStats::operator-(const SearchStats& other) const
+{
+    SearchStats difference = *this;
+    for (const auto& counter : COUNTERS)
+        difference.*counter.second -= other.*counter.second;
+    return difference;
+}
+
+void SearchStats::print(std::ostream& out, const std::string& indent) const
+{
+    for (const auto& counter : COUNTERS)
+        out << indent << counter.first << ": " << this->*counter.second << "\n";
+}
+
+void SearchStats::write_json(std::string& out) const
+{
+    out += '{';
+    for (size_t i = 0; i < NUM_COUNTERS; i++)
+    {
+        out += (i == 0) ? "\"" : ",\"";
+        out += COUNTERS[i].first;
+        out += "\":" + to_string(this->*COUNTERS[i].second);
+    }
+    out += '}';
+}
+
+SearchStats thread_search_stats()
+{
+    return thread_counters().read();
+}
+
+SearchStats process_search_stats()
+{
+    lock_guard<mutex> guard(registryLock);
+    SearchStats total = finished;
+    for (const ThreadCounters* counters : running)
+        total += counters->read();
+    return total;
+}
+
+void count_search_stats(const SearchStats& stats)
+{
+    ThreadCounters& counters = thread_counters();
+    for (size_t i = 0; i < NUM_COUNTERS; i++)
+    {
+        uint64_t add = stats.*COUNTERS[i].second;
+        if (add != 0)
+            counters.values[i].store(counters.values[i].load(memory_order_relaxed) + add, memory_order_relaxed);
+    }
+}
+
+void count_search_stat(uint64_t SearchStats::* counter, uint64_t amount)
+{
+    ThreadCounters& counters = thread_counters();
+    for (size_t i = 0; i < NUM_COUNTERS; i++)
+    {
+        if (COUNTERS[i].second == counter)
+            counters.values[i].store(counters.values[i].load(memory_order_relaxed) + amount, memory_order_relaxed);
+    }
+}
+
+SearchRecorder::SearchRecorder(const SearchContext& context) : m_context(context), m_start(chrono::steady_clock::now()) {}
+
+SearchRecorder::~SearchRecorder()
+{
+    SearchStats stats = m_context.stats();
+    stats.searches = 1;
+    stats.searchNanos = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - m_start).count();
+    count_search_stats(stats);
+}
@@ -0,0 +1,374 @@
+#include "spatial_index.h"
+#include "geodb.h"
+#include "geopoint.h"
+#include <vector>
+#include <string>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <memory>
+#include <mutex>
+using namespace std;
+
+namespace
+{
+    const double EARTH_RADIUS_MILES = 3958.8;
+    const double MILES_PER_DEGREE = EARTH_RADIUS_MILES * M_PI / 180;
+    const double NODES_PER_CELL = 4;
+
+    // the distance from p to the segment a-b, and how far along it the nearest point is
+    double distance_to_segment(double px, double py, double ax, double ay, double bx, double by, double& fraction)
+    {
+        double dx = bx - ax;
+        double dy = by - ay;
+        double lengthSquared = dx * dx + dy * dy;
+        fraction = 0;
+        if (lengthSquared > 0)
+            fraction = min(1.0, max(0.0, ((px - ax) * dx + (py - ay) * dy) / lengthSquared));
+        return hypot(px - (ax + fraction * dx), py - (ay + fraction * dy));
+    }
+
+    // turns per-cell counts into offsets, leaving each cell's offset at its start
+    void counts_to_offsets(vector<uint32_t>& offsets)
+    {
+        uint32_t total = 0;
+        for (auto& offset : offsets)
+        {
+            uint32_t count = offset;
+            offset = total;
+            total += count;
+        }
+    }
+}
+
+SpatialIndex::SpatialIndex(const GeoDatabase& geodb)
+ : m_geodb(geodb)
+{
+    if (geodb.is_tiled())
+        m_tileGrids.resize(geodb.num_tiles());
+    else
+        m_grid = make_unique<Grid>(geodb, 0, geodb.num_nodes());
+}
+
+SpatialIndex::~SpatialIndex() {}
+
+// The grids that cover everything within a tile of a point, building any not built yet
+std::vector<const SpatialIndex::Grid*> SpatialIndex::grids_around(const GeoPoint& pt) const
+{
+    if (m_grid)
+        return vector<const Grid*>(1, m_grid.get());
+
+    vector<const Grid*> grids;
+    for (uint32_t tile : m_geodb.tiles_around(pt))
+    {
+        lock_guard<mutex> guard(m_lock);
+        if ( ! m_tileGrids[tile])
+            m_tileGrids[tile] = make_unique<Grid>(m_geodb, m_geodb.tile_first_node(tile), m_geodb.tile_end_node(tile));
+        grids.push_back(m_tileGrids[tile].get());
+    }
+    return grids;
+}
+
+bool SpatialIndex::nearest_node(const GeoPoint& pt, uint32_t& node) const
+{
+    double best = numeric_limits<double>::infinity();
+    for (const Grid* grid : grids_around(pt))
+    {
+        uint32_t found;
+        double distance;
+        if (grid->nearest_node(pt, found, distance) && distance < best)
+        {
+            best = distance;
+            node = found;
+        }
+    }
+    return best != numeric_limits<double>::infinity();
+}
+
+bool SpatialIndex::nearest_segment(const GeoPoint& pt, SegmentMatch& match) const
+{
+    bool found = false;
+    for (const Grid* grid : grids_around(pt))
+    {
+        SegmentMatch candidate;
+        if (grid->nearest_segment(pt, candidate) && ( ! found || candidate.distance < match.distance))
+        {
+            match = candidate;
+            found = true;
+        }
+    }
+    return found;
+}
+
+SpatialIndex::Grid::Grid(const GeoDatabase& geodb, uint32_t first, uint32_t end)
+ : m_geodb(geodb), m_centerLat(0), m_centerLon(0), m_lonScale(MILES_PER_DEGREE), m_first(first),
+   m_minX(0), m_minY(0), m_cellSize(1), m_cols(1), m_rows(1)
+{
+    uint32_t numNodes = end - first;
+    if (numNodes > 0)
+    {
+        int32_t minLat = numeric_limits<int32_t>::max(), maxLat = numeric_limits<int32_t>::min();
+        int32_t minLon = numeric_limits<int32_t>::max(), maxLon = numeric_limits<int32_t>::min();
+        for (uint32_t u = first; u < end; u++)
+        {
+            const GeoCoord& coord = geodb.get_node_coord(u);
+            minLat = min(minLat, coord.lat);
+            maxLat = max(maxLat, coord.lat);
+            minLon = min(minLon, coord.lon);
+            maxLon = max(maxLon, coord.lon);
+        }
+        m_centerLat = (static_cast<double>(minLat) + maxLat) / 2 * 1e-7;
+        m_centerLon = (static_cast<double>(minLon) + maxLon) / 2 * 1e-7;
+        m_lonScale = MILES_PER_DEGREE * cos(m_centerLat * M_PI / 180);
+    }
+
+    m_points.resize(numNodes);
+    double maxX = 0, maxY = 0;
+    for (uint32_t u = 0; u < numNodes; u++)
+    {
+        const GeoCoord& coord = geodb.get_node_coord(first + u);
+        m_points[u] = project(coord.latitude(), coord.longitude());
+        if (u == 0)
+        {
+            m_minX = maxX = m_points[u].x;
+            m_minY = maxY = m_points[u].y;
+        }
+        m_minX = min(m_minX, m_points[u].x);
+        m_minY = min(m_minY, m_points[u].y);
+        maxX = max(maxX, m_points[u].x);
+        maxY = max(maxY, m_points[u].y);
+    }
+
+    // square cells sized so each holds a few nodes on average
+    double width = maxX - m_minX;
+    double height = maxY - m_minY;
+    double area = max(width * height, 1e-12);
+    m_cellSize = max(sqrt(area * NODES_PER_CELL / max(numNodes, 1u)), 1e-6);
+    m_cols = max(1, static_cast<int>(width / m_cellSize) + 1);
+    m_rows = max(1, static_cast<int>(height / m_cellSize) + 1);
+    size_t numCells = static_cast<size_t>(m_cols) * m_rows;
+
+    // bucket the nodes by cell
+    m_nodeOffsets.assign(numCells + 1, 0);
+    vector<uint32_t> nodeCells(numNodes);
+    for (uint32_t u = 0; u < numNodes; u++)
+    {
+        nodeCells[u] = static_cast<uint32_t>(row(m_points[u].y)) * m_cols + column(m_points[u].x);
+        m_nodeOffsets[nodeCells[u]]++;
+    }
+    counts_to_offsets(m_nodeOffsets);
+    m_cellNodes.resize(numNodes);
+    vector<uint32_t> next(m_nodeOffsets.begin(), m_nodeOffsets.end() - 1);
+    for (uint32_t u = 0; u < numNodes; u++)
+        m_cellNodes[next[nodeCells[u]]++] = first + u;
+
+    // the far ends of segments leaving the grid, whose tiles are read in for their positions
+    for (uint32_t u = first; u < end; u++)
+    {
+        for (uint32_t e = geodb.edges_begin(u); e < geodb.edges_end(u); e++)
+        {
+            uint32_t v = geodb.edge_target(e);
+            if ((v < first || v >= end) && m_outside.find(v) == nullptr)
+            {
+                geodb.touch_node(v);
+                m_outside.insert(v, project(geodb.get_node_coord(v).latitude(), geodb.get_node_coord(v).longitude()));
+            }
+        }
+    }
+
+    // bucket each segment into every cell its bounding box overlaps
+    // Streets run both ways, so a segment is indexed once, by its edge from the lower ID,
+    // unless it leaves the grid, when it's indexed from the end in the grid
+    m_segmentOffsets.assign(numCells + 1, 0);
+    for (int pass = 0; pass < 2; pass++)
+    {
+        for (uint32_t u = first; u < end; u++)
+        {
+            for (uint32_t e = geodb.edges_begin(u); e < geodb.edges_end(u); e++)
+            {
+                uint32_t v = geodb.edge_target(e);
+                if (v < u && v >= first)
+                    continue;
+                const Point& a = point(u);
+                const Point& b = point(v);
+                int col1 = column(min(a.x, b.x));
+                int col2 = column(max(a.x, b.x));
+                int row1 = row(min(a.y, b.y));
+                int row2 = row(max(a.y, b.y));
+                for (int r = row1; r <= row2; r++)
+                {
+                    for (int c = col1; c <= col2; c++)
+                    {
+                        size_t cell = static_cast<size_t>(r) * m_cols + c;
+                        if (pass == 0)
+                            m_segmentOffsets[cell]++;
+                        else
+                            m_cellSegments[next[cell]++] = {u, e};
+                    }
+                }
+            }
+        }
+        if (pass == 0)
+        {
+            counts_to_offsets(m_segmentOffsets);
+            m_cellSegments.resize(m_segmentOffsets.back());
+            next.assign(m_segmentOffsets.begin(), m_segmentOffsets.end() - 1);
+        }
+    }
+}
+
+SpatialIndex::Point SpatialIndex::Grid::project(double latitude, double longitude) const
+{
+    return {(longitude - m_centerLon) * m_lonScale, (latitude - m_centerLat) * MILES_PER_DEGREE};
+}
+
+const SpatialIndex::Point& SpatialIndex::Grid::point(uint32_t node) const
+{
+    if (node - m_first < m_points.size())
+        return m_points[node - m_first];
+    return *m_outside.find(node);
+}
+
+int SpatialIndex::Grid::column(double x) const
+{
+    return min(m_cols - 1, max(0, static_cast<int>(floor((x - m_minX) / m_cellSize))));
+}
+
+int SpatialIndex::Grid::row(double y) const
+{
+    return min(m_rows - 1, max(0, static_cast<int>(floor((y - m_minY) / m_cellSize))));
+}
+
+template <typename Visit>
+void SpatialIndex::Grid::search_rings(const Point& p, const double& best, Visit visit) const
+{
+    int col = column(p.x);
+    int r0 = row(p.y);
+    int maxRadius = max(max(col, m_cols - 1 - col), max(r0, m_rows - 1 - r0));
+    for (int radius = 0; radius <= maxRadius; radius++)
+    {
+        int col1 = col - radius, col2 = col + radius;
+        int row1 = r0 - radius, row2 = r0 + radius;
+        for (int r = max(row1, 0); r <= min(row2, m_rows - 1); r++)
+        {
+            // only the ring's edge cells are new: whole rows at the top and bottom, the two ends of the others
+            int step = (r == row1 || r == row2) ? 1 : col2 - col1;
+            for (int c = col1; c <= col2; c += max(step, 1))
+            {
+                if (c >= 0 && c < m_cols)
+                    visit(static_cast<size_t>(r) * m_cols + c);
+            }
+        }
+
+        // everything outside the block of cells searched so far is at least this far away,
+        // which is 0 if the point is outside the block, as it can be when it's off the map
+        double margin = min(min(p.x - (m_minX + col1 * m_cellSize), m_minX + (col2 + 1) * m_cellSize - p.x),
+                            min(p.y - (m_minY + row1 * m_cellSize), m_minY + (row2 + 1) * m_cellSize - p.y));
+        if (best <= margin)
+            break;
+    }
+}
+
+bool SpatialIndex::Grid::nearest_node(const GeoPoint& pt, uint32_t& node, double& best) const
+{
+    if (m_points.empty())
+        return false;
+
+    Point p = project(pt.latitude, pt.longitude);
+    best = numeric_limits<double>::infinity();
+    search_rings(p, best, [&](size_t cell)
+    {
+        for (uint32_t i = m_nodeOffsets[cell]; i < m_nodeOffsets[cell + 1]; i++)
+        {
+            uint32_t u = m_cellNodes[i];
+            double distance = hypot(p.x - point(u).x, p.y - point(u).y);
+            if (distance < best)
+            {
+                best = distance;
+                node = u;
+            }
+        }
+    });
+    return true;
+}
+
+bool SpatialIndex::Grid::nearest_segment(const GeoPoint& pt, SegmentMatch& match) const
+{
+    if (m_cellSegments.empty())
+        return false;
+
+    Point p = project(pt.latitude, pt.longitude);
+    double best = numeric_limits<double>::infinity();
+    search_rings(p, best, [&](size_t cell)
+    {
+        for (uint32_t i = m_segmentOffsets[cell]; i < m_segmentOffsets[cell + 1]; i++)
+        {
+            uint32_t u = m_cellSegments[i].from;
+            uint32_t e = m_cellSegments[i].edge;
+            uint32_t v = m_geodb.edge_target(e);
+            double fraction;
+            double distance = distance_to_segment(p.x, p.y, point(u).x, point(u).y,
+                point(v).x, point(v).y, fraction);
+            if (distance < best)
+            {
+                best = distance;
+                match.edge = e;
+                match.from = u;
+                match.to = v;
+                match.fraction = fraction;
+                match.distance = distance;
+            }
+        }
+    });
+    return true;
+}
+
+string SpatialIndex::street_at(const GeoPoint& pt, double max_miles) const
+{
+    SegmentMatch match;
+    if ( ! nearest_segment(pt, match) || match.distance > max_miles)
+        return "";
+    return string(m_geodb.street_name(m_geodb.edge_street(match.edge)));
+}
+
+SnappingRouter::SnappingRouter(const RouterBase& router, const GeoDatabase& geodb, const SpatialIndex& index, double max_snap_miles)
+ : m_router(router), m_edgeRouter(dynamic_cast<const EdgeRouter*>(&router)), m_geodb(geodb), m_index(index),
+   m_maxSnapMiles(max_snap_miles) {}
+
+SnappingRouter::~SnappingRouter() {}
+
+vector<GeoPoint> SnappingRouter::route(const GeoPoint& pt1, const GeoPoint& pt2) const
+{
+    GeoPoint start, end;
+    if ( ! snap(pt1, start) || ! snap(pt2, end))
+        return vector<GeoPoint>();
+    return m_router.route(start, end);
+}
+
+vector<GeoPoint> SnappingRouter::route(const GeoPoint& pt1, const GeoPoint& pt2, vector<uint32_t>& edges) const
+{
+    edges.clear();
+    GeoPoint start, end;
+    if ( ! snap(pt1, start) || ! snap(pt2, end))
+        return vector<GeoPoint>();
+    return (m_edgeRouter != nullptr) ? m_edgeRouter->route(start, end, edges) : m_router.route(start, end);
+}
+
+bool SnappingRouter::snap(const GeoPoint& pt, GeoPoint& snapped) const
+{
+    uint32_t node;
+    if (m_geodb.get_node_id(pt, node))
+    {
+        snapped = pt;
+        return true;
+    }
+
+    // the nearest node may be on another street than the one the point is on,
+    // so snap to the street first; every node of the map is on a street
+    SegmentMatch match;
+    if ( ! m_index.nearest_segment(pt, match) || match.distance > m_maxSnapMiles)
+        return false;   // off the map
+    node = match.fraction <= 0.5 ? match.from : match.to;
+    snapped = m_geodb.get_node_point(node);
+    return true;
+}
@@ -0,0 +1,186 @@
+#include "stop_order.h"
+#include "parallel.h"
+#include <vector>
+#include <chrono>
+#include <random>
+#include <limits>
+#include <numeric>
+#include <algorithm>
+using namespace std;
+
+// A worker gives up after this many kicks in a row per stop fail to find a shorter order
+const int KICKS_PER_STOP = 20;
+
+// An order of stops being improved by one worker
+class LocalSearch
+{
+public:
+    LocalSearch(const vector<double>& distances, int n, int last)
+     : m_distances(distances), m_n(n), m_last(last), m_forward(n), m_backward(n) {}
+
+    // the distance from stop a to stop b
+    double d(int a, int b) const { return m_distances[static_cast<size_t>(a) * m_n + b]; }
+
+    double cost(const vector<int>& order) const
+    {
+        double total = 0;
+        for (int k = 0; k + 1 < m_n; k++)
+            total += d(order[k], order[k + 1]);
+        return total;
+    }
+
+    // Applies improving 2-opt and Or-opt moves until there are none
+    void improve(vector<int>& order, chrono::steady_clock::time_point deadline)
+    {
+        for (bool improved = true; improved && chrono::steady_clock::now() < deadline; )
+            improved = two_opt(order) || or_opt(order);
+    }
+private:
+    const vector<double>& m_distances;
+    int m_n;
+    int m_last;     // the last position that can be reordered
+    vector<double> m_forward;   // m_forward[k] is the length of the order up to position k
+    vector<double> m_backward;  // ... and m_backward[k] of the same stops in reverse
+
+    // Reverses the first improving segment order[i..j] it finds
+    bool two_opt(vector<int>& order)
+    {
+        // prefix sums in both directions make a reversed segment's length O(1), even if
+        // distances aren't symmetric
+        for (int k = 1; k < m_n; k++)
+        {
+            m_forward[k] = m_forward[k - 1] + d(order[k - 1], order[k]);
+            m_backward[k] = m_backward[k - 1] + d(order[k], order[k - 1]);
+        }
+
+        for (int i = 1; i < m_last; i++)
+        {
+            for (int j = i + 1; j <= m_last; j++)
+            {
+                double delta = d(order[i - 1], order[j]) - d(order[i - 1], order[i]) +
+                    (m_backward[j] - m_backward[i]) - (m_forward[j] - m_forward[i]);
+                if (j + 1 < m_n)
+                    delta += d(order[i], order[j + 1]) - d(order[j], order[j + 1]);
+
+                if (delta < -1e-12)
+                {
+                    reverse(order.begin() + i, order.begin() + j + 1);
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    // Moves the first segment of 1 to 3 stops it finds a better place for
+    bool or_opt(vector<int>& order)
+    {
+        for (int length = 1; length <= 3; length++)
+        {
+            for (int i = 1; i + length - 1 <= m_last; i++)
+            {
+                int j = i + length - 1;     // the segment is order[i..j]
+                double removed = d(order[i - 1], order[i]);
+                if (j + 1 < m_n)
+                    removed += d(order[j], order[j + 1]) - d(order[i - 1], order[j + 1]);
+
+                // insert the segment between order[p] and order[p + 1], outside the segment
+                for (int p = 0; p <= m_last; p++)
+                {
+                    if (p >= i - 1 && p <= j)
+                        continue;
+
+                    double added = d(order[p], order[i]);
+                    if (p + 1 < m_n)
+                        added += d(order[j], order[p + 1]) - d(order[p], order[p + 1]);
+
+                    if (added - removed < -1e-12)
+                    {
+                        vector<int> segment(order.begin() + i, order.begin() + j + 1);
+                        order.erase(order.begin() + i, order.begin() + j + 1);
+                        int at = (p < i) ? p + 1 : p + 1 - length;
+                        order.insert(order.begin() + at, segment.begin(), segment.end());
+                        return true;
+                    }
+                }
+            }
+        }
+        return false;
+    }
+};
+
+std::vector<int> optimize_stop_order(const std::vector<double>& distances, int n, bool keep_last, double time_budget_ms)
+{
+    vector<int> fileOrder(n);
+    iota(fileOrder.begin(), fileOrder.end(), 0);
+
+    int last = keep_last ? n - 2 : n - 1;   // the last position that can be reordered
+    if (last < 2)
+        return fileOrder;   // at most one stop can move
+
+    // an unreachable stop makes every order equally impossible
+    for (double distance : distances)
+        if (distance == numeric_limits<double>::infinity())
+            return fileOrder;
+
+    auto deadline = chrono::steady_clock::now() +
+        chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double, milli>(time_budget_ms));
+
+    // one search per hardware thread, numbered by its index in the loop rather than by the thread
+    // it runs on, so every search is run however the pool's threads pick them up
+    size_t numWorkers = hardware_threads();
+    vector<vector<int>> best(numWorkers);
+    vector<double> bestCost(numWorkers);
+    parallel_for(numWorkers, [&](size_t w)
+    {
+        LocalSearch search(distances, n, last);
+        mt19937 rng(static_cast<unsigned>(w));
+
+        // the first worker starts from the file order, the second from nearest neighbors,
+        // and the rest from random orders
+        vector<int> order(fileOrder);
+        if (w == 1)
+        {
+            for (int k = 1; k < last; k++)
+            {
+                int nearest = k;
+                for (int m = k + 1; m <= last; m++)
+                    if (search.d(order[k - 1], order[m]) < search.d(order[k - 1], order[nearest]))
+                        nearest = m;
+                swap(order[k], order[nearest]);
+            }
+        }
+        else if (w > 1)
+            shuffle(order.begin() + 1, order.begin() + last + 1, rng);
+
+        search.improve(order, deadline);
+        best[w] = order;
+        bestCost[w] = search.cost(order);
+
+        // Iterated local search: kick the best order by moving a random stretch of it elsewhere,
+        // improve that, and keep it if it's shorter
+        for (int failures = 0; failures < KICKS_PER_STOP * n && chrono::steady_clock::now() < deadline; failures++)
+        {
+            order = best[w];
+            int i = 1 + static_cast<int>(rng() % last);
+            int j = 1 + static_cast<int>(rng() % last);
+            int k = 1 + static_cast<int>(rng() % last);
+            int bounds[3] = {i, j, k};
+            sort(bounds, bounds + 3);
+            rotate(order.begin() + bounds[0], order.begin() + bounds[1], order.begin() + bounds[2] + 1);
+
+            search.improve(order, deadline);
+            double cost = search.cost(order);
+            if (cost < bestCost[w] - 1e-12)
+            {
+                best[w] = order;
+                bestCost[w] = cost;
+                failures = -1;
+            }
+        }
+    });
+
+    // the shortest order found by any worker, preferring the lowest worker on ties
+    size_t winner = min_element(bestCost.begin(), bestCost.end()) - bestCost.begin();
+    return best[winner];
+}
@@ -3,129 +3,309 @@
 #include "tourcmd.h"
 #include "geopoint.h"
 #include "geotools.h"
+#include "geodb.h"
+#include "geo_batch.h"
+#include "distance_matrix.h"
+#include "stop_order.h"
+#include "parallel.h"
+#include "spatial_index.h"
+#include "router.h"
+#include "trace.h"
 #include <vector>
 #include <string>
+#include <limits>
+#include <numeric>
+#include <chrono>
+#include <algorithm>
 using namespace std;
 
-TourGenerator::TourGenerator(const GeoDatabaseBase& geodb, const RouterBase& router) : m_geodb(geodb), m_router(router) {}
+TourGenerator::TourGenerator(const GeoDatabaseBase& geodb, const RouterBase& router)
+ : m_geodb(geodb), m_router(router), m_optimizeOrder(false), m_keepLast(false), m_timeBudgetMs(0) {}
 
 TourGenerator::~TourGenerator() {}
 
+void TourGenerator::optimize_order(bool keep_last, double time_budget_ms)
+{
+    m_optimizeOrder = true;
+    m_keepLast = keep_last;
+    m_timeBudgetMs = time_budget_ms;
+}
+
+// Where a stop is: its location, or else its point of interest's
+// Returns false if its point of interest isn't in the map data
+bool TourGenerator::locate(const TourStop& stop, GeoPoint& location) const
+{
+    if (stop.at_location)
+    {
+        location = stop.location;
+        return true;
+    }
+    return m_geodb.get_poi_location(stop.poi, location);
+}
+
+// The indices of the stops in the order they're visited
+std::vector<int> TourGenerator::visiting_order(const std::vector<TourStop>& stops) const
+{
+    int n = static_cast<int>(stops.size());
+    vector<int> fileOrder(n);
+    iota(fileOrder.begin(), fileOrder.end(), 0);
+    if ( ! m_optimizeOrder || n < 3)
+        return fileOrder;
+
+    // If a point of interest isn't found, the tour is generated in file order and fails as usual
+    // Locations off the map are measured from where the router snaps them to
+    const SnappingRouter* snapping = dynamic_cast<const SnappingRouter*>(&m_router);
+    vector<GeoPoint> locations(n);
+    for (int i = 0; i < n; i++)
+    {
+        if ( ! locate(stops[i], locations[i]))
+            return fileOrder;
+        if (stops[i].at_location && snapping != nullptr && ! snapping->snap(stops[i].location, locations[i]))
+            return fileOrder;
+    }
+
+    // Distances between every pair of stops, by one search per stop over a GeoDatabase's graph,
+    // or else by routing every pair
+    vector<double> distances(static_cast<size_t>(n) * n, numeric_limits<double>::infinity());
+    const GeoDatabase* graph = dynamic_cast<const GeoDatabase*>(&m_geodb);
+    if (graph != nullptr)
+    {
+        DistanceMatrix matrix(*graph);
+        if ( ! matrix.compute(locations))
+            return fileOrder;
+
+        for (int from = 0; from < n; from++)
+            for (int to = 0; to < n; to++)
+                distances[from * n + to] = matrix.distance(from, to);
+    }
+    else
+    {
+        for (int from = 0; from < n; from++)
+        {
+            for (int to = 0; to < n; to++)
+            {
+                vector<GeoPoint> route = m_router.route(locations[from], locations[to]);
+                if (route.empty())
+                    continue;   // unreachable
+                distances[from * n + to] = path_length_miles(route);
+            }
+        }
+    }
+
+    return optimize_stop_order(distances, n, m_keepLast, m_timeBudgetMs);
+}
+
 std::vector<TourCommand> TourGenerator::generate_tour(const Stops& stops) const
 {
-    vector<TourCommand> commands;
-    
+    return generate_tour(stops, nullptr);
+}
+
+std::vector<TourCommand> TourGenerator::generate_tour(const Stops& stops, TourStats* stats) const
+{
+    vector<TourStop> list(stops.size());
     for (int i = 0; i < stops.size(); i++)
+        stops.get_poi_data(i, list[i].poi, list[i].talking_points);
+    return generate_tour(list, stats);
+}
+
+std::vector<TourCommand> TourGenerator::generate_tour(const std::vector<TourStop>& stops, TourStats* stats) const
+{
+    TraceSpan span("tour");
+    auto start = chrono::steady_clock::now();
+    
+    // a tiled map reads in the tiles around each stop first, where every search starts or ends
+    const GeoDatabase* tiled = dynamic_cast<const GeoDatabase*>(&m_geodb);
+    if (tiled != nullptr && tiled->is_tiled())
+    {
+        for (const TourStop& stop : stops)
+        {
+            GeoPoint location;
+            if (locate(stop, location))
+                tiled->load_tiles_around(location);
+        }
+    }
+    TraceSpan orderSpan("tour.order");
+    vector<int> order = visiting_order(stops);
+    orderSpan.end();
+    auto ordered = chrono::steady_clock::now();
+    
+    // Legs between consecutive stops don't depend on each other, so they're routed and turned
+    // into commands in parallel, then stitched together in order
+    size_t numLegs = order.empty() ? 0 : order.size() - 1;
+    vector<vector<TourCommand>> legs(numLegs);
+    vector<char> legOk(numLegs, false);
+    vector<LegStats> legStats(stats != nullptr ? numLegs : 0);
+    parallel_for(numLegs, [&](size_t k)
     {
-        string currentPoIName;
-        string currentPoICommentary;
-        stops.get_poi_data(i, currentPoIName, currentPoICommentary);
+        TraceSpan legSpan("leg");
+        if (legSpan.active())
+            legSpan.set_detail(stops[order[k]].poi + " -> " + stops[order[k + 1]].poi);
+        
+        if (stats == nullptr)
+        {
+            legOk[k] = generate_leg(stops[order[k]], stops[order[k + 1]], legs[k]);
+            return;
+        }
         
+        // a leg is generated on one thread, so that thread's counters tell its work apart
+        SearchStats before = thread_search_stats();
+        auto legStart = chrono::steady_clock::now();
+        legOk[k] = generate_leg(stops[order[k]], stops[order[k + 1]], legs[k]);
+        legStats[k] = {stops[order[k]].poi, stops[order[k + 1]].poi,
+                       chrono::duration<double, micro>(chrono::steady_clock::now() - legStart).count(),
+                       thread_search_stats() - before};
+    });
+    
+    if (stats != nullptr)
+    {
+        stats->orderMicros = chrono::duration<double, micro>(ordered - start).count();
+        stats->micros = chrono::duration<double, micro>(chrono::steady_clock::now() - start).count();
+        stats->search = SearchStats();
+        for (const LegStats& leg : legStats)
+            stats->search += leg.search;
+        stats->legs = move(legStats);
+    }
+    
+    vector<TourCommand> commands;
+    for (size_t k = 0; k < order.size(); k++)
+    {
         // commentary for the current point of interest
         TourCommand commentary;
-        commentary.init_commentary(currentPoIName, currentPoICommentary);
+        commentary.init_commentary(stops[order[k]].poi, stops[order[k]].talking_points);
         commands.push_back(commentary);
         
-        string nextPoIName;
-        string nextPoICommentary;
-        
-        if ( ! stops.get_poi_data(i + 1, nextPoIName, nextPoICommentary))
+        if (k == numLegs)
             return commands;    // no next point of interest
         
-        // there is another point of interest following the current point of interest
-        // find GeoPoints associated with the current and next point of interest
-        GeoPoint currentPoI;
-        GeoPoint nextPoI;
-        
-        if ( ! m_geodb.get_poi_location(currentPoIName, currentPoI))
-            return vector<TourCommand>();   // current point of interest not found in the map data
+        if ( ! legOk[k])
+            return vector<TourCommand>();   // a point of interest not found in the map data, or no route is possible
         
-        if ( ! m_geodb.get_poi_location(nextPoIName, nextPoI))
-            return vector<TourCommand>();   // next point of interest not found in the map data
+        commands.insert(commands.end(), legs[k].begin(), legs[k].end());
+    }
+    
+    return commands;
+}
+
+// Generates the commands for travelling from one stop to another, after the first stop's commentary
+// Returns false if either point of interest isn't in the map data or there's no route between them
+bool TourGenerator::generate_leg(const TourStop& from, const TourStop& to, std::vector<TourCommand>& commands) const
+{
+    // find GeoPoints associated with the current and next point of interest
+    GeoPoint currentPoI;
+    GeoPoint nextPoI;
+    
+    if ( ! locate(from, currentPoI))
+        return false;   // current point of interest not found in the map data
+    
+    if ( ! locate(to, nextPoI))
+        return false;   // next point of interest not found in the map data
+    
+    // the GeoPoints associated with the current and next point of interest were successfully found
+    // A router over a GeoDatabase also gives the edges its route takes
+    const GeoDatabase* graph = dynamic_cast<const GeoDatabase*>(&m_geodb);
+    const EdgeRouter* edgeRouter = (graph != nullptr) ? dynamic_cast<const EdgeRouter*>(&m_router) : nullptr;
+    TraceSpan routeSpan("leg.route");
+    vector<uint32_t> segmentEdges;
+    vector<GeoPoint> route = (edgeRouter != nullptr) ? edgeRouter->route(currentPoI, nextPoI, segmentEdges) : m_router.route(currentPoI, nextPoI);
+    routeSpan.end();
+    
+    if (route.empty())
+        return false;   // no route is possible
+    
+    // a route from the current point of interest to the next point of interest is possible
+    // Name, measure and orient every segment once; a GeoDatabase works out each edge's street,
+    // length and direction when it loads, so those are read straight off the route's edges,
+    // and consecutive segments are compared by street ID
+    TraceSpan streetSpan("leg.streets");
+    size_t numSegments = route.size() - 1;
+    vector<string> segmentNames(numSegments);
+    vector<uint32_t> segmentStreets;
+    vector<double> segmentDistances(numSegments);
+    vector<double> segmentAngles(numSegments);     // in radians, as atan2 gives them
+    vector<uint8_t> segmentCompass(numSegments);
+    if (segmentEdges.size() != numSegments)
+        segmentEdges.assign(numSegments, NO_EDGE);  // the router didn't give them
+    
+    // any segment that isn't an edge is named by the map and measured with the rest of the route in one batch
+    bool allEdges = (find(segmentEdges.begin(), segmentEdges.end(), NO_EDGE) == segmentEdges.end());
+    if (allEdges)
+        segmentStreets.resize(numSegments);
+    else
+    {
+        PathColumns columns;
+        columns.assign(route);
+        const double* lat = columns.latitudes.data();
+        const double* lon = columns.longitudes.data();
+        batch_distance_miles(lat, lon, lat + 1, lon + 1, numSegments, segmentDistances.data());
+        batch_bearings(lat, lon, lat + 1, lon + 1, numSegments, segmentAngles.data());
+    }
+    
+    for (size_t j = 0; j < numSegments; j++)
+    {
+        uint32_t edge = segmentEdges[j];
+        if (edge != NO_EDGE)
+        {
+            uint32_t street = graph->edge_street(edge);
+            if (allEdges)
+                segmentStreets[j] = street;
+            segmentNames[j] = graph->street_name(street);
+            segmentDistances[j] = graph->edge_length(edge);
+            segmentAngles[j] = graph->edge_angle(edge);
+            segmentCompass[j] = graph->edge_compass(edge);
+            continue;
+        }
         
-        // the GeoPoints associated with the current and next point of interest were successfully found
-        vector<GeoPoint> route = m_router.route(currentPoI, nextPoI);
+        segmentNames[j] = m_geodb.get_street_name(route[j], route[j + 1]);
+        double degrees = segmentAngles[j] * 180 / pi;
+        segmentCompass[j] = compass_sector(degrees < 0 ? degrees + 360 : degrees);
+    }
+    
+    streetSpan.end();
+    
+    // classify each segment's direction and each turn between streets
+    TraceSpan commandSpan("leg.commands");
+    for (int j = 0; j < route.size() - 1; j++)
+    {
+        const string& firstSegmentName = segmentNames[j];
+        double firstSegmentDistance = segmentDistances[j];
+        string firstSegmentDirection = COMPASS_DIRECTIONS[segmentCompass[j]];
         
-        if (route.empty())
-            return vector<TourCommand>();   // no route is possible
+        // proceed from route[j] to route[j + 1]
+        TourCommand proceed;
+        proceed.init_proceed(firstSegmentDirection, firstSegmentName, firstSegmentDistance, route[j], route[j + 1]);
+        commands.push_back(proceed);
         
-        // a route from the current point of interest to the next point of interest is possible
-        for (int j = 0; j < route.size() - 1; j++)
+        // there is a GeoPoint route[j + 2] directly after route[j + 1] on the path
+        if (j + 2 < route.size())
         {
-            string firstSegmentName = m_geodb.get_street_name(route[j], route[j + 1]);
-            double firstSegmentDistance = distance_earth_miles(route[j], route[j + 1]);
-            double firstSegmentAngle = angle_of_line(route[j], route[j + 1]);
-            string firstSegmentDirection;
+            const string& secondSegmentName = segmentNames[j + 1];
+            // the same arithmetic as angle_of_turn
+            double turningAngle = (segmentAngles[j + 1] - segmentAngles[j]) * 180 / pi;
+            if (turningAngle < 0)
+                turningAngle += 360;
+            bool sameStreet = segmentStreets.empty() ? (firstSegmentName == secondSegmentName) :
+                (segmentStreets[j] == segmentStreets[j + 1]);
             
-            if (firstSegmentAngle >= 0 && firstSegmentAngle < 22.5)
+            // segment street names differ and there is some turn
+            if ( ! sameStreet && turningAngle >= 1 && turningAngle <= 359)
             {
-                firstSegmentDirection = "east";
-            }
-            else if (firstSegmentAngle >= 22.5 && firstSegmentAngle < 67.5)
-            {
-                firstSegmentDirection = "northeast";
-            }
-            else if (firstSegmentAngle >= 67.5 && firstSegmentAngle < 112.5)
-            {
-                firstSegmentDirection = "north";
-            }
-            else if (firstSegmentAngle >= 112.5 && firstSegmentAngle < 157.5)
-            {
-                firstSegmentDirection = "northwest";
-            }
-            else if (firstSegmentAngle >= 157.5 && firstSegmentAngle < 202.5)
-            {
-                firstSegmentDirection = "west";
-            }
-            else if (firstSegmentAngle >= 202.5 && firstSegmentAngle < 247.5)
-            {
-                firstSegmentDirection = "southwest";
-            }
-            else if (firstSegmentAngle >= 247.5 && firstSegmentAngle < 292.5)
-            {
-                firstSegmentDirection = "south";
-            }
-            else if (firstSegmentAngle >= 292.5 && firstSegmentAngle < 337.5)
-            {
-                firstSegmentDirection = "southeast";
-            }
-            else if (firstSegmentAngle >= 337.5)
-            {
-                firstSegmentDirection = "east";
-            }
-            
-            // proceed from route[j] to route[j + 1]
-            TourCommand proceed;
-            proceed.init_proceed(firstSegmentDirection, firstSegmentName, firstSegmentDistance, route[j], route[j + 1]);
-            commands.push_back(proceed);
-            
-            // there is a GeoPoint route[j + 2] directly after route[j + 1] on the path
-            if (j + 2 < route.size())
-            {
-                string secondSegmentName = m_geodb.get_street_name(route[j + 1], route[j + 2]);
-                double turningAngle = angle_of_turn(route[j], route[j + 1], route[j + 2]);
+                string turningDirection;
                 
-                // segment street names differ and there is some turn
-                if (firstSegmentName != secondSegmentName && turningAngle >= 1 && turningAngle <= 359)
+                if (turningAngle >= 1 && turningAngle < 180)
+                {
+                    turningDirection = "left";
+                }
+                else if (turningAngle >= 180 && turningAngle <= 359)
                 {
-                    string turningDirection;
-                    
-                    if (turningAngle >= 1 && turningAngle < 180)
-                    {
-                        turningDirection = "left";
-                    }
-                    else if (turningAngle >= 180 && turningAngle <= 359)
-                    {
-                        turningDirection = "right";
-                    }
-                    
-                    TourCommand turn;
-                    turn.init_turn(turningDirection, secondSegmentName);
-                    commands.push_back(turn);
+                    turningDirection = "right";
                 }
+                
+                TourCommand turn;
+                turn.init_turn(turningDirection, secondSegmentName);
+                commands.push_back(turn);
             }
         }
     }
     
-    return commands;
+    return true;
 }
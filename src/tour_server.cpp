@@ -0,0 +1,430 @@
+#include "tour_server.h"
+#include "tour_generator.h"
+#include "tourcmd.h"
+#include "json.h"
+#include "live_map.h"
+#include "map_delta.h"
+#include "poi_index.h"
+#include "spatial_index.h"
+#include "geocoord.h"
+#include "parallel.h"
+#include "trace.h"
+#include <string>
+#include <vector>
+#include <memory>
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+#include <atomic>
+#include <exception>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+using namespace std;
+
+// A request line longer than this is refused, and its connection stops being read
+const size_t MAX_REQUEST_SIZE = 1 << 20;
+
+// An error answer to a request
+static string errorAnswer(const string& id, const string& error)
+{
+    string answer = "{\"id\":" + id + ",\"ok\":false,\"error\":";
+    write_json_string(answer, error);
+    return answer + "}";
+}
+
+// Reads a location given as [latitude, longitude]; returns false if value isn't one on the globe
+static bool readLocation(const JsonValue* value, GeoPoint& location)
+{
+    GeoCoord coord;
+    if (value == nullptr || value->type != JsonValue::ARRAY || value->items.size() != 2 ||
+        value->items[0].type != JsonValue::NUMBER || value->items[1].type != JsonValue::NUMBER ||
+        ! parse_location(value->items[0].text, value->items[1].text, coord))
+        return false;
+    location = to_geopoint(coord);
+    return true;
+}
+
+TourServer::TourServer(LiveMap& map, int num_workers)
+ : m_map(map), m_stopping(false)
+{
+    size_t numWorkers = (num_workers > 0) ? num_workers : hardware_threads();
+    for (size_t i = 0; i < numWorkers; i++)
+        m_workers.emplace_back(&TourServer::work, this);
+}
+
+TourServer::~TourServer()
+{
+    {
+        lock_guard<mutex> guard(m_lock);
+        m_stopping = true;
+    }
+    m_ready.notify_all();
+    
+    for (auto& worker : m_workers)
+        worker.join();  // after finishing every job already queued
+}
+
+void TourServer::submit(std::function<void()> job)
+{
+    {
+        lock_guard<mutex> guard(m_lock);
+        m_jobs.push_back(move(job));
+    }
+    m_ready.notify_one();
+}
+
+void TourServer::work()
+{
+    for (;;)
+    {
+        function<void()> job;
+        {
+            unique_lock<mutex> guard(m_lock);
+            m_ready.wait(guard, [this] { return m_stopping || ! m_jobs.empty(); });
+            if (m_jobs.empty())
+                return;     // stopping, and nothing is left to do
+            job = move(m_jobs.front());
+            m_jobs.pop_front();
+        }
+        job();
+    }
+}
+
+std::string TourServer::handle(const std::string& request) const
+{
+    TraceSpan span("request");
+    JsonValue json;
+    if ( ! parse_json(request, json) || json.type != JsonValue::OBJECT)
+        return errorAnswer("null", "malformed request");
+    
+    string id = "null";
+    if (const JsonValue* idValue = json.find("id"))
+    {
+        id.clear();
+        write_json(id, *idValue);
+    }
+    
+    // a request that fails in a way nothing above caught is answered with the error, and the server goes on
+    try
+    {
+        return answer(id, json);
+    }
+    catch (const exception& error)
+    {
+        return errorAnswer(id, string("request failed: ") + error.what());
+    }
+}
+
+// The answer to a request once its id is read
+std::string TourServer::answer(const std::string& id, const JsonValue& json) const
+{
+    if (json.find("update") != nullptr)
+        return update(id, json);
+    
+    // the whole request is answered on the version of the map current when it started
+    shared_ptr<const MapVersion> version = m_map.current();
+    if (json.find("search") != nullptr)
+        return search(id, json, *version);
+    if (json.find("street_at") != nullptr)
+        return street_at(id, json, *version);
+    
+    const JsonValue* stopsValue = json.find("stops");
+    if (stopsValue == nullptr || stopsValue->type != JsonValue::ARRAY)
+        return errorAnswer(id, "request has no stops");
+    
+    vector<TourStop> stops;
+    for (const JsonValue& item : stopsValue->items)
+    {
+        size_t index = stops.size();
+        if (item.type != JsonValue::OBJECT)
+            return errorAnswer(id, "every stop needs a poi or a location");
+        const JsonValue* poi = item.find("poi");
+        const JsonValue* location = item.find("location");
+        const JsonValue* commentary = item.find("commentary");
+        
+        // a stop at a location is named after the street it's on, unless it's given a name
+        TourStop stop;
+        if (location != nullptr)
+        {
+            GeoPoint snapped;
+            if ( ! readLocation(location, stop.location))
+                return errorAnswer(id, "a location must be [latitude, longitude] in degrees");
+            if ( ! version->router().snap(stop.location, snapped))
+                return errorAnswer(id, "the stop at index " + to_string(index) + " is off the map, too far from any street to route");
+            stop.at_location = true;
+            stop.poi = version->spatial_index().street_at(stop.location);
+            if (stop.poi.empty())
+                stop.poi = UNNAMED_LOCATION;
+        }
+        else if (poi == nullptr)
+            return errorAnswer(id, "every stop needs a poi or a location");
+        if (poi != nullptr)
+        {
+            if (poi->type != JsonValue::STRING)
+                return errorAnswer(id, "a poi must be a string");
+            stop.poi = poi->text;
+        }
+        if (commentary != nullptr && commentary->type == JsonValue::STRING)
+            stop.talking_points = commentary->text;
+        stops.push_back(stop);
+    }
+    
+    vector<TourCommand> commands = version->generator().generate_tour(stops);
+    if (commands.empty())
+        return errorAnswer(id, "unable to generate tour");
+    
+    string list;
+    double totalDistance = 0;
+    for (const TourCommand& command : commands)
+    {
+        list += list.empty() ? "{\"type\":" : ",{\"type\":";
+        switch (command.get_command_type())
+        {
+            case TourCommand::commentary:
+                list += "\"commentary\",\"poi\":";
+                write_json_string(list, command.get_poi());
+                list += ",\"commentary\":";
+                write_json_string(list, command.get_commentary());
+                break;
+            case TourCommand::turn:
+                list += "\"turn\",\"direction\":";
+                write_json_string(list, command.get_direction());
+                list += ",\"street\":";
+                write_json_string(list, command.get_street());
+                break;
+            case TourCommand::proceed:
+                list += "\"proceed\",\"direction\":";
+                write_json_string(list, command.get_direction());
+                list += ",\"street\":";
+                write_json_string(list, command.get_street());
+                list += ",\"distance\":" + to_string(command.get_distance());
+                totalDistance += command.get_distance();
+                break;
+            default:
+                list += "\"invalid\"";
+        }
+        list += '}';
+    }
+    
+    return "{\"id\":" + id + ",\"ok\":true,\"epoch\":" + to_string(version->epoch()) + ",\"distance\":" + to_string(totalDistance) + ",\"commands\":[" + list + "]}";
+}
+
+std::string TourServer::search(const std::string& id, const JsonValue& request, const MapVersion& version) const
+{
+    const PoiIndex* poiIndex = version.poi_index();
+    if (poiIndex == nullptr)
+        return errorAnswer(id, "search is not enabled");
+    
+    const JsonValue* query = request.find("search");
+    if (query->type != JsonValue::STRING)
+        return errorAnswer(id, "search needs a string");
+    
+    size_t limit = 10;
+    if (const JsonValue* limitValue = request.find("limit"))
+    {
+        if (limitValue->type != JsonValue::NUMBER || limitValue->number < 1 || limitValue->number > 100)
+            return errorAnswer(id, "limit must be from 1 to 100");
+        limit = static_cast<size_t>(limitValue->number);
+    }
+    
+    static const char* const kinds[] = {"exact", "prefix", "word", "fuzzy"};
+    string list;
+    for (const PoiMatch& match : poiIndex->search(query->text, limit))
+    {
+        list += list.empty() ? "{\"poi\":" : ",{\"poi\":";
+        write_json_string(list, match.name);
+        list += ",\"match\":\"" + string(kinds[match.kind]) + "\",\"edits\":" + to_string(match.edits) + "}";
+    }
+    
+    return "{\"id\":" + id + ",\"ok\":true,\"matches\":[" + list + "]}";
+}
+
+std::string TourServer::street_at(const std::string& id, const JsonValue& request, const MapVersion& version) const
+{
+    GeoPoint location;
+    if ( ! readLocation(request.find("street_at"), location))
+        return errorAnswer(id, "street_at needs [latitude, longitude]");
+    
+    string answer = "{\"id\":" + id + ",\"ok\":true,\"street\":";
+    write_json_string(answer, version.spatial_index().street_at(location));
+    return answer + "}";
+}
+
+std::string TourServer::update(const std::string& id, const JsonValue& request) const
+{
+    const JsonValue* delta = request.find("update");
+    if (delta->type != JsonValue::STRING)
+        return errorAnswer(id, "update needs the text of a delta");
+    
+    vector<MapChange> changes;
+    size_t badLine;
+    if ( ! parse_map_delta(delta->text, changes, badLine))
+        return errorAnswer(id, "malformed change on line " + to_string(badLine));
+    
+    size_t failed;
+    uint64_t epoch;
+    if ( ! m_map.update(changes, failed, epoch))
+        return errorAnswer(id, "no such segment or point of interest for the change on line " + to_string(changes[failed].line));
+    
+    return "{\"id\":" + id + ",\"ok\":true,\"epoch\":" + to_string(epoch) + "}";
+}
+
+void TourServer::serve(std::istream& in, std::ostream& out)
+{
+    // answers are written whole under a lock, and the last one to finish wakes the reader
+    mutex outLock;
+    condition_variable done;
+    size_t pending = 0;
+    
+    string line;
+    while (getline(in, line))
+    {
+        if (line.find_first_not_of(" \t\r") == string::npos)
+            continue;   // blank line
+        
+        {
+            lock_guard<mutex> guard(outLock);
+            pending++;
+        }
+        submit([this, line, &out, &outLock, &done, &pending]()
+        {
+            string answer = handle(line) + "\n";
+            lock_guard<mutex> guard(outLock);
+            out << answer << flush;
+            if (--pending == 0)
+                done.notify_all();
+        });
+    }
+    
+    unique_lock<mutex> guard(outLock);
+    done.wait(guard, [&] { return pending == 0; });
+}
+
+// A client connected to the socket, closed once its reader and every job answering it are done
+struct Connection
+{
+    int fd;
+    mutex writeLock;
+    
+    Connection(int socket) : fd(socket) {}
+    ~Connection() { ::close(fd); }
+    
+    void write(const string& answer)
+    {
+        lock_guard<mutex> guard(writeLock);
+        for (size_t sent = 0; sent < answer.size(); )
+        {
+            ssize_t n = send(fd, answer.data() + sent, answer.size() - sent, MSG_NOSIGNAL);
+            if (n <= 0)
+                return;     // the client went away
+            sent += n;
+        }
+    }
+};
+
+// A thread reading a connection, and whether it's done
+struct ConnectionReader
+{
+    thread reader;
+    weak_ptr<Connection> connection;
+    shared_ptr<atomic<bool>> done;
+};
+
+// Reads a connection's requests until it closes, submitting each to the pool as it comes in
+void TourServer::read_connection(std::shared_ptr<Connection> connection)
+{
+    string buffer;
+    char chunk[4096];
+    ssize_t n;
+    while ((n = recv(connection->fd, chunk, sizeof(chunk), 0)) > 0)
+    {
+        buffer.append(chunk, n);
+        size_t start = 0;
+        for (size_t newline; (newline = buffer.find('\n', start)) != string::npos; start = newline + 1)
+        {
+            string line = buffer.substr(start, newline - start);
+            if (line.find_first_not_of(" \t\r") == string::npos)
+                continue;   // blank line
+            submit([this, connection, line]() { connection->write(handle(line) + "\n"); });
+        }
+        buffer.erase(0, start);
+        
+        if (buffer.size() > MAX_REQUEST_SIZE)
+        {
+            connection->write(errorAnswer("null", "request too long") + "\n");
+            return;
+        }
+    }
+    
+    // a last request the client didn't end with a newline
+    if (buffer.find_first_not_of(" \t\r") != string::npos)
+        submit([this, connection, buffer]() { connection->write(handle(buffer) + "\n"); });
+}
+
+bool TourServer::serve_socket(const std::string& socket_path)
+{
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(address.sun_path))
+        return false;   // path too long
+    strcpy(address.sun_path, socket_path.c_str());
+    
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0)
+        return false;
+    
+    unlink(socket_path.c_str());    // a socket left behind by an earlier server
+    if (bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(listener, SOMAXCONN) != 0)
+    {
+        ::close(listener);
+        return false;
+    }
+    
+    // the threads reading each connection, each joined once it's done, and every one before returning
+    vector<ConnectionReader> readers;
+    for (;;)
+    {
+        int client = accept(listener, nullptr, nullptr);
+        if (client < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            break;
+        }
+        
+        for (size_t i = 0; i < readers.size(); )
+        {
+            if (readers[i].done->load())
+            {
+                readers[i].reader.join();
+                readers[i] = move(readers.back());
+                readers.pop_back();
+            }
+            else
+                i++;
+        }
+        
+        // each connection's requests are read on a thread of their own and answered by the pool
+        auto connection = make_shared<Connection>(client);
+        auto done = make_shared<atomic<bool>>(false);
+        thread reader([this, connection, done]()
+        {
+            read_connection(connection);
+            done->store(true);
+        });
+        readers.push_back(ConnectionReader{move(reader), connection, done});
+    }
+    
+    // connections still open stop being read, though their requests already read are still answered
+    for (ConnectionReader& reader : readers)
+    {
+        if (shared_ptr<Connection> connection = reader.connection.lock())
+            shutdown(connection->fd, SHUT_RD);
+        reader.reader.join();
+    }
+    
+    ::close(listener);
+    return false;
+}
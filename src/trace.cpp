@@ -0,0 +1,124 @@
+#include "trace.h"
+#include "json.h"
+#include <string>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <fstream>
+#include <algorithm>
+#include <cstdio>
+using namespace std;
+
+std::atomic<bool> traceEnabled(false);
+
+namespace
+{
+    struct TraceEvent
+    {
+        const char* name;
+        string detail;
+        double start;       // in microseconds since tracing started
+        double duration;
+    };
+
+    // A thread's spans, which it appends to under its own lock so the trace can be written
+    // while the thread is still running
+    struct ThreadTrace
+    {
+        int tid;
+        mutex lock;
+        vector<TraceEvent> events;
+
+        ThreadTrace();
+        ~ThreadTrace();
+    };
+
+    chrono::steady_clock::time_point traceStart;
+
+    // The traces of running threads, and the spans of finished ones with their thread IDs
+    mutex registryLock;
+    vector<ThreadTrace*> running;
+    vector<pair<int, TraceEvent>> finished;
+    int nextTid = 1;
+
+    ThreadTrace::ThreadTrace()
+    {
+        lock_guard<mutex> guard(registryLock);
+        tid = nextTid++;
+        running.push_back(this);
+    }
+
+    ThreadTrace::~ThreadTrace()
+    {
+        lock_guard<mutex> guard(registryLock);
+        for (auto& event : events)
+            finished.emplace_back(tid, move(event));
+        running.erase(find(running.begin(), running.end(), this));
+    }
+
+    void writeEvent(string& out, int tid, const TraceEvent& event)
+    {
+        out += "{\"name\":";
+        write_json_string(out, event.name);
+        char numbers[96];
+        snprintf(numbers, sizeof(numbers), ",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f", tid, event.start, event.duration);
+        out += numbers;
+        if ( ! event.detail.empty())
+        {
+            out += ",\"args\":{\"detail\":";
+            write_json_string(out, event.detail);
+            out += '}';
+        }
+        out += '}';
+    }
+}
+
+void start_tracing()
+{
+    traceStart = chrono::steady_clock::now();
+    traceEnabled.store(true);
+}
+
+bool write_trace(const std::string& trace_file)
+{
+    string out = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    bool first = true;
+    auto append = [&](int tid, const TraceEvent& event) {
+        if ( ! first)
+            out += ",\n";
+        first = false;
+        writeEvent(out, tid, event);
+    };
+
+    {
+        lock_guard<mutex> guard(registryLock);
+        for (const auto& entry : finished)
+            append(entry.first, entry.second);
+        for (ThreadTrace* thread : running)
+        {
+            lock_guard<mutex> threadGuard(thread->lock);
+            for (const auto& event : thread->events)
+                append(thread->tid, event);
+        }
+    }
+    out += "]}\n";
+
+    ofstream file(trace_file, ios::binary);
+    file << out;
+    return static_cast<bool>(file);
+}
+
+double TraceSpan::now()
+{
+    return chrono::duration<double, micro>(chrono::steady_clock::now() - traceStart).count();
+}
+
+void TraceSpan::finish()
+{
+    thread_local ThreadTrace trace;
+    double end = now();
+    lock_guard<mutex> guard(trace.lock);
+    trace.events.push_back({m_name, move(m_detail), m_start, end - m_start});
+    m_start = -1;
+}
@@ -0,0 +1,100 @@
+#include "hashmap.h"
+#include "geocoord.h"
+#include "check.h"
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <random>
+using namespace std;
+
+// Inserting, replacing and finding string keys, looked up by string_view and by precomputed hash
+static void testStrings()
+{
+    HashMap<int> map;
+    CHECK(map.size() == 0);
+    CHECK(map.find("missing") == nullptr);
+
+    map.insert("Westwood Plaza", 1);
+    map["Bruin Walk"] = 2;
+    map.insert("Westwood Plaza", 3);    // replaces
+    CHECK(map.size() == 2);
+    CHECK(map.find("Westwood Plaza") != nullptr && *map.find("Westwood Plaza") == 3);
+
+    string text = "Bruin Walk and more";
+    string_view name = string_view(text).substr(0, 10);
+    size_t hash = map.hash_key(name);
+    CHECK(map.find(name, hash) != nullptr && *map.find(name, hash) == 2);
+    CHECK(map["Strathmore Place"] == 0);    // a new key gets the default value
+    CHECK(map.size() == 3);
+
+    // iteration is in insertion order
+    vector<string> keys;
+    for (const auto& entry : map)
+        keys.push_back(entry.first);
+    CHECK((keys == vector<string>{"Westwood Plaza", "Bruin Walk", "Strathmore Place"}));
+}
+
+// Keys of another type, with their own hash
+static void testCoordKeys()
+{
+    HashMap<vector<uint32_t>, GeoCoord, GeoCoordHash> map;
+    GeoCoord a{340709818, -1184447589};
+    GeoCoord b{340707966, -1184447645};
+    map[a].push_back(1);
+    map[a].push_back(2);
+    map[b].push_back(3);
+    CHECK(map.size() == 2);
+    CHECK(map.find(a) != nullptr && map.find(a)->size() == 2);
+    CHECK(map.find(GeoCoord{0, 0}) == nullptr);
+}
+
+// Many inserts and erases through rehashes, checked against std::map
+static void testAgainstMap()
+{
+    HashMap<int> map;
+    std::map<string, int> expected;
+    mt19937 random(7);
+    for (int i = 0; i < 20000; i++)
+    {
+        string key = "street " + to_string(random() % 5000);
+        if (random() % 3 == 0)
+        {
+            CHECK(map.erase(key) == (expected.erase(key) == 1));
+        }
+        else
+        {
+            map.insert(key, i);
+            expected[key] = i;
+        }
+    }
+
+    CHECK(map.size() == static_cast<int>(expected.size()));
+    for (const auto& entry : expected)
+        CHECK(map.find(entry.first) != nullptr && *map.find(entry.first) == entry.second);
+    for (const auto& entry : map)
+        CHECK(expected.count(entry.first) == 1);
+}
+
+// Reserving room up front keeps every association, and a negative count is ignored
+static void testReserve()
+{
+    HashMap<int> map(0.9);
+    map.reserve(-1);
+    CHECK(map.size() == 0 && map.find("0") == nullptr);
+    map.reserve(1000);
+    for (int i = 0; i < 1000; i++)
+        map.insert(to_string(i), i);
+    map.reserve(10);
+    for (int i = 0; i < 1000; i++)
+        CHECK(map.find(to_string(i)) != nullptr && *map.find(to_string(i)) == i);
+}
+
+int main()
+{
+    testStrings();
+    testCoordKeys();
+    testAgainstMap();
+    testReserve();
+    return check_failures() != 0;
+}
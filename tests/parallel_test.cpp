@@ -0,0 +1,72 @@
+#include "parallel.h"
+#include "check.h"
+#include <atomic>
+#include <thread>
+#include <vector>
+using namespace std;
+
+// Every index is visited exactly once, and each worker number is only ever used on one thread
+static void testLoop(size_t count)
+{
+    vector<atomic<int>> visits(count);
+    vector<thread::id> workerThreads(hardware_threads());
+    atomic<bool> sharedWorker(false);
+    vector<atomic<int>> workerCalls(hardware_threads());
+    parallel_for_workers(count, [&](size_t w, size_t i)
+    {
+        visits[i]++;
+        if (w >= workerThreads.size())
+        {
+            sharedWorker = true;
+            return;
+        }
+        if (workerCalls[w]++ == 0)
+            workerThreads[w] = this_thread::get_id();
+        else if (workerThreads[w] != this_thread::get_id())
+            sharedWorker = true;
+    });
+
+    for (size_t i = 0; i < count; i++)
+        CHECK(visits[i] == 1);
+    CHECK(!sharedWorker);
+}
+
+// Loops started at once from several threads, as server requests do, all finish
+static void testConcurrentLoops()
+{
+    vector<thread> callers;
+    vector<atomic<long>> sums(8);
+    for (size_t c = 0; c < sums.size(); c++)
+    {
+        callers.emplace_back([&, c]
+        {
+            for (int round = 0; round < 50; round++)
+                parallel_for(100, [&](size_t i) { sums[c] += static_cast<long>(i); });
+        });
+    }
+    for (auto& caller : callers)
+        caller.join();
+    for (auto& sum : sums)
+        CHECK(sum == 50 * 4950);
+}
+
+// Loops inside loops don't wait on each other
+static void testNestedLoops()
+{
+    atomic<int> calls(0);
+    parallel_for(8, [&](size_t)
+    {
+        parallel_for(8, [&](size_t) { calls++; });
+    });
+    CHECK(calls == 64);
+}
+
+int main()
+{
+    testLoop(0);
+    testLoop(1);
+    testLoop(10000);
+    testConcurrentLoops();
+    testNestedLoops();
+    return check_failures() != 0;
+}
@@ -0,0 +1,100 @@
+#include "geodb.h"
+#include "map_snapshot.h"
+#include "live_map.h"
+#include "tour_generator.h"
+#include "check.h"
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <vector>
+using namespace std;
+
+// Run with the path to data/mapdata.txt and a directory to write snapshots in
+
+static vector<char> readFile(const string& path)
+{
+    ifstream inf(path, ios::binary);
+    return vector<char>((istreambuf_iterator<char>(inf)), istreambuf_iterator<char>());
+}
+
+static void writeFile(const string& path, const vector<char>& bytes)
+{
+    ofstream outf(path, ios::binary | ios::trunc);
+    outf.write(bytes.data(), bytes.size());
+}
+
+// Overwrites the word in the middle of a section of a snapshot
+static vector<char> damageSection(vector<char> bytes, SnapshotSection section, uint32_t word)
+{
+    SnapshotHeader header;
+    memcpy(&header, bytes.data(), sizeof(header));
+    uint64_t offset = header.sections[section].offset + header.sections[section].size / 2 / sizeof(word) * sizeof(word);
+    memcpy(bytes.data() + offset, &word, sizeof(word));
+    return bytes;
+}
+
+// A snapshot whose IDs point off the map is rejected when loaded, without verify_snapshot
+static void testDamagedSnapshot(const GeoDatabase& geodb, const string& dir)
+{
+    string path = dir + "/snapshot_test.bin";
+    CHECK(geodb.save_snapshot(path));
+    vector<char> bytes = readFile(path);
+
+    GeoDatabase loaded;
+    CHECK(loaded.load(path) && loaded.num_nodes() == geodb.num_nodes() && loaded.verify_snapshot());
+
+    writeFile(path, damageSection(bytes, SECTION_EDGE_TARGETS, 0x7fffffff));
+    CHECK(!GeoDatabase().load(path));
+    writeFile(path, damageSection(bytes, SECTION_EDGE_STREETS, 0x7fffffff));
+    CHECK(!GeoDatabase().load(path));
+    writeFile(path, damageSection(bytes, SECTION_EDGE_OFFSETS, 0));
+    CHECK(!GeoDatabase().load(path));
+
+    // a half copied file
+    writeFile(path, vector<char>(bytes.begin(), bytes.begin() + bytes.size() / 2));
+    CHECK(!GeoDatabase().load(path));
+
+    // a changed length is caught only by the checksum
+    writeFile(path, damageSection(bytes, SECTION_EDGE_LENGTHS, 0x3ff00000));
+    CHECK(loaded.load(path) && !loaded.verify_snapshot());
+}
+
+// Setting up routing over a tiled snapshot and routing one short leg reads in only the tiles around it
+static void testTiledResidency(const string& mapFile, const string& dir)
+{
+    string path = dir + "/snapshot_test_tiled.bin";
+    GeoDatabase tiled;
+    CHECK(tiled.load(mapFile) && tiled.tile(0.01) && tiled.save_snapshot(path));
+
+    auto geodb = make_shared<GeoDatabase>();
+    CHECK(geodb->load(path) && geodb->is_tiled());
+    MapVersion version(geodb, 0);
+    CHECK(version.build(RoutingOptions()));
+    CHECK(geodb->tile_stats().resident == 0);
+
+    TourStop from;
+    from.poi = "Ackerman Union";
+    TourStop to;
+    to.poi = "Diddy Riese";
+    CHECK(!version.generator().generate_tour(vector<TourStop>{from, to}).empty());
+    CHECK(version.spatial_index().street_at(GeoPoint("34.0709000", "-118.4446000")) == "Bruin Walk");
+
+    TileStats stats = geodb->tile_stats();
+    CHECK(stats.resident > 0 && stats.resident < stats.tiles / 2);
+}
+
+int main(int argc, char* argv[])
+{
+    GeoDatabase geodb;
+    if (argc != 3 || !geodb.load(argv[1]))
+    {
+        cerr << "usage: snapshot_test mapdata.txt scratch_dir" << endl;
+        return 1;
+    }
+
+    testDamagedSnapshot(geodb, argv[2]);
+    testTiledResidency(argv[1], argv[2]);
+    return check_failures() != 0;
+}
@@ -0,0 +1,100 @@
+#include "spatial_index.h"
+#include "geodb.h"
+#include "router.h"
+#include "live_map.h"
+#include "tour_generator.h"
+#include "check.h"
+#include <memory>
+#include <string>
+#include <vector>
+using namespace std;
+
+// Run with the path to data/mapdata.txt
+
+// Points exactly on the map, and points near them that aren't
+static void testNearest(const GeoDatabase& geodb, const SpatialIndex& index)
+{
+    uint32_t node, found;
+    CHECK(geodb.get_node_id(GeoPoint("34.0547000", "-118.4794734"), node));
+    CHECK(index.nearest_node(GeoPoint("34.0547000", "-118.4794734"), found) && found == node);
+    CHECK(index.nearest_node(GeoPoint("34.0547200", "-118.4794734"), found) && found == node);
+
+    // the midpoint of 10th Helena Drive's one segment
+    SegmentMatch match;
+    CHECK(index.nearest_segment(GeoPoint("34.0545795", "-118.4797936"), match));
+    CHECK(match.distance < 0.001);
+    CHECK(match.fraction > 0.4 && match.fraction < 0.6);
+}
+
+// Reverse geocoding
+static void testStreetAt(const SpatialIndex& index)
+{
+    CHECK(index.street_at(GeoPoint("34.0545795", "-118.4797936")) == "10th Helena Drive");
+    CHECK(index.street_at(GeoPoint("34.0709000", "-118.4446000")) == "Bruin Walk");
+    CHECK(index.street_at(GeoPoint("35.0000000", "-118.0000000")) == "");    // nowhere near a street
+}
+
+// A route from a location that isn't one of the map's points starts where it's snapped to
+static void testSnappingRouter(const GeoDatabase& geodb, const SpatialIndex& index)
+{
+    Router router(geodb);
+    SnappingRouter snapping(router, geodb, index);
+    GeoPoint offGrid("34.0547200", "-118.4794734");
+    GeoPoint ackerman;
+    CHECK(geodb.get_poi_location("Ackerman Union", ackerman));
+
+    CHECK(router.route(offGrid, ackerman).empty());     // what snapping is for
+
+    GeoPoint snapped;
+    CHECK(snapping.snap(offGrid, snapped) && snapped.to_string() == "34.0547000,-118.4794734");
+    vector<GeoPoint> route = snapping.route(offGrid, ackerman);
+    CHECK(!route.empty());
+    CHECK(!route.empty() && route.front().to_string() == snapped.to_string());
+    CHECK(!route.empty() && route.back().to_string() == ackerman.to_string());
+
+    // a point of the map is routed from as it is
+    CHECK(snapping.snap(ackerman, snapped) && snapped.to_string() == ackerman.to_string());
+
+    // a location far from every street is off the map, not moved onto it
+    GeoPoint farAway("35.0000000", "-118.0000000");
+    CHECK(!snapping.snap(farAway, snapped));
+    CHECK(snapping.route(farAway, ackerman).empty());
+    SnappingRouter lenient(router, geodb, index, 100);
+    CHECK(lenient.snap(farAway, snapped));
+}
+
+// A tour on a live map can start from a GPS position
+static void testTourFromLocation(shared_ptr<const GeoDatabase> geodb)
+{
+    LiveMap map(RoutingOptions{});
+    CHECK(map.start(geodb));
+    shared_ptr<const MapVersion> version = map.current();
+
+    TourStop start;
+    start.at_location = true;
+    start.location = GeoPoint("34.0709000", "-118.4446000");
+    start.poi = version->spatial_index().street_at(start.location);
+    TourStop end;
+    end.poi = "Ackerman Union";
+    vector<TourCommand> commands = version->generator().generate_tour(vector<TourStop>{start, end});
+    CHECK(commands.size() > 2);
+    CHECK(!commands.empty() && commands.front().get_poi() == "Bruin Walk");
+    CHECK(!commands.empty() && commands.back().get_poi() == "Ackerman Union");
+}
+
+int main(int argc, char* argv[])
+{
+    auto geodb = make_shared<GeoDatabase>();
+    if (argc != 2 || !geodb->load(argv[1]))
+    {
+        cerr << "usage: spatial_index_test mapdata.txt" << endl;
+        return 1;
+    }
+
+    SpatialIndex index(*geodb);
+    testNearest(*geodb, index);
+    testStreetAt(index);
+    testSnappingRouter(*geodb, index);
+    testTourFromLocation(geodb);
+    return check_failures() != 0;
+}
@@ -0,0 +1,341 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "ch_router.h"
+#include "contraction_hierarchy.h"
+#include "geo_batch.h"
+#include "geodb.h"
+#include "geotools.h"
+#include "heuristic.h"
+#include "json.h"
+#include "parallel.h"
+#include "router.h"
+#include "stops.h"
+#include "tour_generator.h"
+
+using namespace std;
+
+// The timings of one benchmark, each sample being the mean time of one call in a batch of calls
+struct Benchmark
+{
+    string name;
+    size_t callsPerSample;
+    vector<double> samples;     // in microseconds
+
+    double percentile(double p) const
+    {
+        // nearest rank
+        vector<double> sorted(samples);
+        sort(sorted.begin(), sorted.end());
+        size_t rank = static_cast<size_t>(p / 100 * sorted.size() + 0.5);
+        return sorted[min(sorted.size() - 1, rank > 0 ? rank - 1 : 0)];
+    }
+
+    double mean() const
+    {
+        double total = 0;
+        for (double sample : samples)
+            total += sample;
+        return total / samples.size();
+    }
+};
+
+// Times num_samples batches of calls_per_sample calls to call(i), i counting up across batches,
+// after one untimed batch to warm up caches and per-thread state
+template <typename Fn>
+Benchmark measure(const string& name, size_t num_samples, size_t calls_per_sample, Fn call)
+{
+    Benchmark benchmark{name, calls_per_sample, {}};
+    for (size_t i = 0; i < calls_per_sample; i++)
+        call(i);
+
+    size_t next = 0;
+    for (size_t s = 0; s < num_samples; s++)
+    {
+        auto start = chrono::steady_clock::now();
+        for (size_t i = 0; i < calls_per_sample; i++)
+            call(next++);
+        chrono::duration<double, micro> elapsed = chrono::steady_clock::now() - start;
+        benchmark.samples.push_back(elapsed.count() / calls_per_sample);
+    }
+
+    fprintf(stdout, "%-28s %8zu x %-6zu p50 %12.2f us  p90 %12.2f us  p99 %12.2f us  max %12.2f us\n",
+            name.c_str(), num_samples, calls_per_sample, benchmark.percentile(50), benchmark.percentile(90),
+            benchmark.percentile(99), benchmark.percentile(100));
+    return benchmark;
+}
+
+// How far the batch kernels may stray from geotools on a map's edges
+const double MAX_BATCH_ULPS = 16;
+
+// How many representable doubles apart two results are, relative to the expected one
+static double ulpsApart(double actual, double expected)
+{
+    if (actual == expected)
+        return 0;
+    double ulp = nextafter(fabs(expected), INFINITY) - fabs(expected);
+    return fabs(actual - expected) / ulp;
+}
+
+// Appends a name and a time or a count as a JSON member
+static void writeTime(string& out, const string& name, double microseconds)
+{
+    write_json_string(out, name);
+    char number[32];
+    snprintf(number, sizeof(number), ":%.3f", microseconds);
+    out += number;
+}
+
+static void writeCount(string& out, const string& name, size_t count)
+{
+    write_json_string(out, name);
+    out += ':' + to_string(count);
+}
+
+static string toJson(const vector<Benchmark>& benchmarks, const GeoDatabase& geodb, unsigned seed)
+{
+    string out = "{\"machine\":{";
+    writeCount(out, "threads", hardware_threads());
+    out += "},\"map\":{";
+    writeCount(out, "nodes", geodb.num_nodes());
+    out += ',';
+    writeCount(out, "edges", geodb.num_edges());
+    out += ',';
+    writeCount(out, "pois", geodb.num_pois());
+    out += "},";
+    writeCount(out, "seed", seed);
+    out += ",\"benchmarks\":[";
+    for (size_t i = 0; i < benchmarks.size(); i++)
+    {
+        const Benchmark& b = benchmarks[i];
+        out += (i == 0) ? "{\"name\":" : ",{\"name\":";
+        write_json_string(out, b.name);
+        out += ",\"unit\":\"us\",";
+        writeCount(out, "samples", b.samples.size());
+        out += ',';
+        writeCount(out, "calls_per_sample", b.callsPerSample);
+        out += ',';
+        writeTime(out, "mean", b.mean());
+        out += ',';
+        writeTime(out, "min", b.percentile(0));
+        for (int p : {50, 90, 99})
+        {
+            out += ',';
+            writeTime(out, "p" + to_string(p), b.percentile(p));
+        }
+        out += ',';
+        writeTime(out, "max", b.percentile(100));
+        out += '}';
+    }
+    return out + "]}\n";
+}
+
+int main(int argc, char *argv[])
+{
+    string jsonFile;
+    size_t numPairs = 200;
+    size_t repeat = 10;
+    unsigned seed = 1;
+    bool useHierarchy = false;
+
+    int arg = 1;
+    for (; arg < argc && string(argv[arg]).rfind("--", 0) == 0; arg++)
+    {
+        string option = argv[arg];
+        if (option.rfind("--json=", 0) == 0)
+            jsonFile = option.substr(7);
+        else if (option.rfind("--pairs=", 0) == 0)
+            numPairs = max(1, atoi(option.c_str() + 8));
+        else if (option.rfind("--repeat=", 0) == 0)
+            repeat = max(1, atoi(option.c_str() + 9));
+        else if (option.rfind("--seed=", 0) == 0)
+            seed = static_cast<unsigned>(atoi(option.c_str() + 7));
+        else if (option == "--ch")
+            useHierarchy = true;
+        else
+            break;  // unknown option
+    }
+
+    if (argc - arg != 2)
+    {
+        cout << "usage: bruintour_bench [--json=results.json] [--pairs=N] [--repeat=N] [--seed=N] [--ch] mapdata.txt stops.txt\n";
+        return 1;
+    }
+    const char* mapFile = argv[arg];
+    const char* stopsFile = argv[arg + 1];
+
+    GeoDatabase geodb;
+    Stops stops;
+    if (!geodb.load(mapFile) || geodb.num_pois() == 0)
+    {
+        cout << "Unable to load map data: " << mapFile << endl;
+        return 1;
+    }
+    if (!stops.load(stopsFile))
+    {
+        cout << "Unable to load tour data: " << stopsFile << endl;
+        return 1;
+    }
+
+    // Every benchmark's inputs are drawn from one seeded generator, so runs with the same seed are comparable
+    mt19937 rng(seed);
+    vector<GeoPoint> points;
+    vector<pair<GeoPoint, GeoPoint>> segments;
+    for (size_t i = 0; i < 1000; i++)
+    {
+        uint32_t node = rng() % geodb.num_nodes();
+        points.push_back(geodb.get_node_point(node));
+        if (geodb.edges_end(node) > geodb.edges_begin(node))
+            segments.emplace_back(points.back(), geodb.get_node_point(geodb.edge_target(geodb.edges_begin(node))));
+    }
+    vector<pair<GeoPoint, GeoPoint>> poiPairs;
+    for (size_t i = 0; i < numPairs; i++)
+    {
+        GeoPoint from, to;
+        geodb.get_poi_location(string(geodb.poi_name(rng() % geodb.num_pois())), from);
+        geodb.get_poi_location(string(geodb.poi_name(rng() % geodb.num_pois())), to);
+        poiPairs.emplace_back(from, to);
+    }
+
+    vector<Benchmark> benchmarks;
+    cout << "Map: " << geodb.num_nodes() << " nodes, " << geodb.num_edges() << " edges, "
+         << geodb.num_pois() << " points of interest; " << hardware_threads() << " threads\n";
+
+    // loading, from the text map and from a snapshot of it
+    benchmarks.push_back(measure("load_text", repeat, 1, [&](size_t) {
+        GeoDatabase loaded;
+        loaded.load(mapFile);
+    }));
+    string snapshotFile = string(mapFile) + ".bench.bin";
+    if (geodb.save_snapshot(snapshotFile))
+    {
+        benchmarks.push_back(measure("load_snapshot", repeat, 1, [&](size_t) {
+            GeoDatabase loaded;
+            loaded.load(snapshotFile);
+        }));
+        remove(snapshotFile.c_str());
+    }
+
+    // the GeoDatabaseBase lookups
+    benchmarks.push_back(measure("get_connected_points", 100, 1000, [&](size_t i) {
+        geodb.get_connected_points(points[i % points.size()]);
+    }));
+    benchmarks.push_back(measure("get_street_name", 100, 1000, [&](size_t i) {
+        const auto& segment = segments[i % segments.size()];
+        geodb.get_street_name(segment.first, segment.second);
+    }));
+    benchmarks.push_back(measure("get_poi_location", 100, 1000, [&](size_t i) {
+        GeoPoint point;
+        geodb.get_poi_location(string(geodb.poi_name(static_cast<uint32_t>(i % geodb.num_pois()))), point);
+    }));
+
+    // the batch distance and bearing kernels over every edge, against geotools one edge at a time
+    size_t numEdges = geodb.num_edges();
+    vector<double> fromLat(numEdges), fromLon(numEdges), toLat(numEdges), toLon(numEdges);
+    for (uint32_t node = 0; node < geodb.num_nodes(); node++)
+    {
+        for (uint32_t e = geodb.edges_begin(node); e < geodb.edges_end(node); e++)
+        {
+            fromLat[e] = geodb.get_node_coord(node).latitude();
+            fromLon[e] = geodb.get_node_coord(node).longitude();
+            toLat[e] = geodb.get_node_coord(geodb.edge_target(e)).latitude();
+            toLon[e] = geodb.get_node_coord(geodb.edge_target(e)).longitude();
+        }
+    }
+    vector<double> scalarDistances(numEdges), scalarBearings(numEdges);
+    benchmarks.push_back(measure("edge_distances_geotools", repeat, 1, [&](size_t) {
+        GeoPoint from, to;
+        for (size_t e = 0; e < numEdges; e++)
+        {
+            from.latitude = fromLat[e];
+            from.longitude = fromLon[e];
+            to.latitude = toLat[e];
+            to.longitude = toLon[e];
+            scalarDistances[e] = distance_earth_miles(from, to);
+            scalarBearings[e] = atan2(toLat[e] - fromLat[e], toLon[e] - fromLon[e]);
+        }
+    }));
+    vector<double> batchDistances(numEdges), batchBearings(numEdges);
+    auto runBatch = [&](size_t) {
+        batch_distance_miles(fromLat.data(), fromLon.data(), toLat.data(), toLon.data(), numEdges, batchDistances.data());
+        batch_bearings(fromLat.data(), fromLon.data(), toLat.data(), toLon.data(), numEdges, batchBearings.data());
+    };
+    vector<double> simdDistances, simdBearings;
+    if (batch_simd_enabled())
+    {
+        benchmarks.push_back(measure("edge_distances_batch_avx2", repeat, 1, runBatch));
+        simdDistances = batchDistances;
+        simdBearings = batchBearings;
+        set_batch_simd(false);
+    }
+    benchmarks.push_back(measure("edge_distances_batch_scalar", repeat, 1, runBatch));
+    set_batch_simd(true);
+    
+    // the kernels must agree with geotools to within a few units in the last place, and with each other exactly
+    double distanceUlps = 0, bearingUlps = 0;
+    for (size_t e = 0; e < numEdges; e++)
+    {
+        distanceUlps = max(distanceUlps, ulpsApart(batchDistances[e], scalarDistances[e]));
+        bearingUlps = max(bearingUlps, ulpsApart(batchBearings[e], scalarBearings[e]));
+    }
+    bool simdMatches = simdDistances.empty() || (simdDistances == batchDistances && simdBearings == batchBearings);
+    printf("batch kernels: AVX2 %s; most units in the last place from geotools: distance %.0f, bearing %.0f\n",
+           simdDistances.empty() ? "unavailable" : (simdMatches ? "matches scalar" : "DIFFERS FROM SCALAR"),
+           distanceUlps, bearingUlps);
+    if (!simdMatches || distanceUlps > MAX_BATCH_ULPS || bearingUlps > MAX_BATCH_ULPS)
+    {
+        cout << "Batch kernels are out of tolerance" << endl;
+        return 1;
+    }
+
+    // routing between the same random pairs of points of interest with each router
+    Router astar(geodb);
+    benchmarks.push_back(measure("route_astar", numPairs, 1, [&](size_t i) {
+        astar.route(poiPairs[i % numPairs].first, poiPairs[i % numPairs].second);
+    }));
+    BidirectionalRouter bidirectional(geodb);
+    benchmarks.push_back(measure("route_bidirectional", numPairs, 1, [&](size_t i) {
+        bidirectional.route(poiPairs[i % numPairs].first, poiPairs[i % numPairs].second);
+    }));
+    LandmarkHeuristic landmarks(geodb, 16);
+    Router alt(geodb, &landmarks);
+    benchmarks.push_back(measure("route_alt16", numPairs, 1, [&](size_t i) {
+        alt.route(poiPairs[i % numPairs].first, poiPairs[i % numPairs].second);
+    }));
+
+    ContractionHierarchy hierarchy;
+    if (useHierarchy)
+    {
+        benchmarks.push_back(measure("ch_build", 1, 1, [&](size_t) { hierarchy.build(geodb); }));
+        CHRouter chRouter(geodb, hierarchy);
+        benchmarks.push_back(measure("route_ch", numPairs, 1, [&](size_t i) {
+            chRouter.route(poiPairs[i % numPairs].first, poiPairs[i % numPairs].second);
+        }));
+    }
+
+    // whole tours of the stops file, in file order and with the order optimized
+    TourGenerator tours(geodb, astar);
+    benchmarks.push_back(measure("generate_tour", repeat, 1, [&](size_t) { tours.generate_tour(stops); }));
+    TourGenerator optimized(geodb, astar);
+    optimized.optimize_order();
+    benchmarks.push_back(measure("generate_tour_optimized", repeat, 1, [&](size_t) { optimized.generate_tour(stops); }));
+
+    if (!jsonFile.empty())
+    {
+        ofstream out(jsonFile);
+        out << toJson(benchmarks, geodb, seed);
+        if (!out)
+        {
+            cout << "Unable to write results: " << jsonFile << endl;
+            return 1;
+        }
+    }
+}
@@ -0,0 +1,76 @@
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include "contraction_hierarchy.h"
+#include "geodb.h"
+
+using namespace std;
+
+int main(int argc, char *argv[])
+{
+    double tileDegrees = 0;     // 0 for an untiled snapshot
+
+    int arg = 1;
+    for (; arg < argc && string(argv[arg]).rfind("--", 0) == 0; arg++)
+    {
+        string option = argv[arg];
+        if (option.rfind("--tile=", 0) == 0)
+            tileDegrees = atof(option.c_str() + 7);
+        else
+            break;  // unknown option
+    }
+
+    if (argc - arg != 2 && argc - arg != 3)
+    {
+        cout << "usage: compile_map [--tile=DEGREES] mapdata.txt mapdata.bin [mapdata.ch]\n";
+        return 1;
+    }
+
+    GeoDatabase geodb;
+    if (!geodb.load(argv[arg]))
+    {
+        cout << "Unable to load map data: " << argv[arg] << endl;
+        return 1;
+    }
+
+    // tiling renumbers the nodes, so it comes before the hierarchy is built over them
+    if (tileDegrees != 0 && !geodb.tile(tileDegrees))
+    {
+        cout << "Unable to tile the map by " << tileDegrees << " degrees" << endl;
+        return 1;
+    }
+
+    if (!geodb.save_snapshot(argv[arg + 1]))
+    {
+        cout << "Unable to write map snapshot: " << argv[arg + 1] << endl;
+        return 1;
+    }
+
+    // loading doesn't read all of a snapshot, so the file is read back and checked once here
+    GeoDatabase written;
+    if (!written.load(argv[arg + 1]) || !written.verify_snapshot())
+    {
+        cout << "Map snapshot did not read back intact: " << argv[arg + 1] << endl;
+        return 1;
+    }
+
+    cout << "Wrote " << geodb.num_nodes() << " nodes";
+    if (geodb.is_tiled())
+        cout << " in " << geodb.tile_stats().tiles << " tiles";
+    cout << " to " << argv[arg + 1] << endl;
+
+    // optionally contract the map and save the hierarchy next to it
+    if (argc - arg == 3)
+    {
+        ContractionHierarchy hierarchy;
+        hierarchy.build(geodb);
+        if (!hierarchy.save(argv[arg + 2]))
+        {
+            cout << "Unable to write contraction hierarchy: " << argv[arg + 2] << endl;
+            return 1;
+        }
+
+        cout << "Wrote contraction hierarchy to " << argv[arg + 2] << endl;
+    }
+}
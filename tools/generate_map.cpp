@@ -0,0 +1,250 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Writes a synthetic map data file and a stops file touring some of its points of interest,
+// for measuring how loading and routing scale with map size
+//
+// Intersections lie on a rows x columns lattice around Los Angeles, about 100 meters apart,
+// each nudged a little off the lattice. A grid map joins every intersection to its neighbors
+// along the rows (numbered streets) and columns (numbered avenues). A planar map keeps a
+// random spanning tree of those blocks, so the whole map stays connected, plus a random
+// share of the rest, and cuts some blocks with a diagonal, which never cross each other
+// Everything is derived from the seed, so the same options always write the same files
+
+const double CENTER_LAT = 34.05;
+const double CENTER_LON = -118.25;
+const double SPACING_LAT = 0.0009;      // degrees between rows
+const double SPACING_LON = 0.0011;      // between columns, about as far at this latitude
+const double JITTER = 0.25;             // of the spacing, each way
+
+const double PLANAR_KEEP = 0.8;         // of the blocks not in the spanning tree
+const double PLANAR_DIAGONAL = 0.15;    // of the cells
+
+const char* const POI_ADJECTIVES[] = {"Golden", "Blue", "Sunset", "Harbor", "Maple", "Royal", "Canyon", "Pacific", "Silver", "Oak"};
+const char* const POI_NOUNS[] = {"Bakery", "Library", "Park", "Museum", "Cafe", "Theater", "Market", "Gym", "Clinic", "Gallery"};
+
+class MapGenerator
+{
+public:
+    MapGenerator(bool planar, size_t target_segments, size_t target_pois, uint64_t seed)
+     : m_planar(planar), m_seed(seed), m_segments(0), m_pois(0)
+    {
+        // a lattice of n intersections has about 2n blocks; a planar map keeps the n - 1 in its
+        // spanning tree and a share of the rest, and adds diagonals
+        double perNode = planar ? 1 + PLANAR_KEEP + PLANAR_DIAGONAL : 2;
+        m_size = max<size_t>(2, static_cast<size_t>(ceil(sqrt(target_segments / perNode))));
+        m_poiChance = min(1.0, static_cast<double>(target_pois) / max<size_t>(1, target_segments));
+    }
+
+    // Writes every street segment, and picks num_stops of the points of interest to tour
+    bool write_map(FILE* out, size_t num_stops, mt19937_64& rng)
+    {
+        m_out = out;
+        m_stops.clear();
+        m_numStops = num_stops;
+        m_rng = &rng;
+
+        for (size_t r = 0; r < m_size; r++)
+        {
+            for (size_t c = 0; c < m_size; c++)
+            {
+                if (c + 1 < m_size && has_block(r, c, r, c + 1))
+                    segment(ordinal(r + 1) + " Street", r, c, r, c + 1);
+                if (r + 1 < m_size && has_block(r, c, r + 1, c))
+                    segment(ordinal(c + 1) + " Avenue", r, c, r + 1, c);
+                if (m_planar && r + 1 < m_size && c + 1 < m_size && uniform(r, c, 3) < PLANAR_DIAGONAL)
+                {
+                    if (uniform(r, c, 4) < 0.5)
+                        segment("Diagonal Road", r, c, r + 1, c + 1);
+                    else
+                        segment("Diagonal Road", r, c + 1, r + 1, c);
+                }
+            }
+        }
+        return ! ferror(out);
+    }
+
+    // Writes the picked stops in a random order
+    bool write_stops(FILE* out)
+    {
+        shuffle(m_stops.begin(), m_stops.end(), *m_rng);
+        for (size_t i = 0; i < m_stops.size(); i++)
+            fprintf(out, "%s|Stop %zu of the tour.\n", m_stops[i].c_str(), i + 1);
+        return ! ferror(out);
+    }
+
+    size_t size() const { return m_size; }
+    size_t segments() const { return m_segments; }
+    size_t pois() const { return m_pois; }
+    size_t stops() const { return m_stops.size(); }
+private:
+    bool m_planar;
+    uint64_t m_seed;
+    size_t m_size;          // intersections per row and per column
+    double m_poiChance;     // that a segment has a point of interest
+
+    FILE* m_out;
+    size_t m_segments;
+    size_t m_pois;
+    size_t m_numStops;
+    vector<string> m_stops;
+    mt19937_64* m_rng;
+
+    // A uniform number in [0, 1) fixed by the seed, a lattice position and what it's for,
+    // so anything about a position can be decided wherever it's needed without storing it
+    double uniform(size_t r, size_t c, uint64_t salt) const
+    {
+        // splitmix64 over the inputs
+        uint64_t x = m_seed ^ (r * 0x9E3779B97F4A7C15ULL) ^ (c * 0xC2B2AE3D27D4EB4FULL) ^ (salt * 0x165667B19E3779F9ULL);
+        x += 0x9E3779B97F4A7C15ULL;
+        x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+        x ^= x >> 31;
+        return (x >> 11) * (1.0 / 9007199254740992.0);
+    }
+
+    double latitude(size_t r, size_t c) const
+    {
+        double offset = static_cast<double>(r) - (m_size - 1) / 2.0;
+        return CENTER_LAT + (offset + (2 * uniform(r, c, 0) - 1) * JITTER) * SPACING_LAT;
+    }
+
+    double longitude(size_t r, size_t c) const
+    {
+        double offset = static_cast<double>(c) - (m_size - 1) / 2.0;
+        return CENTER_LON + (offset + (2 * uniform(r, c, 1) - 1) * JITTER) * SPACING_LON;
+    }
+
+    // Whether the block between two neighboring intersections is a street
+    // In a planar map, each intersection but the first keeps its block to the intersection
+    // left of it or above it, chosen at random, and those blocks form a spanning tree
+    bool has_block(size_t r1, size_t c1, size_t r2, size_t c2) const
+    {
+        if ( ! m_planar)
+            return true;
+
+        // (r2, c2) is right of or below (r1, c1); which way did it link back?
+        bool linksLeft = (r2 == 0) || (c2 > 0 && uniform(r2, c2, 2) < 0.5);
+        bool isTreeBlock = (c2 > c1) ? linksLeft : ! linksLeft;
+        return isTreeBlock || uniform(r1 * 2 + (r2 - r1), c1, 5) < PLANAR_KEEP;
+    }
+
+    static string ordinal(size_t n)
+    {
+        const char* suffix = "th";
+        if (n % 100 < 11 || n % 100 > 13)
+        {
+            if (n % 10 == 1)
+                suffix = "st";
+            else if (n % 10 == 2)
+                suffix = "nd";
+            else if (n % 10 == 3)
+                suffix = "rd";
+        }
+        return to_string(n) + suffix;
+    }
+
+    void segment(const string& street, size_t r1, size_t c1, size_t r2, size_t c2)
+    {
+        double lat1 = latitude(r1, c1), lon1 = longitude(r1, c1);
+        double lat2 = latitude(r2, c2), lon2 = longitude(r2, c2);
+        fprintf(m_out, "%s\n%.7f %.7f %.7f %.7f\n", street.c_str(), lat1, lon1, lat2, lon2);
+        m_segments++;
+
+        // a point of interest sits just off the middle of its segment
+        if (uniform(r1 * 2 + (r2 - r1), c1 * 2 + (c2 - c1), 6) >= m_poiChance)
+        {
+            fprintf(m_out, "0\n");
+            return;
+        }
+        string name = string(POI_ADJECTIVES[m_pois % 10]) + " " + POI_NOUNS[m_pois / 10 % 10] + " " + to_string(m_pois / 100 + 1);
+        fprintf(m_out, "1\n%s|%.7f %.7f\n", name.c_str(), (lat1 + lat2) / 2 + SPACING_LAT * 0.05, (lon1 + lon2) / 2);
+        m_pois++;
+
+        // reservoir sampling, so every point of interest is equally likely to be a stop
+        if (m_stops.size() < m_numStops)
+            m_stops.push_back(name);
+        else
+        {
+            size_t slot = uniform_int_distribution<size_t>(0, m_pois - 1)(*m_rng);
+            if (slot < m_numStops)
+                m_stops[slot] = name;
+        }
+    }
+};
+
+int main(int argc, char *argv[])
+{
+    bool planar = false;
+    size_t numSegments = 100000;
+    size_t numPois = 0;     // 0 for one per hundred segments
+    size_t numStops = 5;
+    uint64_t seed = 1;
+
+    int arg = 1;
+    for (; arg < argc && string(argv[arg]).rfind("--", 0) == 0; arg++)
+    {
+        string option = argv[arg];
+        if (option == "--grid")
+            planar = false;
+        else if (option == "--planar")
+            planar = true;
+        else if (option.rfind("--segments=", 0) == 0)
+            numSegments = max(1LL, atoll(option.c_str() + 11));
+        else if (option.rfind("--pois=", 0) == 0)
+            numPois = max(1LL, atoll(option.c_str() + 7));
+        else if (option.rfind("--stops=", 0) == 0)
+            numStops = max(1LL, atoll(option.c_str() + 8));
+        else if (option.rfind("--seed=", 0) == 0)
+            seed = strtoull(option.c_str() + 7, nullptr, 10);
+        else
+            break;  // unknown option
+    }
+
+    if (argc - arg != 2)
+    {
+        cout << "usage: generate_map [--grid | --planar] [--segments=N] [--pois=N] [--stops=N] [--seed=N] mapdata.txt stops.txt\n";
+        return 1;
+    }
+    if (numPois == 0)
+        numPois = max<size_t>(10, numSegments / 100);
+
+    FILE* mapFile = fopen(argv[arg], "w");
+    if (mapFile == nullptr)
+    {
+        cout << "Unable to write map data: " << argv[arg] << endl;
+        return 1;
+    }
+    vector<char> buffer(1 << 20);
+    setvbuf(mapFile, buffer.data(), _IOFBF, buffer.size());
+
+    MapGenerator generator(planar, numSegments, numPois, seed);
+    mt19937_64 rng(seed);
+    bool wrote = generator.write_map(mapFile, numStops, rng);
+    wrote = (fclose(mapFile) == 0) && wrote;
+    if (!wrote)
+    {
+        cout << "Unable to write map data: " << argv[arg] << endl;
+        return 1;
+    }
+
+    FILE* stopsFile = fopen(argv[arg + 1], "w");
+    if (stopsFile == nullptr || !generator.write_stops(stopsFile) || fclose(stopsFile) != 0)
+    {
+        cout << "Unable to write tour data: " << argv[arg + 1] << endl;
+        return 1;
+    }
+
+    cout << "Wrote " << generator.segments() << " segments on a " << generator.size() << " x " << generator.size()
+         << " lattice with " << generator.pois() << " points of interest to " << argv[arg] << endl;
+    cout << "Wrote " << generator.stops() << " stops to " << argv[arg + 1] << endl;
+}